@@ -5,6 +5,11 @@ include $(CLEAR_VARS)
 LOCAL_CPP_EXTENSION:=.cc
 LOCAL_SRC_FILES:=        \
  IAndroitShmem.cc      \
+ BinderTransport.cc    \
+ AndroitShmemRegistry.cc \
+ AndroitShmemBacking.cc \
+ AndroitShmemAttach.cc \
+ AndroitShmemCheckpoint.cc \
  AndroitShmemServer.cc \
 
 LOCAL_SHARED_LIBRARIES:= libcutils libutils libbinder
@@ -43,6 +48,11 @@ include $(CLEAR_VARS)
 LOCAL_CPP_EXTENSION:=.cc
 LOCAL_SRC_FILES:=        \
  IAndroitShmem.cc      \
+ BinderTransport.cc    \
+ AndroitShmemRegistry.cc \
+ AndroitShmemBacking.cc \
+ AndroitShmemAttach.cc \
+ AndroitShmemCheckpoint.cc \
  AndroitShmemClient.cc \
 
 LOCAL_SHARED_LIBRARIES:= libcutils libutils libbinder
@@ -57,6 +67,72 @@ LOCAL_PRELINK_MODULE:=false
 include $(BUILD_EXECUTABLE)
 
 
+############# Statistics ################
+include $(CLEAR_VARS)
+LOCAL_CPP_EXTENSION:=.cc
+LOCAL_SRC_FILES:=        \
+ IAndroitShmem.cc      \
+ BinderTransport.cc    \
+ AndroitShmemRegistry.cc \
+ AndroitShmemBacking.cc \
+ AndroitShmemAttach.cc \
+ AndroitShmemCheckpoint.cc \
+ AndroitShmemStat.cc \
+
+LOCAL_SHARED_LIBRARIES:= libcutils libutils libbinder
+
+LOCAL_MODULE:= AndroitShmemStat
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_CFLAGS+=-DLOG_TAG=\"AndroitShmemStat\"
+LOCAL_CPPFLAGS  := -I$(LOCAL_PATH)/include
+
+LOCAL_PRELINK_MODULE:=false
+include $(BUILD_EXECUTABLE)
+
+
+############# Benchmark ################
+include $(CLEAR_VARS)
+LOCAL_CPP_EXTENSION:=.cc
+LOCAL_SRC_FILES:=        \
+ IAndroitShmem.cc      \
+ BinderTransport.cc    \
+ AndroitShmemRegistry.cc \
+ AndroitShmemBacking.cc \
+ AndroitShmemAttach.cc \
+ AndroitShmemCheckpoint.cc \
+ bench/AndroitShmemBench.cc \
+
+LOCAL_SHARED_LIBRARIES:= libcutils libutils libbinder
+
+LOCAL_MODULE:= AndroitShmemBench
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_CFLAGS+=-DLOG_TAG=\"AndroitShmemBench\"
+LOCAL_CPPFLAGS  := -I$(LOCAL_PATH)/include
+
+LOCAL_PRELINK_MODULE:=false
+include $(BUILD_EXECUTABLE)
+
+
+############# Checks ################
+include $(CLEAR_VARS)
+LOCAL_CPP_EXTENSION:=.cc
+LOCAL_SRC_FILES:=        \
+ bench/AndroitShmemCheck.cc \
+
+LOCAL_SHARED_LIBRARIES:= libcutils
+
+LOCAL_MODULE:= AndroitShmemCheck
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_CFLAGS+=-DLOG_TAG=\"AndroitShmemCheck\"
+LOCAL_CPPFLAGS  := -I$(LOCAL_PATH)/include
+
+LOCAL_PRELINK_MODULE:=false
+include $(BUILD_EXECUTABLE)
+
+
 ############# Shared Library ################
 include $(CLEAR_VARS)
 LOCAL_CPP_EXTENSION:=.cc
@@ -66,7 +142,7 @@ LOCAL_CFLAGS  := -I$(LOCAL_PATH)/include
 LOCAL_CFLAGS  +=-DLOG_TAG=\"AndroitShLib\"
 
 LOCAL_PATH	:= $(LOCAL_PATH)/shlib
-LOCAL_SRC_FILES := shmem-lib.cc ../IAndroitShmem.cc
+LOCAL_SRC_FILES := shmem-lib.cc channel-lib.cc ../IAndroitShmem.cc ../BinderTransport.cc ../AndroitShmemRegistry.cc ../AndroitShmemBacking.cc ../AndroitShmemAttach.cc ../AndroitShmemCheckpoint.cc
 # NOTE: libutils is required for strong pointers, libbinder for the
 # service manager interaction
 LOCAL_SHARED_LIBRARIES := liblog libutils libbinder
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <AndroitShmemAttach.h>
+#include <AndroitShmemBacking.h>
+#include <AndroitShmemTransport.h>
+
+using namespace androit;
+
+// Prefaults and locks the mapping of a for ATTACH_LOCK
+static void attach_lock(struct attachment *a) {
+	int ret = backing_prefault(a->base, a->size);
+
+	if (ret < 0)
+		LOGE("Could not prefault region: %d (%s)", -ret, strerror(-ret));
+
+	// Fails beyond RLIMIT_MEMLOCK without CAP_IPC_LOCK, the region stays usable
+	if (mlock(a->base, a->size) < 0)
+		LOGE("Could not lock region: %d (%s)", errno, strerror(errno));
+}
+
+int androit::attach_fd(int fd, struct attachment *a, int flags) {
+	struct stat st;
+	void *base;
+
+	if (fstat(fd, &st) < 0)
+		return -errno;
+
+	// Not (yet) sized by the server
+	if ((size_t)st.st_size < sizeof(struct region_header))
+		return -ENODEV;
+
+	base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED)
+		return -errno;
+
+	a->base = base;
+	a->size = st.st_size;
+	a->fd = fd;
+	a->flags = flags;
+
+	if (flags & ATTACH_LOCK)
+		attach_lock(a);
+
+	return 0;
+}
+
+int androit::attach_name(const char *name, struct attachment *a, int flags) {
+	int fd = -ENOENT, ret;
+
+	if (flags & ATTACH_DIRECT) {
+		fd = backing_attach(name);
+		if (fd >= 0) {
+			ret = attach_fd(fd, a, flags);
+			if (ret != 0)
+				close(fd);
+			return ret;
+		}
+	}
+
+	// No backing file (anonymous regions) or no permission to open it
+	if ((flags & ATTACH_SERVICE) && (fd == -ENOENT || fd == -EACCES)) {
+		size_t size = 0;
+		void *base = Transport::get()->attach(name, &size);
+
+		if (base == NULL)
+			return -ENOENT;
+
+		a->base = base;
+		a->size = size;
+		a->fd = -1;
+		a->flags = flags;
+
+		// The transport prefaults already
+		if ((flags & ATTACH_LOCK) && mlock(a->base, a->size) < 0)
+			LOGE("Could not lock region %s: %d (%s)", name, errno, strerror(errno));
+
+		return 0;
+	}
+
+	return fd;
+}
+
+bool androit::attach_stale(const struct attachment *a) {
+	struct stat st;
+
+	if (a->fd < 0)
+		return false;
+
+	// The server removes the file of a region before it creates it anew
+	if (fstat(a->fd, &st) < 0)
+		return true;
+
+	return st.st_nlink == 0 || (size_t)st.st_size != a->size;
+}
+
+void androit::detach(struct attachment *a) {
+	if (a->fd >= 0) {
+		munmap(a->base, a->size);
+		close(a->fd);
+	}
+
+	attachment_init(a);
+}
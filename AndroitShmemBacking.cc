@@ -0,0 +1,234 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <string>
+
+#include <AndroitShmemBacking.h>
+#include <AndroitShmemLog.h>
+
+// Not every C library has these yet
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB 0x0004U
+#endif
+#define ANDROIT_MPOL_BIND 2
+
+using namespace androit;
+
+enum {
+	// Huge page size if the kernel does not tell
+	HUGE_PAGE_DEFAULT = 2 * 1024 * 1024,
+	// Nodes backing_map() can bind to
+	NUMA_NODES_MAX = 1024
+};
+
+// Returns the first number in file path after prefix (a line start), or fallback
+static size_t read_size(const char *path, const char *prefix, size_t fallback, size_t unit) {
+	char line[128];
+	size_t value = fallback;
+	FILE *f = fopen(path, "r");
+
+	if (f == NULL)
+		return fallback;
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (strncmp(line, prefix, strlen(prefix)) == 0) {
+			value = strtoull(line + strlen(prefix), NULL, 10) * unit;
+			break;
+		}
+	}
+
+	fclose(f);
+	return value != 0 ? value : fallback;
+}
+
+static size_t page_size(enum backing_pages pages) {
+	switch (pages) {
+	case BACKING_THP:
+		return read_size("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "", HUGE_PAGE_DEFAULT, 1);
+	case BACKING_HUGETLB:
+		return read_size("/proc/meminfo", "Hugepagesize:", HUGE_PAGE_DEFAULT, 1024);
+	default:
+		return sysconf(_SC_PAGESIZE);
+	}
+}
+
+// Returns the path of the file backing region name (relative to /dev/shm for shm_open())
+static std::string backing_path(const char *name, enum backing_pages pages) {
+#ifdef __ANDROID__
+	(void)pages;
+	return std::string("/mnt/shm/") + name;
+#else
+	if (pages == BACKING_HUGETLB) {
+		const char *dir = getenv("ANDROIT_SHMEM_HUGETLBFS");
+
+		return std::string(dir != NULL ? dir : "/dev/hugepages") + "/androitshmem." + name;
+	}
+
+	return std::string("/androitshmem.") + name;
+#endif
+}
+
+int androit::backing_open(const char *name, const struct region_backing *backing, bool anonymous) {
+	std::string path = backing_path(name, backing->pages);
+	int fd;
+
+#ifdef __ANDROID__
+	if (backing->pages == BACKING_HUGETLB)
+		return -EOPNOTSUPP;
+
+	// NOTE: We explicitely _don't_ use the ashmem allocator because we
+	// don't want the shared memory to be reclaimable. Mapping
+	// a file (or file descriptor) ensures that Android bases the
+	// mapping on mmap.
+	(void)anonymous;
+	fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+#else
+	if (anonymous) {
+		path = std::string("androitshmem.") + name;
+		fd = memfd_create(path.c_str(), MFD_CLOEXEC | (backing->pages == BACKING_HUGETLB ? MFD_HUGETLB : 0));
+	} else if (backing->pages == BACKING_HUGETLB) {
+		fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	} else {
+		fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	}
+#endif
+
+	return fd < 0 ? -errno : fd;
+}
+
+int androit::backing_attach(const char *name) {
+	int fd;
+
+#ifdef __ANDROID__
+	fd = open(backing_path(name, BACKING_DEFAULT).c_str(), O_RDWR | O_CLOEXEC);
+#else
+	// The client does not know the pages of the region, try both places
+	fd = shm_open(backing_path(name, BACKING_DEFAULT).c_str(), O_RDWR | O_CLOEXEC, 0);
+	if (fd < 0 && errno == ENOENT)
+		fd = open(backing_path(name, BACKING_HUGETLB).c_str(), O_RDWR | O_CLOEXEC);
+#endif
+
+	return fd < 0 ? -errno : fd;
+}
+
+int androit::backing_unlink(const char *name, const struct region_backing *backing) {
+	std::string path = backing_path(name, backing->pages);
+	int ret;
+
+#ifdef __ANDROID__
+	ret = unlink(path.c_str());
+#else
+	if (backing->pages == BACKING_HUGETLB)
+		ret = unlink(path.c_str());
+	else
+		ret = shm_unlink(path.c_str());
+#endif
+
+	return ret < 0 && errno != ENOENT ? -errno : 0;
+}
+
+size_t androit::backing_size(size_t size, const struct region_backing *backing) {
+	size_t page;
+
+	if (backing->pages == BACKING_DEFAULT)
+		return size;
+
+	page = page_size(backing->pages);
+	return (size + page - 1) / page * page;
+}
+
+int androit::backing_prefault(void *base, size_t size) {
+	size_t page = sysconf(_SC_PAGESIZE);
+
+	if (madvise(base, size, MADV_POPULATE_WRITE) == 0)
+		return 0;
+	if (errno != EINVAL)
+		return -errno;
+
+	/* Kernels before 5.14: read every page. shmem maps pages writable on
+	 * read faults, and reading cannot interfere with writers of a region
+	 * that is in use already. */
+	for (size_t offset = 0; offset < size; offset += page)
+		(void)*(volatile const char*)((const char*)base + offset);
+
+	return 0;
+}
+
+void *androit::backing_map(int fd, size_t size, const struct region_backing *backing) {
+	void *base;
+	int res;
+
+	if (ftruncate(fd, size) < 0)
+		return MAP_FAILED;
+
+	base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED)
+		return MAP_FAILED;
+
+	// Before any page is faulted in: pages are allocated by the first fault
+	if (backing->pages == BACKING_THP && madvise(base, size, MADV_HUGEPAGE) < 0)
+		LOGE("Could not enable transparent huge pages: %d (%s)", errno, strerror(errno));
+
+	if (backing->numa_node >= 0 && backing->numa_node < NUMA_NODES_MAX) {
+		unsigned long mask[NUMA_NODES_MAX / (8 * sizeof(long))];
+
+		memset(mask, 0, sizeof(mask));
+		mask[backing->numa_node / (8 * sizeof(long))] |= 1UL << (backing->numa_node % (8 * sizeof(long)));
+		if (syscall(__NR_mbind, base, size, ANDROIT_MPOL_BIND, mask, backing->numa_node + 2, 0) < 0)
+			LOGE("Could not bind region to NUMA node %d: %d (%s)", backing->numa_node, errno, strerror(errno));
+	}
+
+	if (backing->prefault) {
+		res = backing_prefault(base, size);
+		if (res < 0)
+			LOGE("Could not prefault region: %d (%s)", -res, strerror(-res));
+	}
+
+	// Lock file mapping into memory to avoid it to be swapped out
+	res = mlock(base, size);
+
+	if (res < 0) {
+		LOGE("Could not lock memory: %d (%s)", errno, 
+			 strerror(errno));
+	}
+
+	return base;
+}
+
+bool androit::backing_parse_pages(const char *arg, enum backing_pages *pages) {
+	if (strcmp(arg, "4k") == 0)
+		*pages = BACKING_DEFAULT;
+	else if (strcmp(arg, "thp") == 0)
+		*pages = BACKING_THP;
+	else if (strcmp(arg, "huge") == 0)
+		*pages = BACKING_HUGETLB;
+	else
+		return false;
+
+	return true;
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+#include <AndroitShmemCheckpoint.h>
+
+using namespace androit;
+
+// Table of checkpoint_crc(), built once by crc_init()
+static uint32_t crc_table[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_init(void) {
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t c = i;
+
+		for (int k = 0; k < 8; k++)
+			c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+		crc_table[i] = c;
+	}
+}
+
+uint32_t androit::checkpoint_crc(const void *data, size_t len) {
+	const uint8_t *p = (const uint8_t*)data;
+	uint32_t crc = 0xffffffff;
+
+	// The checkpoint thread and the registry compute CRCs concurrently
+	pthread_once(&crc_once, crc_init);
+
+	while (len-- > 0)
+		crc = crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return crc ^ 0xffffffff;
+}
+
+// Writes len bytes of buf to fd completely, returns 0 or -errno
+static int write_all(int fd, const void *buf, size_t len) {
+	const char *p = (const char*)buf;
+
+	while (len > 0) {
+		ssize_t ret = write(fd, p, len);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+// Reads len bytes from fd into buf, returns 0, -EIO if the file is shorter or -errno
+static int read_all(int fd, void *buf, size_t len) {
+	char *p = (char*)buf;
+
+	while (len > 0) {
+		ssize_t ret = read(fd, p, len);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (ret == 0)
+			return -EIO;
+		p += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+int androit::checkpoint_write(const char *dir, const char *name, struct checkpoint_file *header, const void *data) {
+	std::string path = std::string(dir) + "/" + name + ".ckpt";
+	std::string tmp = path + ".tmp";
+	int fd, ret;
+
+	header->magic = CHECKPOINT_MAGIC;
+	header->version = CHECKPOINT_VERSION;
+	header->crc = checkpoint_crc(data, header->data_size);
+
+	fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return -errno;
+
+	ret = write_all(fd, header, sizeof(*header));
+	if (ret == 0)
+		ret = write_all(fd, data, header->data_size);
+	// The data is on disk before the rename makes it the checkpoint
+	if (ret == 0 && fsync(fd) < 0)
+		ret = -errno;
+	close(fd);
+
+	if (ret == 0 && rename(tmp.c_str(), path.c_str()) < 0)
+		ret = -errno;
+	if (ret != 0) {
+		unlink(tmp.c_str());
+		return ret;
+	}
+
+	// The rename is on disk as well: a crash does not bring back the previous checkpoint
+	fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	if (fsync(fd) < 0)
+		ret = -errno;
+	close(fd);
+
+	return ret;
+}
+
+int androit::checkpoint_read(const char *dir, const char *name, size_t data_size, uint32_t hash,
+			     struct checkpoint_file *header, void *data) {
+	std::string path = std::string(dir) + "/" + name + ".ckpt";
+	int fd, ret;
+
+	fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	ret = read_all(fd, header, sizeof(*header));
+	if (ret == 0 && (header->magic != CHECKPOINT_MAGIC || header->version != CHECKPOINT_VERSION))
+		ret = -EIO;
+	if (ret == 0 && (header->data_size != data_size || header->layout_hash != hash))
+		ret = -EINVAL;
+	if (ret == 0)
+		ret = read_all(fd, data, data_size);
+	if (ret == 0 && checkpoint_crc(data, data_size) != header->crc)
+		ret = -EIO;
+
+	close(fd);
+	return ret;
+}
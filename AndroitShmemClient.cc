@@ -15,55 +15,38 @@
  * limitations under the License.
  */
 
-#include "IAndroitShmem.h"
-#include <binder/MemoryHeapBase.h>
-#include <binder/IServiceManager.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
-using namespace android;
-using namespace androit;
+#include <AndroitShmem.h>
+#include <AndroitShmemAttach.h>
+#include <AndroitShmemHistory.h>
+#include <AndroitShmemLog.h>
+#include <AndroitShmemTransport.h>
 
-// Function for client to obtain pointer to shared memory
-struct shared* getSharedData(void) {
-	static sp<IAndroitShmem> androitShmem = NULL;
-	static sp<IMemoryHeap> receiverMemBase = NULL;
+using namespace androit;
 
-	sp<IBinder> binder;
-	
-	// Acquire remote interface to AndroitShmem service from ServiceManager
-	if (androitShmem == NULL) {
-		sp<IServiceManager> sm = defaultServiceManager();
-		binder = sm->getService(String16("vendor.androit.shmem"));
+// Attachment of region "map", replaced if the server restarts
+static struct attachment sharedAttachment = { NULL, 0, -1, 0 };
 
-		if (binder != 0) {
-			androitShmem = IAndroitShmem::asInterface(binder);
-		}
-	}
-	
-	// Abort if AndroitShmem service is not published
-	if (androitShmem == NULL) {
-		LOGE("The AndroitShmem service is not published");
-		return NULL;
-	}
-	
-	// Acquire pointer to shared MemoryHeap from AndroitShmem service if not already done
-	if (receiverMemBase == NULL) {
-		LOGD("Getting handle to shared data via binder...");
-		receiverMemBase = androitShmem->getShmem();		
-	}
-	
-	// Return pointer to shared memory
-	return (struct shared*)receiverMemBase->getBase();
+/* Function for client to obtain pointer to shared memory. Attaches directly
+ * without a service round trip, the pages are faulted in and locked. */
+shared<data_struct> *getSharedData(void) {
+	return reattach_region<shared<data_struct> >("map", &sharedAttachment, ATTACH_DEFAULT | ATTACH_LOCK);
 }
 
-void doWrite(void *arg) {
-	struct shared *container = getSharedData();
+void doWrite(void *) {
+	shared<data_struct> *container = getSharedData();
+	// Optional, recorded into if the server keeps a history of the region
+	struct history *hist = getHistory<data_struct>("map.history");
 	int active_data;
 
 	if(container != NULL) {
 		// --- Write Test ---		
 		LOGD("Write test");
 		begin_rt_write(container);
-		LOGD("sequence after lock:\t%d", container->protect.sequence);
+		LOGD("sequence after lock:\t%llu", (unsigned long long)container->protect.sequence);
 		
 		// Determine active data copy by looking at 1-bit of sequence counter
 		active_data = container->protect.sequence & 1;
@@ -73,14 +56,17 @@ void doWrite(void *arg) {
 		     
 		sleep(3); // For TESTING
     
+		// Announce the modification to non-RT writers
+		rt_mark_dirty(container, &container->data[active_data].integer,
+			      sizeof(int) + sizeof(float));
 		container->data[active_data].integer = container->data[active_data].integer+1;
 		container->data[active_data].fp = container->data[active_data].fp*1.234;
     
 		LOGD("AndroitShmem after access: base=%p, integer=%d, float=%f", 
 			container, container->data[active_data].integer, container->data[active_data].fp);	
 			
-		end_rt_write(container);
-		LOGD("sequence after unlock:\t%d", container->protect.sequence);
+		end_rt_write(container, hist);
+		LOGD("sequence after unlock:\t%llu", (unsigned long long)container->protect.sequence);
 		LOGD("Write test finished");
 	} else {
 		LOGE("Error: Androit shared memory not available\n");
@@ -89,9 +75,9 @@ void doWrite(void *arg) {
 	//pthread_exit((void *) 0);
 }
 
-void doRead(void *arg) {
-	struct shared *container = getSharedData();
-	unsigned int start_seq;
+void doRead(void *) {
+	shared<data_struct> *container = getSharedData();
+	seq_t start_seq;
 	int active_data;
 
 	if(container != NULL) {
@@ -105,15 +91,18 @@ void doRead(void *arg) {
 			// Determine active data copy by looking at 1-bit of sequence counter
 			active_data = container->protect.sequence & 1;
 			
-			LOGD("AndroitShmem read content: base=%p, integer=%d, float=%f, start_seq=%d, seq=%d",
-				container, container->data[active_data].integer, container->data[active_data].fp, start_seq, container->protect.sequence);
+			LOGD("AndroitShmem read content: base=%p, integer=%d, float=%f, start_seq=%llu, seq=%llu",
+				container, container->data[active_data].integer, container->data[active_data].fp,
+				(unsigned long long)start_seq, (unsigned long long)container->protect.sequence);
 			
-			LOGD("Sequence counter values after read try: start_seq=%d, seq=%d", start_seq, container->protect.sequence);
+			LOGD("Sequence counter values after read try: start_seq=%llu, seq=%llu", (unsigned long long)start_seq,
+			     (unsigned long long)container->protect.sequence);
 			
 			// Check if read was consistent, retry if it was not
 		} while (seq_doretry(container, start_seq));
 		
-		LOGD("Read was finished, current sequences: start_seq=%d, seq=%d (may have changed since then)", start_seq, container->protect.sequence);
+		LOGD("Read was finished, current sequences: start_seq=%llu, seq=%llu (may have changed since then)",
+		     (unsigned long long)start_seq, (unsigned long long)container->protect.sequence);
 	} else {
 		LOGE("Error: Androit shared memory not available\n");
 	}
@@ -121,7 +110,44 @@ void doRead(void *arg) {
 	//pthread_exit((void *) 0);
 }
 
-int main(int argc, char *argv[]) {
+// Lists the versions of integer and float the history of the region holds
+void doHistory(void *) {
+	struct history *hist = getHistory<data_struct>("map.history");
+	struct {
+		int integer;
+		float fp;
+	} values[8];
+	struct history_stamp stamps[8];
+	bool lost;
+	int count;
+
+	if (hist != NULL) {
+		count = history_read(hist, HISTORY_ALL, offsetof(struct data_struct, integer), sizeof(values[0]),
+				     values, stamps, 8, &lost);
+		for (int i = 0; i < count; i++)
+			LOGD("Version %llu at %llu ns: integer=%d, float=%f", (unsigned long long)stamps[i].seq,
+			     (unsigned long long)stamps[i].time_ns, values[i].integer, values[i].fp);
+	} else {
+		LOGE("Error: Androit history not available\n");
+	}
+}
+
+// Posts an event to the channel of the server, consumers receive every one
+void doEvent(void *) {
+	struct channel *events = getChannel("events");
+	char msg[64];
+	int ret;
+
+	if (events != NULL) {
+		snprintf(msg, sizeof(msg), "write test finished by %d", (int)getpid());
+		ret = channel_send(events, msg, strlen(msg) + 1);
+		LOGD("Event sent: %d, %u messages dropped so far", ret, events->dropped);
+	} else {
+		LOGE("Error: Androit event channel not available\n");
+	}
+}
+
+int main() {
 	// -- two thread test --
 	/* pthread_t writer[2];
 	
@@ -136,7 +162,9 @@ int main(int argc, char *argv[]) {
 	
 	// -- one thread test --
 	doWrite((void *)NULL);
+	doEvent((void *)NULL);
 	doRead((void *)NULL);
+	doHistory((void *)NULL);
 		
 	return 0;
 }
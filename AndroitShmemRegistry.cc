@@ -0,0 +1,376 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <AndroitShmemRegistry.h>
+
+using namespace androit;
+
+RegionRegistry::RegionRegistry(bool anonymous) : backing(default_backing()), anonymous(anonymous),
+	checkpointPeriod(0), checkpointRunning(false), checkpointStop(false), applyRunning(false),
+	applyStop(false) {
+	pthread_condattr_t attr;
+
+	pthread_mutex_init(&checkpointLock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&checkpointCond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+RegionRegistry::~RegionRegistry() {
+	std::map<std::string, region_entry>::iterator it;
+
+	if (checkpointRunning) {
+		pthread_mutex_lock(&checkpointLock);
+		checkpointStop = true;
+		pthread_cond_signal(&checkpointCond);
+		pthread_mutex_unlock(&checkpointLock);
+		pthread_join(checkpointThread, NULL);
+	}
+
+	if (applyRunning) {
+		std::list<struct apply_drain>::iterator drain;
+
+		store_release(&applyStop, true);
+		for (drain = drains.begin(); drain != drains.end(); ++drain)
+			pthread_join(drain->thread, NULL);
+	}
+
+	for (it = regions.begin(); it != regions.end(); ++it) {
+		munmap(it->second.base, it->second.size);
+		close(it->second.fd);
+	}
+}
+
+const region_entry *RegionRegistry::find(const char *name) const {
+	std::map<std::string, region_entry>::const_iterator it = regions.find(name);
+
+	if (it == regions.end())
+		return NULL;
+
+	return &it->second;
+}
+
+int RegionRegistry::addChannel(const char *name, unsigned int capacity, size_t msg_size,
+			       enum channel_policy policy, bool multi_producer) {
+	region_entry *entry;
+
+	if (find(name) != NULL) {
+		LOGE("Region %s is already registered", name);
+		return -EEXIST;
+	}
+
+	// Check the parameters before creating the backing
+	if (!channel_valid(capacity, msg_size, policy)) {
+		LOGE("Invalid parameters of channel %s: %u slots of %zu bytes", name, capacity, msg_size);
+		return -EINVAL;
+	}
+
+	entry = create(name, channel_size(capacity, msg_size));
+	if (entry == NULL)
+		return -ENOMEM;
+
+	init_channel((struct channel*)entry->base, capacity, msg_size, policy, multi_producer);
+	publish_header(&((struct channel*)entry->base)->header);
+
+	LOGD("Channel %s (%u slots of %zu bytes) registered", name, capacity, msg_size);
+	return 0;
+}
+
+int RegionRegistry::addHistory(const char *name, unsigned int capacity, size_t data_size, uint32_t hash) {
+	region_entry *entry;
+
+	if (find(name) != NULL) {
+		LOGE("Region %s is already registered", name);
+		return -EEXIST;
+	}
+
+	if (!history_valid(capacity, data_size)) {
+		LOGE("Invalid parameters of history %s: %u versions of %zu bytes", name, capacity, data_size);
+		return -EINVAL;
+	}
+
+	entry = create(name, history_size(capacity, data_size));
+	if (entry == NULL)
+		return -ENOMEM;
+
+	init_history((struct history*)entry->base, capacity, data_size, hash);
+	publish_header(&((struct history*)entry->base)->header);
+
+	LOGD("History %s (%u versions of %zu bytes) registered", name, capacity, data_size);
+	return 0;
+}
+
+int RegionRegistry::addApplyQueue(const char *name, unsigned int capacity, size_t batch_size, size_t data_size,
+				  uint32_t hash) {
+	region_entry *entry;
+
+	if (find(name) != NULL) {
+		LOGE("Region %s is already registered", name);
+		return -EEXIST;
+	}
+
+	if (!apply_queue_valid(capacity, batch_size)) {
+		LOGE("Invalid parameters of apply queue %s: %u slots of %zu bytes", name, capacity, batch_size);
+		return -EINVAL;
+	}
+
+	entry = create(name, apply_queue_size(capacity, batch_size));
+	if (entry == NULL)
+		return -ENOMEM;
+
+	init_apply_queue((struct apply_queue*)entry->base, capacity, batch_size, data_size, hash);
+	publish_header(&((struct apply_queue*)entry->base)->header);
+
+	LOGD("Apply queue %s (%u slots of %zu bytes) registered", name, capacity, batch_size);
+	return 0;
+}
+
+int RegionRegistry::addCombiner(const char *name, unsigned int capacity, size_t batch_size, size_t data_size,
+				uint32_t hash) {
+	region_entry *entry;
+
+	if (find(name) != NULL) {
+		LOGE("Region %s is already registered", name);
+		return -EEXIST;
+	}
+
+	if (!combiner_valid(capacity, batch_size)) {
+		LOGE("Invalid parameters of combiner %s: %u slots of %zu bytes", name, capacity, batch_size);
+		return -EINVAL;
+	}
+
+	entry = create(name, combiner_size(capacity, batch_size));
+	if (entry == NULL)
+		return -ENOMEM;
+
+	init_combiner((struct combiner*)entry->base, capacity, batch_size, data_size, hash);
+	publish_header(&((struct combiner*)entry->base)->header);
+
+	LOGD("Combiner %s (%u slots of %zu bytes) registered", name, capacity, batch_size);
+	return 0;
+}
+
+/* Creates the mapping of region name with size bytes. Direct attachers can
+ * open it from now on: callers publish_header() it once it is set up. */
+region_entry *RegionRegistry::create(const char *name, size_t size) {
+	region_entry entry;
+
+	entry.name = name;
+	entry.size = backing_size(size, &backing);
+	entry.snapshot = NULL;
+	entry.data_size = 0;
+	entry.hash = 0;
+	entry.checkpoint_seq = 0;
+	entry.checkpointed = false;
+
+	/* A region left behind by a previous instance is still mapped by its
+	 * clients, possibly with a writer lock held: create a new file instead
+	 * of reinitialising it under them. They notice the old one is gone
+	 * and reattach (see attach_stale()). Anonymous regions must not leave
+	 * such a file for direct attaches either. */
+	backing_unlink(name, &backing);
+
+	entry.fd = backing_open(name, &backing, anonymous);
+	if (entry.fd < 0) {
+		LOGE("Could not create backing of region %s: %d (%s)", name, -entry.fd,
+			 strerror(-entry.fd));
+		return NULL;
+	}
+
+	// Sized, bound to a node, prefaulted and locked as configured by setBacking()
+	entry.base = backing_map(entry.fd, entry.size, &backing);
+	if (entry.base == MAP_FAILED) {
+		LOGE("Could not map region %s: %d (%s)", name, errno, strerror(errno));
+		close(entry.fd);
+		return NULL;
+	}
+
+	LOGD("Base: %p, size: %zu, fd: %d", entry.base, entry.size, entry.fd);
+
+	return &(regions[name] = entry);
+}
+
+/* Removes a region create() made that could not be set up: neither a retry
+ * nor direct attachers find it afterwards */
+void RegionRegistry::destroy(region_entry *entry) {
+	std::string name = entry->name;
+
+	munmap(entry->base, entry->size);
+	close(entry->fd);
+	backing_unlink(name.c_str(), &backing);
+	regions.erase(name);
+}
+
+// Wall clock time of checkpoints, they outlive the boot
+static uint64_t realtime_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Reads the checkpoint of a region that was just created into data, returns true if there is a valid one
+bool RegionRegistry::readCheckpoint(region_entry *entry, void *data) {
+	struct checkpoint_file header;
+	int ret = checkpoint_read(checkpointDir.c_str(), entry->name.c_str(), entry->data_size, entry->hash,
+				  &header, data);
+
+	if (ret == -ENOENT)
+		return false;
+	if (ret != 0) {
+		LOGE("Checkpoint of region %s not restored: %d (%s)", entry->name.c_str(), -ret, strerror(-ret));
+		return false;
+	}
+
+	LOGD("Region %s restored from its checkpoint at sequence %llu (%llu s old)", entry->name.c_str(),
+	     (unsigned long long)header.sequence, (unsigned long long)((realtime_ns() - header.time_ns) / 1000000000ULL));
+	return true;
+}
+
+int RegionRegistry::checkpoint() {
+	std::map<std::string, region_entry>::iterator it;
+	std::vector<char> data;
+	int written = 0, ret = 0;
+
+	if (checkpointDir.empty())
+		return -EINVAL;
+
+	pthread_mutex_lock(&checkpointLock);
+	for (it = regions.begin(); it != regions.end(); ++it) {
+		region_entry *entry = &it->second;
+		struct checkpoint_file header;
+		int result;
+
+		if (entry->snapshot == NULL)
+			continue;
+
+		// Copied out like a reader does, writers do not wait for the checkpoint
+		data.resize(entry->data_size);
+		header.sequence = entry->snapshot(entry->base, &data[0]);
+		if (entry->checkpointed && header.sequence == entry->checkpoint_seq)
+			continue;
+
+		header.data_size = entry->data_size;
+		header.layout_hash = entry->hash;
+		header.time_ns = realtime_ns();
+		result = checkpoint_write(checkpointDir.c_str(), entry->name.c_str(), &header, &data[0]);
+		if (result != 0) {
+			LOGE("Could not write checkpoint of region %s: %d (%s)", entry->name.c_str(), -result,
+			     strerror(-result));
+			ret = result;
+			continue;
+		}
+
+		entry->checkpoint_seq = header.sequence;
+		entry->checkpointed = true;
+		written++;
+	}
+	pthread_mutex_unlock(&checkpointLock);
+
+	return ret != 0 ? ret : written;
+}
+
+void *RegionRegistry::checkpointLoop(void *arg) {
+	RegionRegistry *registry = (RegionRegistry*)arg;
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	for (;;) {
+		deadline.tv_sec += registry->checkpointPeriod;
+
+		pthread_mutex_lock(&registry->checkpointLock);
+		while (!registry->checkpointStop &&
+		       pthread_cond_timedwait(&registry->checkpointCond, &registry->checkpointLock, &deadline) != ETIMEDOUT)
+			;
+		if (registry->checkpointStop) {
+			pthread_mutex_unlock(&registry->checkpointLock);
+			break;
+		}
+		pthread_mutex_unlock(&registry->checkpointLock);
+
+		registry->checkpoint();
+	}
+
+	return NULL;
+}
+
+int RegionRegistry::startCheckpoints() {
+	int ret;
+
+	if (checkpointDir.empty() || checkpointPeriod == 0 || checkpointRunning)
+		return -EINVAL;
+
+	ret = pthread_create(&checkpointThread, NULL, checkpointLoop, this);
+	if (ret != 0)
+		return -ret;
+
+	checkpointRunning = true;
+	LOGD("Checkpoints of the regions every %u s in %s", checkpointPeriod, checkpointDir.c_str());
+	return 0;
+}
+
+// Drain threads check for a stop request this often
+static const struct timespec apply_poll = { 0, 100 * 1000000L };
+
+void *RegionRegistry::applyLoop(void *arg) {
+	struct apply_drain *drain = (struct apply_drain*)arg;
+	int ret;
+
+	while (!load_acquire(drain->stop)) {
+		if (apply_wait_ready(drain->queue, &apply_poll) != 0)
+			continue;
+
+		ret = drain->commit(drain->region, drain->queue, drain->history);
+		if (ret < 0)
+			LOGE("Delegated writes could not be applied: %d (%s)", -ret, strerror(-ret));
+	}
+
+	return NULL;
+}
+
+int RegionRegistry::startApply() {
+	std::list<struct apply_drain>::iterator drain;
+	int ret;
+
+	if (applyRunning)
+		return -EINVAL;
+
+	for (drain = drains.begin(); drain != drains.end(); ++drain) {
+		ret = pthread_create(&drain->thread, NULL, applyLoop, &*drain);
+		if (ret != 0) {
+			// Stop the ones already running, they would never be joined
+			store_release(&applyStop, true);
+			while (drain != drains.begin())
+				pthread_join((--drain)->thread, NULL);
+			applyStop = false;
+			return -ret;
+		}
+	}
+
+	applyRunning = true;
+	LOGD("Apply queues drained by %zu threads", drains.size());
+	return 0;
+}
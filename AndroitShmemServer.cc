@@ -15,138 +15,149 @@
  * limitations under the License.
  */
 
-#include "IAndroitShmem.h"
-#include <binder/MemoryHeapBase.h>
-#include <binder/IServiceManager.h>
-#include <binder/IPCThreadState.h>
-#include <stddef.h> // offsetof()
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+
+#include <AndroitShmem.h>
+#include <AndroitShmemBacking.h>
+#include <AndroitShmemLog.h>
+#include <AndroitShmemRegistry.h>
+#include <AndroitShmemTransport.h>
 
-using namespace android;
 using namespace androit;
 
 // NOTE: <cutils/atomic.h> contains definitions for atomic operations,
 // but they don't seem to provide anything that goes beyond the gcc
 // builtins we're currently using.
 
-/* AndroitShmemService inherits from BnAndroitShmem, thus implements
- * the server-local Binder interface. */
-class AndroitShmemService : public BnAndroitShmem {
-public:
-	static void instantiate();
-	AndroitShmemService();
-	virtual ~AndroitShmemService();
-	virtual sp<IMemoryHeap> getShmem();
-private:
-	sp<MemoryHeapBase> shmemHeap;
+// Default period of -c
+enum {
+	CHECKPOINT_PERIOD = 10
 };
 
-
-sp<IMemoryHeap> AndroitShmemService::getShmem() {
-	return shmemHeap;
+static void usage(const char *prog) {
+	fprintf(stderr, "Usage: %s [-m] [-g pages] [-N node] [-F] [-c dir [-C s]]\n"
+		"  -m        back regions by anonymous memfds (POSIX transport only)\n"
+		"  -g pages  pages of the regions: 4k (default), thp or huge (hugetlbfs)\n"
+		"  -N node   bind the pages of the regions to NUMA node\n"
+		"  -F        do not prefault the regions on creation\n"
+		"  -c dir    keep checkpoints of the regions in dir, restore them on start\n"
+		"  -C s      seconds between checkpoints (default %u)\n", prog, (unsigned int)CHECKPOINT_PERIOD);
 }
 
-void AndroitShmemService::instantiate() {
-	status_t status;
-	 // Make AndroitShmemService known to the ServiceManager
-	status = defaultServiceManager()->addService(String16("vendor.androit.shmem"), new AndroitShmemService());
-  
-	if (status != NO_ERROR)
-		LOGE("Could not register AndroitShmem Service to Service Manager");
-	else
-		LOGD("AndroitShmem Service successfully registered to Service Manager");
-}
-
-AndroitShmemService::AndroitShmemService() {
-	struct androit::shared *container;
-	void *ptr;
-	int res = 0;
-	
-	// NOTE: We explicitely _don't_ use the ashmem allocator because we
-	// don't want the shared memory to be reclaimable. Mapping
-	// a file (or file descriptor) ensures that Android bases the
-	// mapping on mmap.	
-	shmemHeap = new MemoryHeapBase("/mnt/shm/map", sizeof(struct androit::shared));
-	ftruncate(shmemHeap->getHeapID(), sizeof(struct androit::shared));
-
-	LOGD("Base: %p, size: %d (%s), ID: %d", shmemHeap->getBase(), shmemHeap->getSize(), 
-		shmemHeap->getDevice(), shmemHeap->getHeapID());
-	
-	if (shmemHeap->getSize() != 0) {
-		// Lock file mapping into memory to avoid it to be swapped out
-		res = mlock(shmemHeap->getBase(), shmemHeap->getSize());
-
-		if (res < 0) {
-			LOGE("Could not lock memory: %d (%s)\n", errno, 
-				 strerror(errno));
+int main(int argc, char *argv[]) {
+	struct region_backing backing = default_backing();
+	const char *checkpoints = NULL;
+	unsigned int period = CHECKPOINT_PERIOD;
+	bool anonymous = false;
+	sigset_t signals;
+	int opt, sig;
+
+	while ((opt = getopt(argc, argv, "mg:N:Fc:C:h")) != -1) {
+		switch (opt) {
+		case 'm':
+			anonymous = true;
+			break;
+		case 'g':
+			if (!backing_parse_pages(optarg, &backing.pages)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'N':
+			backing.numa_node = atoi(optarg);
+			break;
+		case 'F':
+			backing.prefault = false;
+			break;
+		case 'c':
+			checkpoints = optarg;
+			break;
+		case 'C':
+			period = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
 		}
-	} else {
-		LOGE("Could not allocate memory!");
 	}
-	
-	// use allocated "raw" memory as struct shared	
-	container = (struct androit::shared*) shmemHeap->getBase();
-	
-	if (init_shared(container) != 0)
-		LOGE("Concurrency protections could not be initialised correctly");
-	else
-		LOGD("Concurrency protections initialised");
-}
 
-AndroitShmemService::~AndroitShmemService() {
-	shmemHeap = NULL;
-}
+	// Handled by sigwait() below: blocked before any thread inherits the mask
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	RegionRegistry registry(anonymous);
+	registry.setBacking(backing);
+	// Regions added below start with their last checkpoint (warm restart)
+	if (checkpoints != NULL)
+		registry.setCheckpoints(checkpoints, period);
+
+	// Default region, used by all clients that call getShmem()
+	if (registry.add<data_struct>("map", init_sample_data) != 0) {
+		LOGE("Default region could not be registered");
+		return 1;
+	}
+	LOGD("Concurrency protections initialised");
 
-// Server obtains shared data itself through Binder for debug messages
-struct shared *getSharedData(void) {
-	static sp<IAndroitShmem> androitShmem;
-	static sp<IMemoryHeap> receiverMemBase;
-  
-	// Acquire remote interface to AndroitShmem service from ServiceManager
-	if (androitShmem == NULL) {
-		sp<IServiceManager> sm = defaultServiceManager();
-		sp<IBinder> binder;
-		binder = sm->getService(String16("vendor.androit.shmem"));
-		if (binder != 0) {
-			androitShmem = IAndroitShmem::asInterface(binder);
-		}
+	// Last versions of the default region, for readers that poll slower than clients write
+	if (registry.addHistory<data_struct>("map.history", 64) != 0) {
+		LOGE("History of the default region could not be registered");
+		return 1;
+	}
+
+	/* Non-RT writes of the default region that RT writes keep interfering
+	 * with are handed over and applied by a drain thread, see
+	 * AndroitShmemApply.h */
+	if (registry.addApplyQueue<data_struct>("map.apply", "map", 16, 1024, "map.history") != 0) {
+		LOGE("Apply queue of the default region could not be registered");
+		return 1;
 	}
-  
-	// Abort if AndroitShmem service is not published
-	if (androitShmem == NULL) {
-		LOGE("The AndroitShmem service is not published");
-		return NULL;
+
+	// Slots of RT writers of the default region that combine their writes
+	if (registry.addCombiner<data_struct>("map.combine", 16, 1024) != 0) {
+		LOGE("Combiner of the default region could not be registered");
+		return 1;
 	}
-	
-	// Acquire pointer to shared MemoryHeap from AndroitShmem service if not already done
-	if (receiverMemBase == NULL)
-		receiverMemBase = androitShmem->getShmem();
-		
-	// Return pointer to shared memory
-	return (struct shared*)receiverMemBase->getBase();
-}
 
+	// Events of clients that must not be lost, e.g. alarm edges and commands
+	if (registry.addChannel("events", 256, 64, CHANNEL_DROP_OLDEST, true) != 0) {
+		LOGE("Event channel could not be registered");
+		return 1;
+	}
 
-int main(int argc, char *argv[]) {
-	struct shared *container;
-	int active_data;
-
-	AndroitShmemService::instantiate();
-  
-	// Start thread pool to handle incoming Binder calls
-	ProcessState::self()->startThreadPool();
-	LOGD("Androit shmem service started");
-  
-	container = (struct shared*)getSharedData();
-  
-	// Periodically log debug messages
-	for(;;) {
-		active_data = container->protect.sequence & 1;
-		LOGD("AndroitShmemServer: active=%d, base=%p, integer=%d, float=%f, seq=%d", 
-		     active_data, container, container->data[active_data].integer, 
-		     container->data[active_data].fp, container->protect.sequence);
-		     
-		sleep(5);
+	// Further signal groups get a region of their own here, e.g.
+	// registry.add<my_signals>("my_signals");
+	// Regions whose readers must never retry can use N buffers instead:
+	// registry.addNBuf<my_signals, 3>("my_signals");
+
+	// Before clients can delegate, they would only give up after APPLY_TIMEOUT_NS
+	if (registry.startApply() != 0) {
+		LOGE("Apply threads could not be started");
+		return 1;
 	}
 
+	// Hand the regions out to clients
+	if (TransportServer::get()->publish(&registry) != 0)
+		return 1;
+	LOGD("Androit shmem service started, AndroitShmemStat shows its statistics");
+
+	if (checkpoints != NULL && registry.startCheckpoints() != 0)
+		LOGE("Checkpoint thread could not be started");
+
+	// Requests are served by the threads of the transport
+	do {
+		if (sigwait(&signals, &sig) != 0)
+			sig = 0;
+	} while (sig != SIGTERM && sig != SIGINT);
+
+	// A planned restart continues from the image at shutdown
+	if (checkpoints != NULL && registry.checkpoint() < 0)
+		LOGE("Final checkpoint failed");
+	LOGD("Androit shmem service stopped");
+
 	return 0;
 }
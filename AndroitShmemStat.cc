@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Dumps the statistics pages of the regions of a running AndroitShmemServer
+ * (see AndroitShmemStats.h): per region the operation counters and the
+ * percentiles of the lock wait/hold time histograms. With -i, prints the
+ * differences of every interval instead, i.e., the current contention.
+ * Lock times are only recorded while switched on with -t (-T: off). */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include <AndroitShmem.h>
+#include <AndroitShmemStats.h>
+#include <AndroitShmemTransport.h>
+
+using namespace androit;
+
+static const char *counter_names[STAT_COUNTERS] = {
+	"rt_writes", "nonrt_writes", "nonrt_commits", "nonrt_cas_fails",
+	"read_retries", "read_spins", "read_sleeps",
+	"nonrt_delegated", "applied", "rt_combined"
+};
+
+static const char *histogram_names[STAT_HISTOGRAMS] = {
+	"rt_lock_wait", "rt_lock_hold", "nonrt_lock_wait", "nonrt_lock_hold"
+};
+
+struct watched {
+	const char *name;
+	struct region_stats *stats;
+	struct stats_slot last;
+};
+
+// Returns the statistics page of region name, NULL if it is not served or has none
+static struct region_stats *attach_stats(const char *name) {
+	size_t size = 0;
+	struct region_header *header = (struct region_header*)Transport::get()->attach(name, &size);
+
+	if (header == NULL) {
+		fprintf(stderr, "Region %s not available, is AndroitShmemServer running?\n", name);
+		return NULL;
+	}
+
+	if (size < sizeof(*header) || !header_published(header) || header->layout_version != LAYOUT_VERSION) {
+		fprintf(stderr, "Region %s was set up by another version\n", name);
+		return NULL;
+	}
+
+	if (header->stats_offset == 0 || header->stats_offset != stats_offset_for(header->region_size) ||
+	    size < header->stats_offset + sizeof(struct region_stats)) {
+		fprintf(stderr, "Region %s has no statistics page\n", name);
+		return NULL;
+	}
+
+	return region_stats_of(header);
+}
+
+// Returns the upper bound of the bucket p of the count durations of a histogram lie below, in ns
+static uint64_t percentile(const uint32_t *buckets, uint64_t count, double p) {
+	uint64_t seen = 0;
+
+	for (unsigned int b = 0; b < STATS_BUCKETS; b++) {
+		seen += buckets[b];
+		if (seen > 0 && seen >= p * count)
+			return b == 0 ? 0 : 1ULL << b;
+	}
+
+	return 1ULL << (STATS_BUCKETS - 1);
+}
+
+static void print(const char *name, const struct stats_slot *slot, double seconds) {
+	printf("%s\n", name);
+
+	for (unsigned int c = 0; c < STAT_COUNTERS; c++) {
+		if (seconds > 0)
+			printf("  %-16s %14llu %12.0f/s\n", counter_names[c], (unsigned long long)slot->counters[c],
+			       slot->counters[c] / seconds);
+		else
+			printf("  %-16s %14llu\n", counter_names[c], (unsigned long long)slot->counters[c]);
+	}
+
+	printf("  %-16s %14s %10s %10s %10s %10s\n", "[ns, <=]", "count", "p50", "p99", "p99.9", "max");
+	for (unsigned int h = 0; h < STAT_HISTOGRAMS; h++) {
+		const uint32_t *buckets = slot->histograms[h];
+		uint64_t count = 0;
+
+		for (unsigned int b = 0; b < STATS_BUCKETS; b++)
+			count += buckets[b];
+
+		printf("  %-16s %14llu %10llu %10llu %10llu %10llu\n", histogram_names[h], (unsigned long long)count,
+		       (unsigned long long)percentile(buckets, count, 0.5),
+		       (unsigned long long)percentile(buckets, count, 0.99),
+		       (unsigned long long)percentile(buckets, count, 0.999),
+		       (unsigned long long)percentile(buckets, count, 1.0));
+	}
+}
+
+// Stores now - last into diff
+static void subtract(const struct stats_slot *now, const struct stats_slot *last, struct stats_slot *diff) {
+	for (unsigned int c = 0; c < STAT_COUNTERS; c++)
+		diff->counters[c] = now->counters[c] - last->counters[c];
+	for (unsigned int h = 0; h < STAT_HISTOGRAMS; h++)
+		for (unsigned int b = 0; b < STATS_BUCKETS; b++)
+			diff->histograms[h][b] = now->histograms[h][b] - last->histograms[h][b];
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr,
+		"Usage: %s [-t|-T] [-i seconds] [-n count] [region ...]\n"
+		"  -t     start recording lock wait/hold times (costs two clock reads per write)\n"
+		"  -T     stop recording lock wait/hold times\n"
+		"  -i s   print the differences of every interval of s seconds\n"
+		"  -n N   stop after N intervals (default: never)\n"
+		"Regions default to map.\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+	std::vector<watched> regions;
+	unsigned int interval = 0, intervals = 0;
+	struct stats_slot now, diff;
+	int opt, timing = -1;
+
+	while ((opt = getopt(argc, argv, "tTi:n:h")) != -1) {
+		switch (opt) {
+		case 't': timing = 1; break;
+		case 'T': timing = 0; break;
+		case 'i': interval = atoi(optarg); break;
+		case 'n': intervals = atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	for (int i = optind; i < argc || (i == optind && optind == argc); i++) {
+		watched w;
+
+		w.name = i < argc ? argv[i] : "map";
+		w.stats = attach_stats(w.name);
+		if (w.stats == NULL)
+			return 1;
+		if (timing >= 0)
+			store_relaxed(&w.stats->timing, (uint32_t)timing);
+		stats_sum(w.stats, &w.last);
+		regions.push_back(w);
+	}
+
+	if (interval == 0) {
+		for (size_t i = 0; i < regions.size(); i++)
+			print(regions[i].name, &regions[i].last, 0);
+		return 0;
+	}
+
+	for (unsigned int n = 0; intervals == 0 || n < intervals; n++) {
+		sleep(interval);
+
+		for (size_t i = 0; i < regions.size(); i++) {
+			stats_sum(regions[i].stats, &now);
+			subtract(&now, &regions[i].last, &diff);
+			regions[i].last = now;
+			print(regions[i].name, &diff, interval);
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+
+	return 0;
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Transport for Android: AndroitShmemService is published to the
+ * ServiceManager, clients obtain regions as IMemoryHeap via Binder. */
+
+#include <sys/mman.h>
+#include <binder/MemoryHeapBase.h>
+#include <binder/IServiceManager.h>
+#include <binder/IPCThreadState.h>
+#include <binder/ProcessState.h>
+#include <utils/KeyedVector.h>
+#include <utils/Mutex.h>
+#include <utils/String8.h>
+
+#include <IAndroitShmem.h>
+#include <AndroitShmemBacking.h>
+#include <AndroitShmemTransport.h>
+#include <AndroitShmemRegistry.h>
+
+using namespace android;
+using namespace androit;
+
+/////////////////////////// Client //////////////////////
+
+class BinderTransport : public Transport {
+public:
+	virtual void *attach(const char *name, size_t *size);
+
+private:
+	Mutex lock;
+	sp<IAndroitShmem> androitShmem;
+	// Keeps the heaps (and thus their mappings) alive
+	KeyedVector<String8, sp<IMemoryHeap> > heaps;
+};
+
+void *BinderTransport::attach(const char *name, size_t *size) {
+	Mutex::Autolock _l(lock);
+	sp<IMemoryHeap> heap;
+	ssize_t index;
+
+	index = heaps.indexOfKey(String8(name));
+	if (index >= 0) {
+		heap = heaps.valueAt(index);
+		*size = heap->getSize();
+		return heap->getBase();
+	}
+
+	// Acquire remote interface to AndroitShmem service from ServiceManager
+	if (androitShmem == NULL) {
+		sp<IServiceManager> sm = defaultServiceManager();
+		sp<IBinder> binder = sm->getService(String16("vendor.androit.shmem"));
+
+		if (binder != 0) {
+			androitShmem = IAndroitShmem::asInterface(binder);
+		}
+	}
+
+	// Abort if AndroitShmem service is not published
+	if (androitShmem == NULL) {
+		LOGE("The AndroitShmem service is not published");
+		return NULL;
+	}
+
+	LOGD("Getting handle to region %s via binder...", name);
+	heap = androitShmem->getRegion(String16(name));
+	if (heap == NULL || heap->getBase() == MAP_FAILED) {
+		LOGE("The AndroitShmem service did not provide region %s", name);
+		return NULL;
+	}
+
+	// Page tables are per process: fault the pages in now, not on the first RT access
+	backing_prefault(heap->getBase(), heap->getSize());
+
+	heaps.add(String8(name), heap);
+	*size = heap->getSize();
+	return heap->getBase();
+}
+
+Transport *Transport::get() {
+	static BinderTransport transport;
+	return &transport;
+}
+
+/////////////////////////// Server //////////////////////
+
+/* AndroitShmemService inherits from BnAndroitShmem, thus implements
+ * the server-local Binder interface. It hands out the regions of a
+ * RegionRegistry as IMemoryHeap. */
+class AndroitShmemService : public BnAndroitShmem {
+public:
+	AndroitShmemService(RegionRegistry *registry) : registry(registry) {}
+	virtual sp<IMemoryHeap> getShmem();
+	virtual sp<IMemoryHeap> getRegion(const String16& name);
+private:
+	RegionRegistry *registry;
+	Mutex lock;
+	KeyedVector<String8, sp<MemoryHeapBase> > heaps;
+};
+
+sp<IMemoryHeap> AndroitShmemService::getShmem() {
+	return getRegion(String16("map"));
+}
+
+sp<IMemoryHeap> AndroitShmemService::getRegion(const String16& name) {
+	Mutex::Autolock _l(lock);
+	String8 name8(name);
+	const region_entry *entry;
+	sp<MemoryHeapBase> heap;
+	ssize_t index;
+
+	index = heaps.indexOfKey(name8);
+	if (index >= 0)
+		return heaps.valueAt(index);
+
+	entry = registry->find(name8.string());
+	if (entry == NULL)
+		return NULL;
+
+	// MemoryHeapBase duplicates the descriptor of the (already locked) region
+	heap = new MemoryHeapBase(entry->fd, entry->size);
+	heaps.add(name8, heap);
+
+	return heap;
+}
+
+class BinderTransportServer : public TransportServer {
+public:
+	virtual int publish(RegionRegistry *registry);
+};
+
+int BinderTransportServer::publish(RegionRegistry *registry) {
+	status_t status;
+
+	// Make AndroitShmemService known to the ServiceManager
+	status = defaultServiceManager()->addService(String16("vendor.androit.shmem"),
+						     new AndroitShmemService(registry));
+
+	if (status != NO_ERROR) {
+		LOGE("Could not register AndroitShmem Service to Service Manager");
+		return status;
+	}
+	LOGD("AndroitShmem Service successfully registered to Service Manager");
+
+	// Start thread pool to handle incoming Binder calls
+	ProcessState::self()->startThreadPool();
+	return 0;
+}
+
+TransportServer *TransportServer::get() {
+	static BinderTransportServer server;
+	return &server;
+}
@@ -26,7 +26,8 @@ using namespace android;
 
 enum {
 	// "FIRST_CALL_TRANSACTION - The first transaction code available for user commands." (IBinder reference)
-    GET_SHMEM = IBinder::FIRST_CALL_TRANSACTION
+    GET_SHMEM = IBinder::FIRST_CALL_TRANSACTION,
+    GET_REGION
 };
 
 /////////////////////////// Client //////////////////////
@@ -50,6 +51,20 @@ BpAndroitShmem(const sp<IBinder>& impl) : BpInterface<IAndroitShmem>(impl) {}
 
 		return shmem;
 	}
+
+	sp<IMemoryHeap> getRegion(const String16& name) {
+		Parcel data, reply;
+		sp<IMemoryHeap> region = NULL;
+		data.writeInterfaceToken(IAndroitShmem::getInterfaceDescriptor());
+		data.writeString16(name);
+
+		remote()->transact(GET_REGION, data, &reply);
+		// Service replies with an empty parcel for unknown regions
+		if (reply.dataAvail() > 0)
+			region = interface_cast<IMemoryHeap> (reply.readStrongBinder());
+
+		return region;
+	}
 };
 
 // Implements objects previously declared in IAndroitShmem.h (DECLARE_META_INTERFACE(AndroitShmem);)
@@ -69,6 +84,14 @@ status_t BnAndroitShmem::onTransact(uint32_t code, const Parcel& data, Parcel* r
 			reply->writeStrongBinder(Data->asBinder());
 		}
 		return NO_ERROR;
+	} else if (code == GET_REGION) {
+		CHECK_INTERFACE(IAndroitShmem, data, reply);
+		sp<IMemoryHeap> Region = getRegion(data.readString16());
+		// Respond with region if it is registered
+		if (Region != NULL) {
+			reply->writeStrongBinder(Region->asBinder());
+		}
+		return NO_ERROR;
 	}
 
 	return BBinder::onTransact(code, data, reply, flags);
@@ -0,0 +1,369 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Transport for plain Linux hosts: regions live in POSIX shared memory (or
+ * memfds), their file descriptors are passed to clients over a Unix socket
+ * (SCM_RIGHTS). This allows building and benchmarking AndroitShmem without
+ * an Android tree.
+ *
+ * The descriptors are writable, so they are only passed to the peers that
+ * could open the backing files (created 0600): root and the user of the
+ * server, and the members of group ANDROIT_SHMEM_GID if it is set. */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <map>
+#include <string>
+
+#include <AndroitShmemBacking.h>
+#include <AndroitShmemTransport.h>
+#include <AndroitShmemRegistry.h>
+#include <AndroitShmemLog.h>
+
+using namespace androit;
+
+// Region names are at most this long (including terminating zero)
+#define REGION_NAME_MAX 64
+
+// Clients send their request right after connecting, a silent one is dropped after this long
+#define REQUEST_TIMEOUT_MS 100
+
+// Request of a client: name of the region to attach to
+struct region_request {
+	char name[REGION_NAME_MAX];
+};
+
+// Reply of the server, the file descriptor is passed along if status is 0
+struct region_reply {
+	int32_t  status;
+	uint32_t reserved;
+	uint64_t size;
+};
+
+/* Address of the service socket. Defaults to "androitshmem" in the abstract
+ * namespace, ANDROIT_SHMEM_SOCKET overrides it ('@' prefix for abstract
+ * names, a file system path otherwise). */
+static socklen_t service_address(struct sockaddr_un *addr) {
+	const char *name = getenv("ANDROIT_SHMEM_SOCKET");
+	size_t len;
+
+	if (name == NULL || name[0] == '\0')
+		name = "@androitshmem";
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	len = strlen(name);
+	if (len > sizeof(addr->sun_path) - 1)
+		len = sizeof(addr->sun_path) - 1;
+	memcpy(addr->sun_path, name, len);
+
+	if (name[0] == '@') {
+		// Abstract namespace: leading zero byte, name is not terminated
+		addr->sun_path[0] = '\0';
+		return offsetof(struct sockaddr_un, sun_path) + len;
+	}
+
+	return sizeof(*addr);
+}
+
+/////////////////////////// Client //////////////////////
+
+class PosixTransport : public Transport {
+public:
+	PosixTransport() {
+		pthread_mutex_init(&lock, NULL);
+	}
+
+	virtual void *attach(const char *name, size_t *size);
+
+private:
+	struct mapping {
+		void *base;
+		size_t size;
+	};
+
+	int request(const char *name, size_t *size);
+
+	pthread_mutex_t lock;
+	std::map<std::string, mapping> mappings;
+};
+
+// Asks the service for region name, returns its file descriptor or -errno
+int PosixTransport::request(const char *name, size_t *size) {
+	struct sockaddr_un addr;
+	struct region_request req;
+	struct region_reply reply;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char control[CMSG_SPACE(sizeof(int))];
+	socklen_t addrlen;
+	ssize_t len;
+	int sock, fd = -1;
+
+	if (strlen(name) >= REGION_NAME_MAX)
+		return -ENAMETOOLONG;
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return -errno;
+
+	addrlen = service_address(&addr);
+	if (connect(sock, (struct sockaddr*)&addr, addrlen) < 0) {
+		fd = -errno;
+		close(sock);
+		return fd;
+	}
+
+	memset(&req, 0, sizeof(req));
+	strcpy(req.name, name);
+	if (send(sock, &req, sizeof(req), MSG_NOSIGNAL) != sizeof(req)) {
+		close(sock);
+		return -EIO;
+	}
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &reply;
+	iov.iov_len = sizeof(reply);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	len = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	close(sock);
+
+	if (len != sizeof(reply))
+		return -EIO;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	}
+
+	if (reply.status != 0) {
+		if (fd >= 0)
+			close(fd);
+		return reply.status;
+	}
+
+	if (fd < 0)
+		return -EIO;
+
+	*size = reply.size;
+	return fd;
+}
+
+void *PosixTransport::attach(const char *name, size_t *size) {
+	std::map<std::string, mapping>::iterator it;
+	mapping m;
+	int fd;
+
+	pthread_mutex_lock(&lock);
+
+	// Map each region only once per process
+	it = mappings.find(name);
+	if (it != mappings.end()) {
+		*size = it->second.size;
+		pthread_mutex_unlock(&lock);
+		return it->second.base;
+	}
+
+	fd = request(name, &m.size);
+	if (fd < 0) {
+		pthread_mutex_unlock(&lock);
+		LOGE("The AndroitShmem service did not provide region %s: %d (%s)",
+			 name, -fd, strerror(-fd));
+		return NULL;
+	}
+
+	m.base = mmap(NULL, m.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (m.base == MAP_FAILED) {
+		pthread_mutex_unlock(&lock);
+		LOGE("Could not map region %s: %d (%s)", name, errno, strerror(errno));
+		return NULL;
+	}
+
+	// Page tables are per process: fault the pages in now, not on the first RT access
+	backing_prefault(m.base, m.size);
+
+	mappings[name] = m;
+	pthread_mutex_unlock(&lock);
+
+	*size = m.size;
+	return m.base;
+}
+
+Transport *Transport::get() {
+	static PosixTransport transport;
+	return &transport;
+}
+
+/////////////////////////// Server //////////////////////
+
+class PosixTransportServer : public TransportServer {
+public:
+	PosixTransportServer() : registry(NULL), sock(-1), gid(-1) {}
+
+	virtual int publish(RegionRegistry *registry);
+
+private:
+	static void *serve(void *arg);
+	bool allowed(int conn);
+	void handle(int conn);
+
+	RegionRegistry *registry;
+	int sock;
+	// Group allowed besides the user of the server, -1: none
+	long gid;
+	pthread_t thread;
+};
+
+int PosixTransportServer::publish(RegionRegistry *registry) {
+	struct sockaddr_un addr;
+	socklen_t addrlen;
+	int ret;
+
+	this->registry = registry;
+	gid = getenv("ANDROIT_SHMEM_GID") != NULL ? strtol(getenv("ANDROIT_SHMEM_GID"), NULL, 10) : -1;
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0)
+		return -errno;
+
+	addrlen = service_address(&addr);
+	// Remove stale socket file of a previous instance
+	if (addr.sun_path[0] != '\0')
+		unlink(addr.sun_path);
+
+	if (bind(sock, (struct sockaddr*)&addr, addrlen) < 0 || listen(sock, 16) < 0) {
+		ret = -errno;
+		LOGE("Could not bind service socket: %d (%s)", -ret, strerror(-ret));
+		close(sock);
+		sock = -1;
+		return ret;
+	}
+
+	ret = pthread_create(&thread, NULL, serve, this);
+	if (ret != 0) {
+		close(sock);
+		sock = -1;
+		return -ret;
+	}
+
+	LOGD("AndroitShmem Service listening on Unix socket");
+	return 0;
+}
+
+// Returns true if the peer of conn may attach to regions, see above
+bool PosixTransportServer::allowed(int conn) {
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) {
+		LOGE("Could not get credentials of client: %d (%s)", errno, strerror(errno));
+		return false;
+	}
+
+	if (cred.uid == 0 || cred.uid == geteuid() || (gid >= 0 && cred.gid == (gid_t)gid))
+		return true;
+
+	LOGE("Client %d (uid %d, gid %d) may not attach to regions", (int)cred.pid, (int)cred.uid, (int)cred.gid);
+	return false;
+}
+
+// Answers a single region request on conn
+void PosixTransportServer::handle(int conn) {
+	struct timeval timeout = { 0, REQUEST_TIMEOUT_MS * 1000 };
+	struct region_request req;
+	struct region_reply reply;
+	const region_entry *entry;
+	struct msghdr msg;
+	struct iovec iov;
+	char control[CMSG_SPACE(sizeof(int))];
+
+	// Requests are served one at a time: a client that sends nothing must not hold up the others
+	if (setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0 ||
+	    setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0)
+		return;
+
+	if (recv(conn, &req, sizeof(req), MSG_WAITALL) != sizeof(req))
+		return;
+	req.name[REGION_NAME_MAX - 1] = '\0';
+
+	memset(&reply, 0, sizeof(reply));
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &reply;
+	iov.iov_len = sizeof(reply);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	entry = registry->find(req.name);
+	if (!allowed(conn)) {
+		reply.status = -EACCES;
+	} else if (entry == NULL) {
+		reply.status = -ENOENT;
+	} else {
+		struct cmsghdr *cmsg;
+
+		reply.size = entry->size;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &entry->fd, sizeof(int));
+	}
+
+	sendmsg(conn, &msg, MSG_NOSIGNAL);
+}
+
+void *PosixTransportServer::serve(void *arg) {
+	PosixTransportServer *server = (PosixTransportServer*)arg;
+	int conn;
+
+	for (;;) {
+		conn = accept4(server->sock, NULL, NULL, SOCK_CLOEXEC);
+		if (conn < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			LOGE("Service socket failed: %d (%s)", errno, strerror(errno));
+			break;
+		}
+
+		server->handle(conn);
+		close(conn);
+	}
+
+	return NULL;
+}
+
+TransportServer *TransportServer::get() {
+	static PosixTransportServer server;
+	return &server;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.androit;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
+// Generated by tools/shmemgen.py from schema/data_struct.schema, do not edit.
+
+/* Layout of data_struct. Getters read a snapshot of the data (see
+ * SharedMem.readSnapshot()), setters add updates to a WriteBatch. */
+public final class DataStruct {
+	public static final int OFFSET_INTEGER = 0;
+	public static final int OFFSET_FP = 4;
+	public static final int OFFSET_ARBITRARY = 8;
+	public static final int LENGTH_ARBITRARY = 1024;
+	public static final int SIZE = 8200;
+	public static final int LAYOUT_HASH = 0xd8aaff74;
+
+	private final ByteBuffer buf;
+	
+	// Wraps a snapshot of at least SIZE bytes
+	public DataStruct(ByteBuffer snapshot) {
+		buf = snapshot.duplicate().order(ByteOrder.nativeOrder());
+	}
+	
+	public int getInteger() {
+		return buf.getInt(OFFSET_INTEGER);
+	}
+	
+	public static void setInteger(WriteBatch batch, int value) {
+		batch.putInt(OFFSET_INTEGER, value);
+	}
+	
+	public float getFp() {
+		return buf.getFloat(OFFSET_FP);
+	}
+	
+	public static void setFp(WriteBatch batch, float value) {
+		batch.putFloat(OFFSET_FP, value);
+	}
+	
+	public long getArbitrary(int index) {
+		return buf.getLong(OFFSET_ARBITRARY + index * 8);
+	}
+	
+	// Copies count elements from first on to dst[0 .. count)
+	public void getArbitrary(long[] dst, int first, int count) {
+		for (int i = 0; i < count; i++)
+			dst[i] = buf.getLong(OFFSET_ARBITRARY + (first + i) * 8);
+	}
+	
+	// Stores src[srcFirst .. srcFirst + count) in elements first .. first + count
+	public static void setArbitrary(WriteBatch batch, int first, long[] src, int srcFirst, int count) {
+		batch.putLongs(OFFSET_ARBITRARY + first * 8, src, srcFirst, count);
+	}
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.androit;
+
+import java.nio.ByteBuffer;
+
+/* Event channel of AndroitShmem: a queue of messages in shared memory that,
+ * unlike the latest value of SharedMem, loses no event between two reads
+ * (unless the channel was set up to drop the oldest message when full). */
+public class EventChannel {
+	private final long handle;
+	private final int messageSize;
+	
+	// Attaches to channel name of the AndroitShmem service
+	public EventChannel(String name) {
+		handle = attach(name);
+		if (handle == 0)
+			throw new IllegalArgumentException("Androit channel " + name + " not available");
+		
+		messageSize = messageSize(handle);
+	}
+	
+	// Largest message of the channel, in bytes
+	public int getMessageSize() {
+		return messageSize;
+	}
+	
+	// Number of messages the channel discarded because it was full
+	public long getDropped() {
+		return dropped(handle);
+	}
+	
+	/* Sends the first len bytes of msg. If the channel is full and blocks
+	 * senders, waits at most timeoutMs milliseconds (negative: no limit).
+	 * Returns 0, or a negative errno (e.g. -EAGAIN: full, -EMSGSIZE). */
+	public int send(byte[] msg, int len, int timeoutMs) {
+		return send(handle, msg, len, timeoutMs);
+	}
+	
+	/* Allocates a buffer receive() can store count messages in. Must be a
+	 * direct buffer, messages are copied there without going through java. */
+	public ByteBuffer allocateBuffer(int count) {
+		return ByteBuffer.allocateDirect(count * messageSize);
+	}
+	
+	/* Receives up to lens.length messages at once, waiting at most timeoutMs
+	 * milliseconds (negative: no limit, 0: not at all) for the first. Message
+	 * i starts at i * getMessageSize() in buf, its length is lens[i]. Returns
+	 * the number of messages, or a negative errno. */
+	public int receive(ByteBuffer buf, int[] lens, int timeoutMs) {
+		return receive(handle, buf, lens, timeoutMs);
+	}
+	
+	// Methods provided by the native library
+	private static native long attach(String name);
+	private static native int messageSize(long handle);
+	private static native long dropped(long handle);
+	private static native int send(long handle, byte[] msg, int len, int timeoutMs);
+	private static native int receive(long handle, ByteBuffer buf, int[] lens, int timeoutMs);
+	
+	static {
+		System.load("/system/lib/libandroitshmem.so");
+	}
+}
@@ -19,6 +19,7 @@ package com.androit;
 
 import java.nio.ByteBuffer;
 import java.nio.ByteOrder;
+import java.nio.LongBuffer;
 
 // Library to give access to AndroitShmem to java applications
 public class SharedMem {
@@ -46,37 +47,83 @@ public class SharedMem {
 		readBBValues();
 	}
 	
-    private void readBBValues() {
-		ByteBuffer res;
-		int data_offset;
-		
-		res = (ByteBuffer)getByteBuffer();
+    /* Blocks until the shared data was updated since it was last read, at most
+     * timeoutMs milliseconds (negative: no limit). Returns true if it was, the
+     * getters then return the new values. Replaces polling getBBFloat()/getBBInt(). */
+    public boolean waitForUpdate(int timeoutMs) {
+		if (waitSeqUpdate(seq, timeoutMs) < 0)
+			return false;
 		
-		// x86 (for instance) has a different native byte order than java's big endian
-		if (ByteOrder.nativeOrder() != ByteOrder.BIG_ENDIAN) { 
-			res.order(ByteOrder.LITTLE_ENDIAN);
-		}
-		
-		/* Get sequence value before read and compare it to sequence value after read.
-		 * If equal: data read is consistent, if unequal: retry */
-		do {
-			readSeqBegin();
-			data_offset = getActiveDataOffset();
-			bbInt = res.getInt(data_offset + 0);
-			bbFloat =  res.getFloat(data_offset + 4);
-		} while (readSeqRetry()); 
+		readBBValues();
+		return true;
+    }
+    
+    private void readBBValues() {
+		// integer and float, copied consistently by the native library in one call
+		seq = readData(head, 0, HEAD_SIZE, spinBudget);
+		bbInt = head.getInt(DataStruct.OFFSET_INTEGER);
+		bbFloat = head.getFloat(DataStruct.OFFSET_FP);
+    }
+    
+    /* Copies the whole data consistently into snapshot, a direct buffer of
+     * at least DataStruct.SIZE bytes (see allocateSnapshot()), read it with
+     * new DataStruct(snapshot). Returns false if the shared memory is not available. */
+    public boolean readSnapshot(ByteBuffer snapshot) {
+		long s = readData(snapshot, 0, DataStruct.SIZE, spinBudget);
 		
+		return s >= 0;
+    }
+    
+    // Allocates a buffer for readSnapshot()
+    public ByteBuffer allocateSnapshot() {
+		return ByteBuffer.allocateDirect(DataStruct.SIZE).order(ByteOrder.nativeOrder());
+    }
+    
+    /* Copies count elements of arbitrary[], starting at first, consistently to
+     * dst[0..count). Returns false if the range is invalid. */
+    public boolean readArbitrary(long[] dst, int first, int count) {
+		return readArbitrary(dst, first, count, spinBudget) >= 0;
+    }
+    
+    /* Like readArbitrary(long[], ...), into dst[0..count) of a direct buffer,
+     * e.g. ByteBuffer.allocateDirect(n * 8).order(ByteOrder.nativeOrder()).asLongBuffer() */
+    public boolean readArbitrary(LongBuffer dst, int first, int count) {
+		return readArbitraryBuffer(dst, first, count, spinBudget) >= 0;
+    }
+    
+    /* Copies the ranges given by offset/length pairs (see DataStruct) in
+     * ranges[0..2 * count) consistently and back to back into dst, a direct
+     * buffer that holds all of them. Cheaper than readSnapshot() if only a
+     * few fields are needed. Returns false if a range is invalid. */
+    public boolean readProjection(ByteBuffer dst, int[] ranges, int count) {
+		return readProjection(dst, ranges, count, spinBudget) >= 0;
+    }
+    
+    /* Copies len bytes at offset (see DataStruct) of every version committed
+     * after sequence sinceSeq (HISTORY_ALL: of every version the history
+     * holds), oldest first, to dst at i * len, their sequences to seqs[i] and
+     * their CLOCK_MONOTONIC commit times to timesNs[i]. Pass seqs[n - 1] of the
+     * previous call to continue. historyLost() then tells whether versions
+     * were overwritten before they could be read. Returns the number of
+     * versions, or -1 if the service keeps no history. */
+    public int readHistory(long sinceSeq, ByteBuffer dst, int offset, int len, long[] seqs, long[] timesNs) {
+		return readHistory(sinceSeq, dst, offset, len, seqs, timesNs, historyLost);
+    }
+    
+    // True if the last readHistory() missed versions
+    public boolean historyLost() {
+		return historyLost[0];
     }
     
     public void readSeqBegin() {
-		// Wait for RT-Writes to finish before reading data
-    	while (((seq = getSeqCount()) & 2) == 1)
-			try {
-				Thread.sleep(10);
-			} catch (InterruptedException e) {
-				// TODO Auto-generated catch block
-				e.printStackTrace();
-			}
+		// Wait for RT-Writes to finish before reading data: spin, then sleep until the writer is done
+		seq = waitSeqBegin(spinBudget);
+    }
+    
+    /* Number of iterations readSeqBegin() spins while an RT-Write is in progress
+     * before it sleeps, negative values select the default of the native library */
+    public void setSpinBudget(int spin) {
+		spinBudget = spin;
     }
     
     public boolean readSeqRetry() {
@@ -90,11 +137,32 @@ public class SharedMem {
     private native void updateByteBuffer(float bbFloat, int bbInt);
     private native int getActiveDataOffset();
     private native long getSeqCount();
+    private native long waitSeqBegin(int spin);
+    private native long waitSeqUpdate(long lastSeq, int timeoutMs);
+    private native long readData(ByteBuffer dst, int offset, int len, int spin);
+    private native long readArbitrary(long[] dst, int first, int count, int spin);
+    private native long readArbitraryBuffer(LongBuffer dst, int first, int count, int spin);
+    private native long readProjection(ByteBuffer dst, int[] ranges, int count, int spin);
+    private native int readHistory(long since, ByteBuffer dst, int offset, int len, long[] seqs, long[] timesNs,
+                                   boolean[] lost);
+    private static native int getLayoutHash();
 
     // Native private elements
     private long seq = -1;
+    private int spinBudget = -1;
+    private final boolean[] historyLost = new boolean[1];
+    
+    // sinceSeq of readHistory() for all versions
+    public static final long HISTORY_ALL = -1L;
+    // Buffer readBBValues() copies integer and float to
+    private static final int HEAD_SIZE = DataStruct.OFFSET_FP + 4;
+    private final ByteBuffer head = ByteBuffer.allocateDirect(HEAD_SIZE).order(ByteOrder.nativeOrder());
     
     static {
     	System.load("/system/lib/libandroitshmem.so");
+    	
+    	// The offsets of DataStruct are only valid for the data the library was built for
+    	if (getLayoutHash() != DataStruct.LAYOUT_HASH)
+    		throw new UnsatisfiedLinkError("libandroitshmem was built for another layout of data_struct");
     }
 }
@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+package com.androit;
+
+import java.nio.BufferOverflowException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
+/* Batch of updates of the shared data, committed as one non-RT transaction
+ * with a single JNI call: readers see all updates of a batch at once and
+ * are invalidated only once. The updates are records in a direct buffer,
+ * see AndroitShmemBatch.h for the format. */
+public class WriteBatch {
+	private static final int RECORD_HEADER = 8;
+	private static final int ALIGN = 8;
+	
+	private final ByteBuffer buf;
+	private int used;
+	private int count;
+	
+	// Creates a batch of at most capacity bytes of records
+	public WriteBatch(int capacity) {
+		buf = ByteBuffer.allocateDirect(capacity).order(ByteOrder.nativeOrder());
+	}
+	
+	public WriteBatch setInteger(int value) {
+		return putInt(DataStruct.OFFSET_INTEGER, value);
+	}
+	
+	public WriteBatch setFloat(float value) {
+		return putFloat(DataStruct.OFFSET_FP, value);
+	}
+	
+	// Stores value at offset of the data, see DataStruct for the offsets
+	public WriteBatch putByte(int offset, byte value) {
+		buf.put(reserve(offset, 1), value);
+		return this;
+	}
+	
+	public WriteBatch putShort(int offset, short value) {
+		buf.putShort(reserve(offset, 2), value);
+		return this;
+	}
+	
+	public WriteBatch putInt(int offset, int value) {
+		buf.putInt(reserve(offset, 4), value);
+		return this;
+	}
+	
+	public WriteBatch putLong(int offset, long value) {
+		buf.putLong(reserve(offset, 8), value);
+		return this;
+	}
+	
+	public WriteBatch putFloat(int offset, float value) {
+		buf.putFloat(reserve(offset, 4), value);
+		return this;
+	}
+	
+	public WriteBatch putDouble(int offset, double value) {
+		buf.putDouble(reserve(offset, 8), value);
+		return this;
+	}
+	
+	// Stores values[first .. first + n) at offset of the data, as one update
+	public WriteBatch putBytes(int offset, byte[] values, int first, int n) {
+		int pos = reserve(offset, n);
+		
+		for (int i = 0; i < n; i++)
+			buf.put(pos + i, values[first + i]);
+		return this;
+	}
+	
+	public WriteBatch putShorts(int offset, short[] values, int first, int n) {
+		int pos = reserve(offset, n * 2);
+		
+		for (int i = 0; i < n; i++)
+			buf.putShort(pos + i * 2, values[first + i]);
+		return this;
+	}
+	
+	public WriteBatch putInts(int offset, int[] values, int first, int n) {
+		int pos = reserve(offset, n * 4);
+		
+		for (int i = 0; i < n; i++)
+			buf.putInt(pos + i * 4, values[first + i]);
+		return this;
+	}
+	
+	public WriteBatch putLongs(int offset, long[] values, int first, int n) {
+		int pos = reserve(offset, n * 8);
+		
+		for (int i = 0; i < n; i++)
+			buf.putLong(pos + i * 8, values[first + i]);
+		return this;
+	}
+	
+	public WriteBatch putFloats(int offset, float[] values, int first, int n) {
+		int pos = reserve(offset, n * 4);
+		
+		for (int i = 0; i < n; i++)
+			buf.putFloat(pos + i * 4, values[first + i]);
+		return this;
+	}
+	
+	public WriteBatch putDoubles(int offset, double[] values, int first, int n) {
+		int pos = reserve(offset, n * 8);
+		
+		for (int i = 0; i < n; i++)
+			buf.putDouble(pos + i * 8, values[first + i]);
+		return this;
+	}
+	
+	// Stores values[first .. first + n) in arbitrary[index .. index + n)
+	public WriteBatch setArbitrary(int index, long[] values, int first, int n) {
+		DataStruct.setArbitrary(this, index, values, first, n);
+		return this;
+	}
+	
+	// Number of updates in the batch
+	public int size() {
+		return count;
+	}
+	
+	public void clear() {
+		used = 0;
+		count = 0;
+	}
+	
+	/* Applies all updates as one transaction and empties the batch. Returns 0
+	 * or a negative errno (-EINVAL: an update lies outside the data). */
+	public int commit() {
+		int ret = commit(buf, used);
+		
+		if (ret == 0)
+			clear();
+		return ret;
+	}
+	
+	// Appends the header of a record of len bytes at offset, returns the position of its bytes
+	private int reserve(int offset, int len) {
+		int size = (RECORD_HEADER + len + ALIGN - 1) / ALIGN * ALIGN;
+		int pos = used;
+		
+		if (size > buf.capacity() - used)
+			throw new BufferOverflowException();
+		
+		buf.putInt(pos, offset);
+		buf.putInt(pos + 4, len);
+		used += size;
+		count++;
+		return pos + RECORD_HEADER;
+	}
+	
+	// Methods provided by the native library
+	private static native int commit(ByteBuffer buf, int used);
+	
+	static {
+		System.load("/system/lib/libandroitshmem.so");
+	}
+}
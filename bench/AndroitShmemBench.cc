@@ -0,0 +1,1330 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Latency/throughput benchmark of the AndroitShmem hot paths. Runs a
+ * configurable number of RT writers, non-RT writers and readers (each a
+ * thread, optionally pinned to a CPU) against a region for a fixed time
+ * and reports latency percentiles, retries and throughput per operation:
+ * 	- rt_write:     begin_rt_write() .. end_rt_write()
+ * 	- read:         seq_begin() .. seq_doretry() returning false
+ * 	                (with -J: seq_project() of integer, fp and the span)
+ * 	- nonrt_commit: begin_nonrt_write() .. successful CAS, including retries
+ * 	                (with -B: nonrt_write_batch() of one record per field)
+ * 	- wakeup:       commit of a writer .. return of wait_for_update()
+ * With -m nbuf the region is an N-buffer region (AndroitShmemNBuf.h), all
+ * writers go through nbuf_begin_write() .. nbuf_commit() and readers
+ * through nbuf_read_begin() .. nbuf_read_end().
+ * With -m striped the region is a striped region (AndroitShmemStriped.h).
+ * Every writer owns a segment, readers use the seqlock of the segment
+ * their elements lie in, or take a snapshot of the whole region if they
+ * span several segments.
+ * With -m image the region holds an 8 MB image, writers and readers access
+ * spans of it at random offsets: the access pattern of large regions, whose
+ * cost is dominated by TLB misses and page faults. Local regions can be
+ * backed by huge pages (-g) and bound to a NUMA node (-z); page faults and
+ * dTLB load misses of the run are reported for every mode.
+ * With -m paged the same image lives in a page-mapped region
+ * (AndroitShmemPaged.h): non-RT transactions copy only the pages they
+ * modify instead of resyncing the dirty blocks of the whole image.
+ * With -m lr and -m single the region is a left-right region
+ * (AndroitShmemLeftRight.h) or a single-copy one (striped_shared<T, 1>);
+ * all writers and readers use the policy API of AndroitShmemPolicy.h.
+ * With -U the seqlock and nbuf regions are used through it as well, for a
+ * head-to-head comparison of the policies.
+ * With -D the non-RT writers of -B give up on their transaction after a
+ * number of failed commits and delegate the batch to an apply queue
+ * (AndroitShmemApply.h), which the RT writers apply at the end of their
+ * writes: the worst case of nonrt_commit no longer depends on the RT
+ * write rate.
+ * With -C the RT writers publish their writes as batches into the slots of
+ * a combiner (AndroitShmemCombine.h): whichever holds rt_wlock applies all
+ * pending ones in a single RT write.
+ * With -i the RT writers run a priority inversion scenario: RT writer 0
+ * holds rt_wlock for a while at the lowest priority, hog threads keep the
+ * CPUs busy at a medium priority, and the other RT writers (reported as
+ * rt_write) need the lock at the highest priority. Without priority
+ * inheritance (-P) their worst case depends on the hogs, not the holder.
+ * This replaces AndroitShmemClient_timemeasure and is meant to catch
+ * regressions in the determinism of the synchronisation. */
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <vector>
+
+#include <AndroitShmem.h>
+#include <AndroitShmemApply.h>
+#include <AndroitShmemAttach.h>
+#include <AndroitShmemBacking.h>
+#include <AndroitShmemBatch.h>
+#include <AndroitShmemCombine.h>
+#include <AndroitShmemNBuf.h>
+#include <AndroitShmemPaged.h>
+#include <AndroitShmemPolicy.h>
+#include <AndroitShmemProject.h>
+#include <AndroitShmemStriped.h>
+#include <AndroitShmemTransport.h>
+#include <AndroitShmemWait.h>
+#include "Histogram.h"
+
+using namespace androit;
+
+enum mode {
+	MODE_SEQLOCK,
+	MODE_NBUF,
+	MODE_STRIPED,
+	MODE_IMAGE,
+	MODE_PAGED,
+	MODE_LEFT_RIGHT,
+	MODE_SINGLE
+};
+
+// Region data of -m image and -m paged, 8 MB
+enum {
+	BENCH_IMAGE_WORDS = 1 << 20
+};
+
+struct bench_image {
+	int64_t px[BENCH_IMAGE_WORDS];
+};
+
+// Segments of the region with -m striped
+enum {
+	BENCH_SEGMENTS = 8
+};
+
+/* Apply queue of -D and combiner of -C, for the batches of
+ * nonrt_write_batched() and rt_write_combining(): up to 1026 records of 16
+ * bytes */
+enum {
+	BENCH_APPLY_SLOTS = 16,
+	BENCH_COMBINE_SLOTS = 16,
+	BENCH_BATCH_SIZE = 1026 * 16
+};
+
+enum role {
+	RT_WRITER,
+	NONRT_WRITER,
+	READER,
+	LISTENER,
+	HOG,
+	ROLES
+};
+
+static const char *role_names[] = { "rt_write", "nonrt_commit", "read", "wakeup", "hog" };
+
+// CPU time a hog of -i burns per period, it sleeps as long
+enum {
+	HOG_BUSY_US = 1000
+};
+
+struct options {
+	unsigned int threads[ROLES];  // Number of threads per role
+	unsigned int period_us[ROLES];// Period per role, 0: back-to-back
+	std::vector<int> cpus;        // CPUs to pin threads to, round-robin
+	unsigned int duration;        // Seconds
+	int rt_prio;                  // SCHED_FIFO priority of RT writers, 0: none
+	unsigned int rt_span;         // Elements of arbitrary[] an RT write touches
+	unsigned int nonrt_span;      // Elements of arbitrary[] a non-RT write touches
+	unsigned int read_span;       // Elements of arbitrary[] a read copies
+	unsigned int spin;            // Spin budget of seq_begin()
+	bool attach;                  // Use region "map" of a running server
+	bool service;                 // Attach to it through the service, not directly
+	enum mode mode;               // Synchronisation of the region
+	bool batch;                   // Non-RT writers commit write batches
+	unsigned int delegate;        // -D: failed commits before a batch is delegated, 0: never
+	bool combine;                 // -C: RT writers combine their writes
+	bool project;                 // -J: readers copy a projection
+	bool policy;                  // Use the policy API (AndroitShmemPolicy.h)
+	unsigned int hold_us;         // -i: time RT writer 0 holds rt_wlock, 0: no inversion scenario
+	int protect;                  // Lock options of the local region
+	unsigned int stats;           // Local region has a statistics page, 2: recording lock times
+	struct region_backing backing;// Pages of local regions
+};
+
+struct worker {
+	enum role role;
+	unsigned int id;
+	int cpu;
+	pthread_t thread;
+	histogram hist;
+	uint64_t ops;
+	uint64_t retries;
+	uint64_t failed;              // Writes that got no lock or slot
+	uint64_t copied;              // Blocks copied by non-RT transaction attempts
+	seq_t seq;                    // Last sequence a listener has seen
+	int slot;                     // Combiner slot of an RT writer of -C
+	unsigned int rand;            // State of the offsets of -m image and -m paged
+	std::vector<int64_t> buf;     // Copies of image readers
+};
+
+static struct options opts;
+static shared<data_struct> *region;
+static nbuf_shared<data_struct> *nbuf_region;
+static striped_shared<data_struct, BENCH_SEGMENTS> *striped_region;
+static shared<bench_image> *image_region;
+static paged_shared<bench_image> *paged_region;
+// Apply queue of -D, NULL without
+static struct apply_queue *apply;
+// Combiner of -C, NULL without
+static struct combiner *rt_combiner;
+static policy_region<data_struct, left_right_policy>::type *lr_region;
+static policy_region<data_struct, single_policy>::type *single_region;
+static pthread_barrier_t start_barrier;
+static volatile bool stop;
+// Time of the latest commit, for the wakeup latency of listeners
+static volatile uint64_t commit_ns;
+
+static inline uint64_t now_ns() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Sleeps until the next period of a periodic worker starts
+static inline void wait_period(struct timespec *next, unsigned int period_us) {
+	if (period_us == 0)
+		return;
+
+	next->tv_nsec += period_us * 1000L;
+	while (next->tv_nsec >= 1000000000L) {
+		next->tv_nsec -= 1000000000L;
+		next->tv_sec++;
+	}
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, next, NULL);
+}
+
+static void rt_write(struct worker *w) {
+	struct data_struct *active;
+	unsigned int base = w->id * opts.rt_span;
+	uint64_t start = now_ns();
+
+	begin_rt_write(region);
+
+	// RT writers modify the active data copy in place
+	active = &region->data[region->protect.sequence & 1];
+	rt_mark_dirty(region, &active->integer, sizeof(active->integer) + sizeof(active->fp));
+	active->integer++;
+	active->fp = active->fp * 1.0001f;
+	for (unsigned int j = 0; j < opts.rt_span; j++) {
+		int64_t *element = &active->arbitrary[(base + j) % 1024];
+
+		rt_mark_dirty(region, element, sizeof(*element));
+		(*element)++;
+	}
+
+	commit_ns = now_ns();
+	if (apply != NULL)
+		end_rt_write(region, NULL, apply);
+	else
+		end_rt_write(region);
+
+	w->hist.record(now_ns() - start);
+}
+
+/* Same updates as rt_write() (absolute values instead of increments),
+ * published into the combiner slot of the writer */
+static void rt_write_combining(struct worker *w) {
+	char buf[BENCH_BATCH_SIZE];
+	struct write_batch batch;
+	unsigned int base = w->id * opts.rt_span;
+	int integer = (int)w->ops;
+	float fp = (float)w->ops;
+	uint64_t start = now_ns();
+
+	batch_init(&batch, buf, sizeof(buf));
+	batch_add(&batch, offsetof(data_struct, integer), &integer, sizeof(integer));
+	batch_add(&batch, offsetof(data_struct, fp), &fp, sizeof(fp));
+	for (unsigned int j = 0; j < opts.rt_span && j < 1024; j++) {
+		int64_t element = (int64_t)w->ops;
+
+		batch_add(&batch, offsetof(data_struct, arbitrary) + ((base + j) % 1024) * sizeof(int64_t),
+			  &element, sizeof(element));
+	}
+
+	commit_ns = now_ns();
+	rt_write_combined(region, rt_combiner, w->slot, &batch);
+
+	w->hist.record(now_ns() - start);
+}
+
+// Busy-waits for us microseconds
+static void spin_for(unsigned int us) {
+	uint64_t end = now_ns() + us * 1000ULL;
+
+	while (now_ns() < end)
+		cpu_relax();
+}
+
+// Low priority RT writer of the inversion scenario, not measured
+static void rt_hold(void) {
+	begin_rt_write(region);
+	spin_for(opts.hold_us);
+	end_rt_write(region);
+}
+
+static void nonrt_write(struct worker *w) {
+	struct data_struct *update;
+	struct transaction tx;
+	unsigned int base = w->id * opts.nonrt_span;
+	uint64_t start = now_ns();
+
+	begin_nonrt_write(region);
+	nonrt_start(region, &tx);
+	for (;;) {
+		update = nonrt_begin(region, &tx);
+		w->copied += tx.copied;
+
+		// Same work as SharedMem.updateByteBuffer(), plus nonrt_span elements
+		nonrt_mark_dirty(region, &tx, &update->integer, sizeof(update->integer) + sizeof(update->fp));
+		update->fp = update->fp + 1.0f;
+		update->integer = update->integer + 1;
+		for (unsigned int j = 0; j < opts.nonrt_span; j++) {
+			int64_t *element = &update->arbitrary[(base + j) % 1024];
+
+			nonrt_mark_dirty(region, &tx, element, sizeof(*element));
+			(*element)--;
+		}
+
+		commit_ns = now_ns();
+		if (nonrt_commit(region, &tx))
+			break;
+		w->retries++;
+	}
+	end_nonrt_write(region);
+
+	w->hist.record(now_ns() - start);
+}
+
+/* Same updates as nonrt_write(), collected in a write batch (absolute
+ * values instead of increments) and committed at once */
+static void nonrt_write_batched(struct worker *w) {
+	char buf[BENCH_BATCH_SIZE];
+	struct write_batch batch;
+	unsigned int base = w->id * opts.nonrt_span;
+	int integer = (int)w->ops;
+	float fp = (float)w->ops;
+	uint64_t start = now_ns();
+
+	batch_init(&batch, buf, sizeof(buf));
+	batch_add(&batch, offsetof(data_struct, integer), &integer, sizeof(integer));
+	batch_add(&batch, offsetof(data_struct, fp), &fp, sizeof(fp));
+	for (unsigned int j = 0; j < opts.nonrt_span && j < 1024; j++) {
+		int64_t element = -(int64_t)w->ops;
+
+		batch_add(&batch, offsetof(data_struct, arbitrary) + ((base + j) % 1024) * sizeof(int64_t),
+			  &element, sizeof(element));
+	}
+
+	commit_ns = now_ns();
+	if (apply != NULL)
+		nonrt_write_batch(region, &batch, NULL, apply, opts.delegate);
+	else
+		nonrt_write_batch(region, &batch);
+
+	w->hist.record(now_ns() - start);
+}
+
+static void do_read(struct worker *w) {
+	static const unsigned int max_span = 1024;
+	const struct data_struct *active;
+	int64_t copy[max_span];
+	seq_t start_seq;
+	volatile int integer;
+	volatile float fp;
+	uint64_t start = now_ns();
+	bool retry;
+
+	do {
+		start_seq = seq_begin(region, opts.spin);
+		active = &region->data[start_seq & 1];
+
+		integer = active->integer;
+		fp = active->fp;
+		for (unsigned int j = 0; j < opts.read_span && j < max_span; j++)
+			copy[j] = active->arbitrary[j];
+
+		retry = seq_doretry(region, start_seq);
+		if (retry)
+			w->retries++;
+	} while (retry);
+
+	w->hist.record(now_ns() - start);
+	(void)integer;
+	(void)fp;
+	(void)copy;
+}
+
+/* Same data as do_read(), copied with seq_project(): integer and fp, then
+ * the span of arbitrary[] in at most PROJECTION_MAX - 1 ranges of equal size */
+static void project_read(struct worker *w) {
+	static const unsigned int max_span = 1024;
+	struct projection list[PROJECTION_MAX];
+	unsigned int count = 0, span = opts.read_span < max_span ? opts.read_span : max_span, step;
+	char copy[sizeof(int) + sizeof(float) + max_span * sizeof(int64_t)];
+	uint64_t start;
+	seq_t seq;
+
+	list[count].offset = offsetof(data_struct, integer);
+	list[count++].len = sizeof(int) + sizeof(float);
+	step = (span + PROJECTION_MAX - 2) / (PROJECTION_MAX - 1);
+	for (unsigned int j = 0; j < span; j += step) {
+		list[count].offset = offsetof(data_struct, arbitrary) + j * sizeof(int64_t);
+		list[count++].len = (span - j < step ? span - j : step) * sizeof(int64_t);
+	}
+
+	// A reader sets its list up once, only the copy is measured
+	start = now_ns();
+	seq = seq_project(region, list, count, copy, opts.spin);
+
+	w->hist.record(now_ns() - start);
+	(void)seq;
+}
+
+static void nbuf_write(struct worker *w, unsigned int span, int64_t delta) {
+	struct data_struct *update;
+	unsigned int slot, base = w->id * span;
+	uint64_t start = now_ns();
+
+	// No lock, or lagging readers pin every free slot
+	update = nbuf_begin_write(nbuf_region, &slot);
+	if (update == NULL) {
+		w->failed++;
+		return;
+	}
+
+	nbuf_mark_dirty(nbuf_region, slot, &update->integer, sizeof(update->integer) + sizeof(update->fp));
+	update->integer++;
+	update->fp = update->fp * 1.0001f;
+	for (unsigned int j = 0; j < span; j++) {
+		int64_t *element = &update->arbitrary[(base + j) % 1024];
+
+		nbuf_mark_dirty(nbuf_region, slot, element, sizeof(*element));
+		*element += delta;
+	}
+
+	commit_ns = now_ns();
+	nbuf_commit(nbuf_region, slot);
+
+	w->hist.record(now_ns() - start);
+}
+
+static void nbuf_read(struct worker *w) {
+	static const unsigned int max_span = 1024;
+	const struct data_struct *data;
+	int64_t copy[max_span];
+	unsigned int slot;
+	volatile int integer;
+	volatile float fp;
+	uint64_t start = now_ns();
+
+	// Never retries: the pinned slot does not change
+	data = nbuf_read_begin(nbuf_region, &slot);
+	integer = data->integer;
+	fp = data->fp;
+	for (unsigned int j = 0; j < opts.read_span && j < max_span; j++)
+		copy[j] = data->arbitrary[j];
+	nbuf_read_end(nbuf_region, slot);
+
+	w->hist.record(now_ns() - start);
+	(void)integer;
+	(void)fp;
+	(void)copy;
+}
+
+/* Writes span elements of arbitrary[] in segment seg, and integer and fp
+ * if they lie in it */
+static void striped_write(struct worker *w, unsigned int seg, unsigned int span, int64_t delta) {
+	struct data_struct *data = &striped_region->data;
+	unsigned int first = seg * striped_shared<data_struct, BENCH_SEGMENTS>::SEGMENT_SIZE / sizeof(int64_t);
+	uint64_t start = now_ns();
+
+	striped_begin_write(striped_region, seg, seg);
+
+	if (striped_segment(striped_region, &data->fp) == seg) {
+		data->integer++;
+		data->fp = data->fp * 1.0001f;
+	}
+	for (unsigned int j = 0; j < span && first + j < 1024; j++) {
+		int64_t *element = &data->arbitrary[first + j];
+
+		if (striped_segment(striped_region, element) != seg)
+			break;
+		*element += delta;
+	}
+
+	commit_ns = now_ns();
+	striped_end_write(striped_region, seg, seg);
+
+	w->hist.record(now_ns() - start);
+}
+
+static void striped_read(struct worker *w) {
+	static const unsigned int max_span = 1024;
+	const struct data_struct *data = &striped_region->data;
+	int64_t copy[max_span];
+	unsigned int base = (w->id * opts.read_span) % max_span, span, first, last;
+	seq_t start_seq;
+	uint64_t start = now_ns();
+	bool retry;
+
+	span = opts.read_span < max_span - base ? opts.read_span : max_span - base;
+	first = striped_segment(striped_region, &data->arbitrary[base]);
+	last = striped_segment(striped_region, &data->arbitrary[base + span - 1]);
+
+	do {
+		// A single segment needs only its own seqlock
+		if (first == last)
+			start_seq = striped_seq_begin(striped_region, first, opts.spin);
+		else
+			start_seq = striped_epoch_begin(striped_region, opts.spin);
+
+		for (unsigned int j = 0; j < span; j++)
+			copy[j] = data->arbitrary[base + j];
+
+		if (first == last)
+			retry = striped_seq_doretry(striped_region, first, start_seq);
+		else
+			retry = striped_epoch_doretry(striped_region, start_seq);
+		if (retry)
+			w->retries++;
+	} while (retry);
+
+	w->hist.record(now_ns() - start);
+	(void)copy;
+}
+
+// Waits for an update of any segment of the striped region
+static int striped_listen(struct worker *w, const struct timespec *timeout) {
+	struct update_wait waits[BENCH_SEGMENTS];
+	seq_t epoch = striped_epoch(striped_region);
+	int ret;
+
+	if (epoch == w->seq) {
+		for (unsigned int seg = 0; seg < BENCH_SEGMENTS; seg++)
+			striped_update_wait_init(&waits[seg], striped_region, seg, striped_region->segments[seg].sequence);
+
+		// Check the epoch again, the sequences above may be newer
+		if (striped_epoch(striped_region) == epoch) {
+			ret = wait_for_updates(waits, BENCH_SEGMENTS, timeout);
+			if (ret < 0)
+				return ret;
+		}
+	}
+
+	w->seq = striped_epoch(striped_region);
+	return 0;
+}
+
+static void listen(struct worker *w) {
+	static const struct timespec timeout = { 0, 100000000L };
+
+	// Time out regularly to notice the end of the benchmark
+	int ret;
+
+	if (opts.mode == MODE_IMAGE)
+		ret = wait_for_update(image_region, &w->seq, &timeout);
+	else if (opts.mode == MODE_PAGED)
+		ret = wait_for_update(paged_region, &w->seq, &timeout);
+	else if (opts.mode == MODE_LEFT_RIGHT)
+		ret = wait_for_update(lr_region, &w->seq, &timeout);
+	else if (opts.mode == MODE_SINGLE)
+		ret = protect_wait_for_update(&single_region->segments[0], &w->seq, &timeout);
+	else if (opts.mode == MODE_NBUF)
+		ret = wait_for_update(nbuf_region, &w->seq, &timeout);
+	else if (opts.mode == MODE_STRIPED)
+		ret = striped_listen(w, &timeout);
+	else
+		ret = wait_for_update(region, &w->seq, &timeout);
+
+	if (ret != 0) {
+		w->ops--;
+		return;
+	}
+
+	w->hist.record(now_ns() - commit_ns);
+}
+
+// Returns a random offset of span elements in the image
+static inline unsigned int image_offset(struct worker *w, unsigned int span) {
+	w->rand = w->rand * 1103515245 + 12345;
+	return (w->rand >> 4) % (BENCH_IMAGE_WORDS - span + 1);
+}
+
+static void image_write(struct worker *w, unsigned int span) {
+	struct bench_image *active;
+	unsigned int first = image_offset(w, span);
+	uint64_t start = now_ns();
+
+	begin_rt_write(image_region);
+	active = &image_region->data[image_region->protect.sequence & 1];
+	rt_mark_dirty(image_region, &active->px[first], span * sizeof(int64_t));
+	for (unsigned int j = 0; j < span; j++)
+		active->px[first + j]++;
+
+	commit_ns = now_ns();
+	end_rt_write(image_region);
+
+	w->hist.record(now_ns() - start);
+}
+
+static void image_nonrt_write(struct worker *w, unsigned int span) {
+	struct bench_image *update;
+	struct transaction tx;
+	unsigned int first = image_offset(w, span);
+	uint64_t start = now_ns();
+
+	begin_nonrt_write(image_region);
+	nonrt_start(image_region, &tx);
+	for (;;) {
+		update = nonrt_begin(image_region, &tx);
+		w->copied += tx.copied;
+		nonrt_mark_dirty(image_region, &tx, &update->px[first], span * sizeof(int64_t));
+		for (unsigned int j = 0; j < span; j++)
+			update->px[first + j]--;
+
+		commit_ns = now_ns();
+		if (nonrt_commit(image_region, &tx))
+			break;
+		w->retries++;
+	}
+	end_nonrt_write(image_region);
+
+	w->hist.record(now_ns() - start);
+}
+
+static void image_read(struct worker *w) {
+	unsigned int span = opts.read_span, first = image_offset(w, span);
+	seq_t start_seq;
+	uint64_t start = now_ns();
+
+	for (;;) {
+		start_seq = seq_begin(image_region, opts.spin);
+		memcpy(&w->buf[0], &image_region->data[start_seq & 1].px[first], span * sizeof(int64_t));
+		if (!seq_doretry(image_region, start_seq))
+			break;
+		w->retries++;
+	}
+
+	w->hist.record(now_ns() - start);
+}
+
+// Writes of nbuf_write() through the policy API
+template <typename Region>
+static void policy_write(struct worker *w, Region *r, unsigned int span, int64_t delta) {
+	struct data_struct *update;
+	struct sync_write wr;
+	unsigned int base = w->id * span;
+	uint64_t start = now_ns();
+
+	update = sync_write_begin(r, &wr);
+	if (update == NULL) {
+		w->failed++;
+		return;
+	}
+
+	sync_write_mark(r, &wr, &update->integer, sizeof(update->integer) + sizeof(update->fp));
+	update->integer++;
+	update->fp = update->fp * 1.0001f;
+	for (unsigned int j = 0; j < span; j++) {
+		int64_t *element = &update->arbitrary[(base + j) % 1024];
+
+		sync_write_mark(r, &wr, element, sizeof(*element));
+		*element += delta;
+	}
+
+	commit_ns = now_ns();
+	sync_write_commit(r, &wr);
+
+	w->hist.record(now_ns() - start);
+}
+
+// Reads of do_read() through the policy API
+template <typename Region>
+static void policy_read(struct worker *w, const Region *r) {
+	static const unsigned int max_span = 1024;
+	const struct data_struct *data;
+	struct sync_read rd;
+	int64_t copy[max_span];
+	volatile int integer;
+	volatile float fp;
+	uint64_t start = now_ns();
+	bool retry;
+
+	do {
+		data = sync_read_begin(r, &rd, opts.spin);
+
+		integer = data->integer;
+		fp = data->fp;
+		for (unsigned int j = 0; j < opts.read_span && j < max_span; j++)
+			copy[j] = data->arbitrary[j];
+
+		retry = sync_read_retry(r, &rd);
+		if (retry)
+			w->retries++;
+	} while (retry);
+
+	w->hist.record(now_ns() - start);
+	(void)integer;
+	(void)fp;
+	(void)copy;
+}
+
+template <typename Region>
+static void policy_op(struct worker *w, Region *r) {
+	if (w->role == RT_WRITER)
+		policy_write(w, r, opts.rt_span, 1);
+	else if (w->role == NONRT_WRITER)
+		policy_write(w, r, opts.nonrt_span, -1);
+	else
+		policy_read(w, r);
+}
+
+// Runs an operation of the role of w through the policy API
+static void policy_op(struct worker *w) {
+	if (opts.mode == MODE_LEFT_RIGHT)
+		policy_op(w, lr_region);
+	else if (opts.mode == MODE_SINGLE)
+		policy_op(w, single_region);
+	else if (opts.mode == MODE_NBUF)
+		policy_op(w, nbuf_region);
+	else
+		policy_op(w, region);
+}
+
+// Returns element index of the image, page is the frame holding it
+static inline int64_t *paged_px(char *page, unsigned int index) {
+	return (int64_t*)(page + index * sizeof(int64_t) % PAGED_PAGE);
+}
+
+static void paged_write(struct worker *w, unsigned int span) {
+	unsigned int first = image_offset(w, span), active;
+	uint64_t start = now_ns();
+
+	paged_begin_rt_write(paged_region);
+	active = paged_region->protect.sequence & 1;
+	for (unsigned int j = first; j < first + span; j++)
+		(*paged_px(paged_page(paged_region, active, j * sizeof(int64_t) / PAGED_PAGE), j))++;
+
+	commit_ns = now_ns();
+	paged_end_rt_write(paged_region);
+
+	w->hist.record(now_ns() - start);
+}
+
+static void paged_nonrt_write(struct worker *w, unsigned int span) {
+	struct transaction tx;
+	unsigned int first = image_offset(w, span);
+	uint64_t start = now_ns();
+
+	paged_begin_nonrt_write(paged_region);
+	for (;;) {
+		paged_nonrt_begin(paged_region, &tx);
+		for (unsigned int j = first; j < first + span; j++)
+			(*paged_px(paged_nonrt_page(paged_region, &tx, j * sizeof(int64_t) / PAGED_PAGE), j))--;
+		w->copied += tx.copied;
+
+		commit_ns = now_ns();
+		if (paged_nonrt_commit(paged_region, &tx))
+			break;
+		w->retries++;
+	}
+	paged_end_nonrt_write(paged_region);
+
+	w->hist.record(now_ns() - start);
+}
+
+static void paged_read(struct worker *w) {
+	unsigned int span = opts.read_span, first = image_offset(w, span);
+	seq_t start_seq;
+	uint64_t start = now_ns();
+
+	for (;;) {
+		start_seq = paged_seq_begin(paged_region, opts.spin);
+		paged_gather(paged_region, start_seq & 1, first * sizeof(int64_t), &w->buf[0], span * sizeof(int64_t));
+		if (!paged_seq_doretry(paged_region, start_seq))
+			break;
+		w->retries++;
+	}
+
+	w->hist.record(now_ns() - start);
+}
+
+/* Maps a process-local region of size bytes with the backing of -g/-N,
+ * returns MAP_FAILED on errors */
+static void *map_local(size_t size) {
+	void *base;
+	int fd = backing_open("bench", &opts.backing, true);
+
+	if (fd < 0) {
+		errno = -fd;
+		return MAP_FAILED;
+	}
+
+	base = backing_map(fd, backing_size(size, &opts.backing), &opts.backing);
+	close(fd);
+	return base;
+}
+
+// Opens a counter of the dTLB load misses of this process and its threads, -1 if there is none
+static int open_tlb_counter(void) {
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.disabled = 1;
+	attr.inherit = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void *run(void *arg) {
+	struct worker *w = (struct worker*)arg;
+	struct timespec next;
+
+	if (w->cpu >= 0) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(w->cpu, &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+			fprintf(stderr, "Could not pin %s %u to CPU %d\n", role_names[w->role], w->id, w->cpu);
+	}
+
+	if ((w->role == RT_WRITER || w->role == HOG) && opts.rt_prio > 0) {
+		struct sched_param param;
+
+		// Inversion scenario: holder at prio, hogs at prio + 1, measured writers at prio + 2
+		param.sched_priority = opts.rt_prio;
+		if (w->role == HOG)
+			param.sched_priority += 1;
+		else if (opts.hold_us > 0 && w->id > 0)
+			param.sched_priority += 2;
+		if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0)
+			fprintf(stderr, "Could not make %s %u SCHED_FIFO\n", role_names[w->role], w->id);
+	}
+
+	if (w->role == RT_WRITER && rt_combiner != NULL)
+		w->slot = combine_register(rt_combiner);
+
+	pthread_barrier_wait(&start_barrier);
+	clock_gettime(CLOCK_MONOTONIC, &next);
+
+	while (!stop) {
+		switch (w->role) {
+		case RT_WRITER:
+			if (opts.hold_us > 0 && w->id == 0)
+				rt_hold();
+			else if (opts.policy)
+				policy_op(w);
+			else if (opts.mode == MODE_IMAGE)
+				image_write(w, opts.rt_span);
+			else if (opts.mode == MODE_PAGED)
+				paged_write(w, opts.rt_span);
+			else if (opts.mode == MODE_NBUF)
+				nbuf_write(w, opts.rt_span, 1);
+			else if (opts.mode == MODE_STRIPED)
+				striped_write(w, w->id % BENCH_SEGMENTS, opts.rt_span, 1);
+			else if (rt_combiner != NULL)
+				rt_write_combining(w);
+			else
+				rt_write(w);
+			break;
+		case NONRT_WRITER:
+			if (opts.policy)
+				policy_op(w);
+			else if (opts.mode == MODE_IMAGE)
+				image_nonrt_write(w, opts.nonrt_span);
+			else if (opts.mode == MODE_PAGED)
+				paged_nonrt_write(w, opts.nonrt_span);
+			else if (opts.mode == MODE_NBUF)
+				nbuf_write(w, opts.nonrt_span, -1);
+			else if (opts.mode == MODE_STRIPED)
+				striped_write(w, BENCH_SEGMENTS - 1 - w->id % BENCH_SEGMENTS, opts.nonrt_span, -1);
+			else if (opts.batch)
+				nonrt_write_batched(w);
+			else
+				nonrt_write(w);
+			break;
+		case READER:
+			if (opts.policy)
+				policy_op(w);
+			else if (opts.mode == MODE_IMAGE)
+				image_read(w);
+			else if (opts.mode == MODE_PAGED)
+				paged_read(w);
+			else if (opts.mode == MODE_NBUF)
+				nbuf_read(w);
+			else if (opts.mode == MODE_STRIPED)
+				striped_read(w);
+			else if (opts.project)
+				project_read(w);
+			else
+				do_read(w);
+			break;
+		case LISTENER:
+			listen(w);
+			break;
+		case HOG:
+			spin_for(HOG_BUSY_US);
+			break;
+		default:
+			break;
+		}
+		w->ops++;
+
+		wait_period(&next, opts.period_us[w->role]);
+	}
+
+	return NULL;
+}
+
+static uint64_t total_ops(const std::vector<worker*> &workers) {
+	uint64_t ops = 0;
+
+	for (size_t i = 0; i < workers.size(); i++)
+		if (workers[i]->role != HOG)
+			ops += workers[i]->ops;
+
+	return ops > 0 ? ops : 1;
+}
+
+static void report(const std::vector<worker*> &workers, double seconds) {
+	uint64_t attempts = 0, copied = 0;
+
+	printf("%-13s %7s %12s %11s %9s %9s %9s %9s %9s %10s\n", "op", "threads", "ops", "ops/s",
+	       "p50[ns]", "p99[ns]", "p99.9[ns]", "max[ns]", "mean[ns]", "retries");
+
+	for (int r = RT_WRITER; r < ROLES; r++) {
+		histogram hist;
+		uint64_t ops = 0, retries = 0, failed = 0;
+
+		if (opts.threads[r] == 0 || r == HOG)
+			continue;
+
+		for (size_t i = 0; i < workers.size(); i++) {
+			if (workers[i]->role != r)
+				continue;
+			hist.merge(workers[i]->hist);
+			ops += workers[i]->ops;
+			retries += workers[i]->retries;
+			failed += workers[i]->failed;
+			if (r == NONRT_WRITER) {
+				attempts += workers[i]->ops + workers[i]->retries;
+				copied += workers[i]->copied;
+			}
+		}
+
+		printf("%-13s %7u %12llu %11.0f %9llu %9llu %9llu %9llu %9llu %10llu\n", role_names[r],
+		       opts.threads[r], (unsigned long long)ops, ops / seconds,
+		       (unsigned long long)hist.percentile(0.5), (unsigned long long)hist.percentile(0.99),
+		       (unsigned long long)hist.percentile(0.999), (unsigned long long)hist.max,
+		       (unsigned long long)(hist.count ? hist.sum / hist.count : 0), (unsigned long long)retries);
+		if (failed > 0)
+			printf("# %s: %llu of the ops failed (no lock or free slot)\n", role_names[r],
+			       (unsigned long long)failed);
+	}
+
+	if (attempts > 0 && opts.mode == MODE_SEQLOCK && !opts.batch)
+		printf("# nonrt_commit: %.1f of %u blocks copied per attempt\n",
+		       (double)copied / attempts, (unsigned int)shared<data_struct>::BLOCKS);
+	else if (attempts > 0 && opts.mode == MODE_IMAGE)
+		printf("# nonrt_commit: %.1f of %u blocks copied per attempt\n",
+		       (double)copied / attempts, (unsigned int)shared<bench_image>::BLOCKS);
+	else if (attempts > 0 && opts.mode == MODE_PAGED)
+		printf("# nonrt_commit: %.1f of %u pages copied per attempt\n",
+		       (double)copied / attempts, (unsigned int)paged_shared<bench_image>::PAGES);
+}
+
+static void parse_cpus(const char *list) {
+	char *copy = strdup(list), *save = NULL, *tok;
+
+	for (tok = strtok_r(copy, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+		int first, last;
+
+		if (sscanf(tok, "%d-%d", &first, &last) != 2)
+			last = first = atoi(tok);
+		for (int cpu = first; cpu <= last; cpu++)
+			opts.cpus.push_back(cpu);
+	}
+
+	free(copy);
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -w N        RT writer threads (default 1)\n"
+		"  -n N        non-RT writer threads (default 1)\n"
+		"  -r N        reader threads (default 2)\n"
+		"  -l N        listener threads, blocking in wait_for_update() (default 0)\n"
+		"  -W us       RT writer period (default 0: back-to-back)\n"
+		"  -N us       non-RT writer period (default 0)\n"
+		"  -R us       reader period (default 0)\n"
+		"  -c cpus     pin threads round-robin to cpus, e.g. 0,2-3\n"
+		"  -d s        duration in seconds (default 5)\n"
+		"  -p prio     run RT writers SCHED_FIFO with prio\n"
+		"  -s N        elements of arbitrary[] per RT write (default 16)\n"
+		"  -u N        elements of arbitrary[] per non-RT write (default 0)\n"
+		"  -S N        elements of arbitrary[] per read (default 1024)\n"
+		"  -b N        seq_begin() spin budget of readers before sleeping\n"
+		"              (default %u, -1: spin only)\n"
+		"  -a          attach to region \"map\" of a running AndroitShmemServer\n"
+		"              instead of a process-local region\n"
+		"  -A          with -a, attach through the service instead of directly\n"
+		"  -B          non-RT writers commit a write batch per operation\n"
+		"  -J          readers copy a projection (seq_project()) instead of reading\n"
+		"              in place\n"
+		"  -C          RT writers combine their writes (combiner of %u slots)\n"
+		"  -D N        with -B, delegate a batch to the RT writers after N failed\n"
+		"              commits (apply queue of %u slots)\n"
+		"  -m mode     synchronisation of the local region: seqlock (default),\n"
+		"              nbuf (%u slots) or striped (%u segments, writer i owns\n"
+		"              segment i, reader i reads elements i * span ..) or image\n"
+		"              (%u MB, spans at random offsets, -u defaults to 16) or paged\n"
+		"              (the image in a page-mapped region), lr (left-right) or\n"
+		"              single (one copy)\n"
+		"  -U          use the policy API for seqlock and nbuf regions too\n"
+		"  -g pages    pages of the local region: 4k (default), thp or huge\n"
+		"  -z node     bind the local region to NUMA node\n"
+		"  -i us       priority inversion scenario: RT writer 0 holds rt_wlock for\n"
+		"              us at prio (-p), the other RT writers write at prio + 2\n"
+		"  -H N        hog threads of -i, busy %u of every %u us at prio + 1 (default 1)\n"
+		"  -P          local region without priority inheritance (PTHREAD_PRIO_NONE)\n"
+		"  -T          local region with a statistics page, like served regions (-TT: recording lock times)\n", prog, (unsigned int)SEQ_SPIN_DEFAULT,
+		(unsigned int)BENCH_COMBINE_SLOTS, (unsigned int)BENCH_APPLY_SLOTS,
+		(unsigned int)(sizeof(nbuf_region->slots) / sizeof(nbuf_region->slots[0])),
+		(unsigned int)BENCH_SEGMENTS, (unsigned int)(sizeof(struct bench_image) >> 20), (unsigned int)HOG_BUSY_US, 2 * (unsigned int)HOG_BUSY_US);
+}
+
+int main(int argc, char *argv[]) {
+	std::vector<worker*> workers;
+	struct rusage usage_start, usage_end;
+	int64_t tlb_misses = -1;
+	uint64_t start, end;
+	int opt, tlb;
+
+	opts.threads[RT_WRITER] = 1;
+	opts.threads[NONRT_WRITER] = 1;
+	opts.threads[READER] = 2;
+	opts.threads[LISTENER] = 0;
+	memset(opts.period_us, 0, sizeof(opts.period_us));
+	opts.duration = 5;
+	opts.rt_prio = 0;
+	opts.rt_span = 16;
+	opts.nonrt_span = 0;
+	opts.read_span = 1024;
+	opts.spin = SEQ_SPIN_DEFAULT;
+	opts.attach = false;
+	opts.service = false;
+	opts.mode = MODE_SEQLOCK;
+	opts.batch = false;
+	opts.delegate = 0;
+	opts.combine = false;
+	opts.project = false;
+	opts.policy = false;
+	opts.hold_us = 0;
+	opts.protect = PROTECT_DEFAULT;
+	opts.stats = 0;
+	opts.backing = default_backing();
+	opts.threads[HOG] = 1;
+	opts.period_us[HOG] = 2 * HOG_BUSY_US;
+
+	while ((opt = getopt(argc, argv, "w:n:r:l:W:N:R:c:d:p:s:u:S:b:aABCD:JUm:i:H:PTg:z:h")) != -1) {
+		switch (opt) {
+		case 'w': opts.threads[RT_WRITER] = atoi(optarg); break;
+		case 'n': opts.threads[NONRT_WRITER] = atoi(optarg); break;
+		case 'r': opts.threads[READER] = atoi(optarg); break;
+		case 'l': opts.threads[LISTENER] = atoi(optarg); break;
+		case 'W': opts.period_us[RT_WRITER] = atoi(optarg); break;
+		case 'N': opts.period_us[NONRT_WRITER] = atoi(optarg); break;
+		case 'R': opts.period_us[READER] = atoi(optarg); break;
+		case 'c': parse_cpus(optarg); break;
+		case 'd': opts.duration = atoi(optarg); break;
+		case 'p': opts.rt_prio = atoi(optarg); break;
+		case 's': opts.rt_span = atoi(optarg); break;
+		case 'u': opts.nonrt_span = atoi(optarg); break;
+		case 'S': opts.read_span = atoi(optarg); break;
+		case 'b': opts.spin = strtol(optarg, NULL, 0) < 0 ? (unsigned int)SEQ_SPIN_FOREVER : atoi(optarg); break;
+		case 'a': opts.attach = true; break;
+		case 'A': opts.service = true; break;
+		case 'B': opts.batch = true; break;
+		case 'C': opts.combine = true; break;
+		case 'J': opts.project = true; break;
+		case 'D': opts.delegate = atoi(optarg); break;
+		case 'U': opts.policy = true; break;
+		case 'i': opts.hold_us = atoi(optarg); break;
+		case 'H': opts.threads[HOG] = atoi(optarg); break;
+		case 'P': opts.protect &= ~PROTECT_PI; break;
+		case 'T': opts.stats++; break;
+		case 'g':
+			if (!backing_parse_pages(optarg, &opts.backing.pages)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'z': opts.backing.numa_node = atoi(optarg); break;
+		case 'm':
+			if (strcmp(optarg, "nbuf") == 0) {
+				opts.mode = MODE_NBUF;
+			} else if (strcmp(optarg, "striped") == 0) {
+				opts.mode = MODE_STRIPED;
+			} else if (strcmp(optarg, "image") == 0 || strcmp(optarg, "paged") == 0) {
+				opts.mode = strcmp(optarg, "image") == 0 ? MODE_IMAGE : MODE_PAGED;
+				if (opts.nonrt_span == 0)
+					opts.nonrt_span = 16;
+			} else if (strcmp(optarg, "lr") == 0) {
+				opts.mode = MODE_LEFT_RIGHT;
+				opts.policy = true;
+			} else if (strcmp(optarg, "single") == 0) {
+				opts.mode = MODE_SINGLE;
+				opts.policy = true;
+			} else if (strcmp(optarg, "seqlock") != 0) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (opts.attach && opts.mode != MODE_SEQLOCK) {
+		fprintf(stderr, "Region map of AndroitShmemServer is a seqlock region\n");
+		return 1;
+	}
+
+	if (opts.policy && opts.mode != MODE_SEQLOCK && opts.mode != MODE_NBUF && opts.mode != MODE_LEFT_RIGHT &&
+	    opts.mode != MODE_SINGLE) {
+		fprintf(stderr, "-U applies to seqlock, nbuf, lr and single regions\n");
+		return 1;
+	}
+
+	if (opts.delegate > 0 && (opts.mode != MODE_SEQLOCK || opts.attach || opts.policy || !opts.batch)) {
+		fprintf(stderr, "-D needs a local seqlock region and -B\n");
+		return 1;
+	}
+
+	if (opts.project && (opts.mode != MODE_SEQLOCK || opts.policy)) {
+		fprintf(stderr, "-J needs a seqlock region\n");
+		return 1;
+	}
+
+	if (opts.combine && (opts.mode != MODE_SEQLOCK || opts.attach || opts.policy || opts.hold_us > 0 ||
+			     opts.threads[RT_WRITER] > BENCH_COMBINE_SLOTS)) {
+		fprintf(stderr, "-C needs a local seqlock region and at most %u RT writers\n",
+			(unsigned int)BENCH_COMBINE_SLOTS);
+		return 1;
+	}
+
+	if (opts.hold_us > 0) {
+		if (opts.mode != MODE_SEQLOCK || opts.attach || opts.rt_prio <= 0 || opts.threads[RT_WRITER] < 2) {
+			fprintf(stderr, "-i needs a local seqlock region, -p and at least 2 RT writers\n");
+			return 1;
+		}
+	} else {
+		opts.threads[HOG] = 0;
+	}
+
+	if ((opts.mode == MODE_IMAGE || opts.mode == MODE_PAGED) &&
+	    (opts.rt_span > BENCH_IMAGE_WORDS || opts.nonrt_span > BENCH_IMAGE_WORDS ||
+	     opts.read_span > BENCH_IMAGE_WORDS)) {
+		fprintf(stderr, "Spans of -m image and -m paged must not exceed %u elements\n",
+			(unsigned int)BENCH_IMAGE_WORDS);
+		return 1;
+	}
+
+	if (opts.mode == MODE_IMAGE) {
+		image_region = (shared<bench_image>*)map_local(sizeof(*image_region));
+		if (image_region == MAP_FAILED || init_shared(image_region, (void (*)(bench_image*))NULL, opts.protect) != 0) {
+			fprintf(stderr, "Could not set up region: %s\n", strerror(errno));
+			return 1;
+		}
+	} else if (opts.mode == MODE_PAGED) {
+		paged_region = (paged_shared<bench_image>*)map_local(sizeof(*paged_region));
+		if (paged_region == MAP_FAILED || init_shared(paged_region, (void (*)(bench_image*))NULL, opts.protect) != 0) {
+			fprintf(stderr, "Could not set up region: %s\n", strerror(errno));
+			return 1;
+		}
+	} else if (opts.mode == MODE_LEFT_RIGHT) {
+		lr_region = (lr_shared<data_struct>*)map_local(sizeof(*lr_region));
+		if (lr_region == MAP_FAILED || init_shared(lr_region, init_sample_data, opts.protect) != 0) {
+			fprintf(stderr, "Could not set up region: %s\n", strerror(errno));
+			return 1;
+		}
+	} else if (opts.mode == MODE_SINGLE) {
+		single_region = (striped_shared<data_struct, 1>*)map_local(sizeof(*single_region));
+		if (single_region == MAP_FAILED || init_shared(single_region, init_sample_data) != 0) {
+			fprintf(stderr, "Could not set up region: %s\n", strerror(errno));
+			return 1;
+		}
+	} else if (opts.mode == MODE_NBUF) {
+		nbuf_region = (nbuf_shared<data_struct>*)map_local(sizeof(*nbuf_region));
+		if (nbuf_region == MAP_FAILED || init_shared(nbuf_region, init_sample_data) != 0) {
+			fprintf(stderr, "Could not set up region: %s\n", strerror(errno));
+			return 1;
+		}
+	} else if (opts.mode == MODE_STRIPED) {
+		striped_region = (striped_shared<data_struct, BENCH_SEGMENTS>*)map_local(sizeof(*striped_region));
+		if (striped_region == MAP_FAILED || init_shared(striped_region, init_sample_data) != 0) {
+			fprintf(stderr, "Could not set up region: %s\n", strerror(errno));
+			return 1;
+		}
+	} else if (opts.attach) {
+		struct attachment attachment;
+		uint64_t attach_start = now_ns();
+
+		attachment_init(&attachment);
+		region = attach_region<shared<data_struct> >("map", &attachment,
+							     (opts.service ? ATTACH_SERVICE : ATTACH_DEFAULT) | ATTACH_LOCK);
+		if (region == NULL) {
+			fprintf(stderr, "Region map not available, is AndroitShmemServer running?\n");
+			return 1;
+		}
+		printf("# attached %s in %.1f us\n", attachment.fd >= 0 ? "directly" : "through the service",
+		       (now_ns() - attach_start) / 1e3);
+	} else {
+		// Process-local region, same layout and protection as a served one
+		size_t size = opts.stats ? stats_offset_for(sizeof(*region)) + sizeof(struct region_stats) : sizeof(*region);
+
+		region = (shared<data_struct>*)map_local(size);
+		if (region == MAP_FAILED || init_shared(region, init_sample_data, opts.protect) != 0) {
+			fprintf(stderr, "Could not set up region: %s\n", strerror(errno));
+			return 1;
+		}
+		if (opts.stats) {
+			struct region_stats *stats = (struct region_stats*)((char*)region + stats_offset_for(sizeof(*region)));
+
+			init_stats(stats);
+			stats->timing = opts.stats > 1;
+			region->header.stats_offset = stats_offset_for(sizeof(*region));
+		}
+	}
+
+	if (opts.combine) {
+		rt_combiner = (struct combiner*)map_local(combiner_size(BENCH_COMBINE_SLOTS, BENCH_BATCH_SIZE));
+		if (rt_combiner == MAP_FAILED || init_combiner(rt_combiner, BENCH_COMBINE_SLOTS, BENCH_BATCH_SIZE,
+							    sizeof(data_struct), layout_hash<data_struct>::value) != 0) {
+			fprintf(stderr, "Could not set up combiner: %s\n", strerror(errno));
+			return 1;
+		}
+	}
+
+	if (opts.delegate > 0) {
+		apply = (struct apply_queue*)map_local(apply_queue_size(BENCH_APPLY_SLOTS, BENCH_BATCH_SIZE));
+		if (apply == MAP_FAILED || init_apply_queue(apply, BENCH_APPLY_SLOTS, BENCH_BATCH_SIZE, sizeof(data_struct),
+							    layout_hash<data_struct>::value) != 0) {
+			fprintf(stderr, "Could not set up apply queue: %s\n", strerror(errno));
+			return 1;
+		}
+	}
+
+	for (int r = RT_WRITER; r < ROLES; r++) {
+		for (unsigned int i = 0; i < opts.threads[r]; i++) {
+			worker *w = new worker();
+
+			w->role = (enum role)r;
+			w->id = i;
+			w->cpu = opts.cpus.empty() ? -1 : opts.cpus[workers.size() % opts.cpus.size()];
+			w->rand = workers.size() + 1;
+			if ((opts.mode == MODE_IMAGE || opts.mode == MODE_PAGED) && r == READER)
+				w->buf.resize(opts.read_span + 1);
+			workers.push_back(w);
+		}
+	}
+
+	if (workers.empty()) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	// Before the threads are created, they inherit it
+	tlb = open_tlb_counter();
+
+	pthread_barrier_init(&start_barrier, NULL, workers.size() + 1);
+	for (size_t i = 0; i < workers.size(); i++) {
+		if (pthread_create(&workers[i]->thread, NULL, run, workers[i]) != 0) {
+			fprintf(stderr, "Could not create thread\n");
+			return 1;
+		}
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	getrusage(RUSAGE_SELF, &usage_start);
+	if (tlb >= 0)
+		ioctl(tlb, PERF_EVENT_IOC_ENABLE, 0);
+	start = now_ns();
+	sleep(opts.duration);
+	stop = true;
+
+	for (size_t i = 0; i < workers.size(); i++)
+		pthread_join(workers[i]->thread, NULL);
+	end = now_ns();
+	if (tlb >= 0) {
+		ioctl(tlb, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(tlb, &tlb_misses, sizeof(tlb_misses)) != sizeof(tlb_misses))
+			tlb_misses = -1;
+	}
+	getrusage(RUSAGE_SELF, &usage_end);
+
+	printf("# %u RT writers, %u non-RT writers, %u readers, %u listeners, %u s, %s region\n",
+	       opts.threads[RT_WRITER], opts.threads[NONRT_WRITER], opts.threads[READER], opts.threads[LISTENER],
+	       opts.duration, opts.attach ? "served" : opts.mode == MODE_NBUF ? "local nbuf" :
+	       opts.mode == MODE_STRIPED ? "local striped" : opts.mode == MODE_IMAGE ? "local image" :
+	       opts.mode == MODE_PAGED ? "local paged" : opts.mode == MODE_LEFT_RIGHT ? "local left-right" :
+	       opts.mode == MODE_SINGLE ? "local single-copy" : "local");
+	if (!opts.attach)
+		printf("# %s pages%s\n", opts.backing.pages == BACKING_HUGETLB ? "hugetlbfs" :
+		       opts.backing.pages == BACKING_THP ? "transparent huge" : "base",
+		       opts.backing.numa_node >= 0 ? ", NUMA bound" : "");
+	if (opts.policy)
+		printf("# policy API, region of %zu bytes\n", opts.mode == MODE_LEFT_RIGHT ? sizeof(*lr_region) :
+		       opts.mode == MODE_SINGLE ? sizeof(*single_region) : opts.mode == MODE_NBUF ? sizeof(*nbuf_region) :
+		       sizeof(*region));
+	if (opts.hold_us > 0)
+		printf("# inversion: rt_write 0 holds rt_wlock %u us, %u hogs, priority inheritance %s\n",
+		       opts.hold_us, opts.threads[HOG], opts.protect & PROTECT_PI ? "on" : "off");
+	report(workers, (end - start) / 1e9);
+
+	printf("# page faults: %ld minor, %ld major", usage_end.ru_minflt - usage_start.ru_minflt,
+	       usage_end.ru_majflt - usage_start.ru_majflt);
+	if (tlb_misses >= 0)
+		printf(", dTLB load misses: %lld (%.1f/op)\n", (long long)tlb_misses,
+		       (double)tlb_misses / total_ops(workers));
+	else
+		printf(", dTLB load misses: n/a\n");
+
+	return 0;
+}
@@ -0,0 +1,601 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/* Checks of the synchronisation protocols whose results the benchmark does
+ * not verify, on process-local regions. ctest runs each of them, or run
+ * AndroitShmemCheck [check ...] (default: all):
+ * 	- recover: an RT writer killed while it holds rt_wlock is rolled back
+ * 	  by the next reader, a non-RT writer killed holding nonrt_wlock is
+ * 	  recovered from by the next non-RT writer
+ * 	- dirty:   transactions that only copy dirty blocks end up with the
+ * 	  same data as a reference copy, with RT writes interfering
+ * 	- history: versions read from a history are never torn, while a
+ * 	  non-RT recorder stalls and RT recorders lap the ring
+ * 	- apply:   delegated batches are applied once and in order, a batch
+ * 	  nobody applies is withdrawn after APPLY_TIMEOUT_NS
+ * 	- combine: combined RT writes apply every update of every writer
+ * Every check prints a line, the exit status is 1 if one failed. */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <AndroitShmem.h>
+#include <AndroitShmemApply.h>
+#include <AndroitShmemBatch.h>
+#include <AndroitShmemCombine.h>
+#include <AndroitShmemHistory.h>
+
+using namespace androit;
+
+// Stops the threads of a check
+static volatile bool stop;
+
+static inline uint64_t now_ns() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Prints why check failed, returns false
+static bool failed(const char *check, const char *fmt, ...) {
+	va_list args;
+
+	printf("%-8s FAILED: ", check);
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
+	printf("\n");
+
+	return false;
+}
+
+// Maps size bytes of memory shared with forked children, exits on errors
+static void *map_shared(size_t size) {
+	void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if (base == MAP_FAILED) {
+		fprintf(stderr, "Could not map %zu bytes: %s\n", size, strerror(errno));
+		exit(1);
+	}
+
+	return base;
+}
+
+// Returns a region with the sample data and a statistics page, like served regions
+static shared<data_struct> *new_region(void) {
+	size_t offset = stats_offset_for(sizeof(shared<data_struct>));
+	shared<data_struct> *region = (shared<data_struct>*)map_shared(offset + sizeof(struct region_stats));
+
+	if (init_shared(region, init_sample_data) != 0) {
+		fprintf(stderr, "Could not set up region\n");
+		exit(1);
+	}
+	init_stats((struct region_stats*)((char*)region + offset));
+	region->header.stats_offset = offset;
+
+	return region;
+}
+
+static const struct data_struct *active_of(const shared<data_struct> *region) {
+	return &region->data[region->protect.sequence & 1];
+}
+
+///////////////////////////////////////////////////////////////////
+// recover
+static bool check_recover(void) {
+#ifndef ANDROIT_SHMEM_ROBUST
+	printf("%-8s skipped: no robust locks\n", "recover");
+	return true;
+#else
+	shared<data_struct> *region = new_region();
+	struct data_struct expected, copy;
+	struct transaction tx;
+	struct data_struct *update;
+	int status;
+	pid_t pid;
+
+	init_sample_data(&expected);
+
+	// An RT writer dies halfway through its write, holding rt_wlock
+	pid = fork();
+	if (pid == 0) {
+		begin_rt_write(region);
+		update = &region->data[region->protect.sequence & 1];
+		rt_mark_dirty(region, &update->arbitrary[0], 32 * sizeof(update->arbitrary[0]));
+		for (int j = 0; j < 32; j++)
+			update->arbitrary[j] = -1;
+		kill(getpid(), SIGKILL);
+	}
+	waitpid(pid, &status, 0);
+
+	// The reader waits SEQ_RECOVER_MS for it, then rolls the write back
+	seq_copy(region, 0, &copy, sizeof(copy));
+	if (memcmp(&copy, &expected, sizeof(copy)) != 0)
+		return failed("recover", "data of the dead RT writer was not rolled back");
+	if (region->protect.dead_writers != 1 || region->protect.torn != 0)
+		return failed("recover", "dead_writers %u, torn at %llu", region->protect.dead_writers,
+			      (unsigned long long)region->protect.torn);
+	if (begin_rt_write(region) != 0 || end_rt_write(region) != 0)
+		return failed("recover", "rt_wlock unusable after recovery");
+
+	// A non-RT writer dies in its transaction, holding nonrt_wlock
+	pid = fork();
+	if (pid == 0) {
+		begin_nonrt_write(region);
+		nonrt_start(region, &tx);
+		update = nonrt_begin(region, &tx);
+		nonrt_mark_dirty(region, &tx, &update->arbitrary[100], sizeof(update->arbitrary[100]));
+		update->arbitrary[100] = -1;
+		kill(getpid(), SIGKILL);
+	}
+	waitpid(pid, &status, 0);
+
+	// The next one takes over its lock, and does not commit its leftovers
+	if (begin_nonrt_write(region) != 0)
+		return failed("recover", "nonrt_wlock of the dead non-RT writer not recovered");
+	nonrt_start(region, &tx);
+	do {
+		update = nonrt_begin(region, &tx);
+		nonrt_mark_dirty(region, &tx, &update->integer, sizeof(update->integer));
+		update->integer = 7;
+	} while (!nonrt_commit(region, &tx));
+	end_nonrt_write(region);
+
+	expected.integer = 7;
+	seq_copy(region, 0, &copy, sizeof(copy));
+	if (memcmp(&copy, &expected, sizeof(copy)) != 0)
+		return failed("recover", "data of the dead non-RT writer was committed");
+
+	printf("%-8s ok\n", "recover");
+	return true;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////
+// dirty
+enum {
+	CHECK_DIRTY_STEPS = 20000
+};
+
+struct modification {
+	unsigned int index[8];
+	int64_t value[8];
+	unsigned int count;
+};
+
+static void pick(struct modification *m, unsigned int *seed) {
+	m->count = 1 + rand_r(seed) % 8;
+	for (unsigned int i = 0; i < m->count; i++) {
+		m->index[i] = rand_r(seed) % 1024;
+		m->value[i] = rand_r(seed);
+	}
+}
+
+static void apply_to(struct data_struct *data, const struct modification *m) {
+	for (unsigned int i = 0; i < m->count; i++)
+		data->arbitrary[m->index[i]] = m->value[i];
+}
+
+static void rt_modify(shared<data_struct> *region, const struct modification *m) {
+	struct data_struct *active;
+
+	begin_rt_write(region);
+	active = &region->data[region->protect.sequence & 1];
+	for (unsigned int i = 0; i < m->count; i++)
+		rt_mark_dirty(region, &active->arbitrary[m->index[i]], sizeof(active->arbitrary[0]));
+	apply_to(active, m);
+	end_rt_write(region);
+}
+
+static bool check_dirty(void) {
+	shared<data_struct> *region = new_region();
+	struct data_struct ref, *update;
+	struct modification m, rt;
+	struct transaction tx;
+	unsigned int seed = 1, copied = 0, attempts = 0;
+
+	init_sample_data(&ref);
+
+	for (unsigned int step = 0; step < CHECK_DIRTY_STEPS; step++) {
+		pick(&m, &seed);
+
+		if (rand_r(&seed) % 2) {
+			rt_modify(region, &m);
+			apply_to(&ref, &m);
+		} else {
+			begin_nonrt_write(region);
+			nonrt_start(region, &tx);
+			for (;;) {
+				update = nonrt_begin(region, &tx);
+				for (unsigned int i = 0; i < m.count; i++)
+					nonrt_mark_dirty(region, &tx, &update->arbitrary[m.index[i]],
+							 sizeof(update->arbitrary[0]));
+				apply_to(update, &m);
+				copied += tx.copied;
+				attempts++;
+
+				// RT writes interfere with every other attempt: it is retried on top of them
+				if (rand_r(&seed) % 2) {
+					pick(&rt, &seed);
+					rt_modify(region, &rt);
+					apply_to(&ref, &rt);
+				}
+				if (nonrt_commit(region, &tx))
+					break;
+			}
+			end_nonrt_write(region);
+			apply_to(&ref, &m);
+		}
+
+		if (memcmp(active_of(region), &ref, sizeof(ref)) != 0)
+			return failed("dirty", "data differs from the reference after step %u", step);
+	}
+
+	printf("%-8s ok, %.1f of %u blocks copied per attempt\n", "dirty", (double)copied / attempts,
+	       (unsigned int)shared<data_struct>::BLOCKS);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////
+// history
+enum {
+	// Entries of the history and duration of the concurrent part
+	CHECK_HISTORY_CAPACITY = 8,
+	CHECK_HISTORY_MS = 1000
+};
+
+struct recorded {
+	uint64_t words[32];
+};
+
+struct history_recorder {
+	struct history *h;
+	unsigned int id;      // Low bit of the sequences recorded
+	bool stall;           // Sleep between history_record() and history_publish() now and then
+};
+
+// Versions recorded by the check have their sequence in every word
+static void fill_recorded(struct recorded *data, seq_t seq) {
+	for (unsigned int i = 0; i < 32; i++)
+		data->words[i] = seq;
+}
+
+// Returns false if one of count versions read is torn
+static bool check_recorded(const struct recorded *out, const struct history_stamp *stamps, int count) {
+	for (int k = 0; k < count; k++)
+		for (unsigned int i = 0; i < 32; i++)
+			if (out[k].words[i] != stamps[k].seq)
+				return failed("history", "torn version %llu: word %u is %llu",
+					      (unsigned long long)stamps[k].seq, i, (unsigned long long)out[k].words[i]);
+	return true;
+}
+
+static void *record_loop(void *arg) {
+	struct history_recorder *rec = (struct history_recorder*)arg;
+	struct history_entry *entry;
+	struct recorded data;
+	uint64_t index, n = 0;
+
+	while (!stop) {
+		n++;
+		fill_recorded(&data, n * 2 + rec->id);
+
+		entry = history_record(rec->h, &index, &data, n * 2 + rec->id);
+		/* A non-RT recorder preempted in its copy while RT recorders lap
+		 * the ring: it writes the second half of the entry afterwards */
+		if (rec->stall && n % 50 == 0) {
+			usleep(200);
+			memcpy(history_data(entry) + sizeof(data) / 2, &data.words[16], sizeof(data) / 2);
+		}
+		history_publish(entry, index, true);
+	}
+
+	return NULL;
+}
+
+static bool check_history(void) {
+	size_t size = history_size(CHECK_HISTORY_CAPACITY, sizeof(struct recorded));
+	struct history *h = (struct history*)map_shared(size);
+	struct history_recorder recs[2] = { { h, 0, false }, { h, 1, true } };
+	struct recorded out[CHECK_HISTORY_CAPACITY];
+	struct history_stamp stamps[CHECK_HISTORY_CAPACITY];
+	uint64_t versions = 0, deadline, index;
+	struct history_entry *stalled;
+	struct recorded data;
+	pthread_t threads[2];
+	bool lost, ok = true;
+	int count;
+
+	init_history(h, CHECK_HISTORY_CAPACITY, sizeof(struct recorded), 0);
+
+	/* First in order: a recorder stalls in its copy while others record a
+	 * whole lap of the ring, then finishes its copy */
+	fill_recorded(&data, 1);
+	stalled = history_record(h, &index, &data, 1);
+	for (seq_t seq = 2; seq <= 2 * (CHECK_HISTORY_CAPACITY + 1); seq += 2) {
+		struct history_entry *entry;
+		uint64_t i;
+
+		fill_recorded(&data, seq);
+		entry = history_record(h, &i, &data, seq);
+		history_publish(entry, i, true);
+	}
+	fill_recorded(&data, 1);
+	memcpy(history_data(stalled) + sizeof(data) / 2, &data.words[16], sizeof(data) / 2);
+	history_publish(stalled, index, true);
+
+	count = history_read(h, HISTORY_ALL, 0, sizeof(struct recorded), out, stamps, CHECK_HISTORY_CAPACITY, &lost);
+	if (count <= 0 || !check_recorded(out, stamps, count))
+		return count <= 0 ? failed("history", "no versions after a lap: %d", count) : false;
+
+	// Then concurrently
+	init_history(h, CHECK_HISTORY_CAPACITY, sizeof(struct recorded), 0);
+	deadline = now_ns() + CHECK_HISTORY_MS * 1000000ULL;
+	stop = false;
+	for (int i = 0; i < 2; i++)
+		pthread_create(&threads[i], NULL, record_loop, &recs[i]);
+
+	while (ok && now_ns() < deadline) {
+		count = history_read(h, HISTORY_ALL, 0, sizeof(struct recorded), out, stamps,
+				     CHECK_HISTORY_CAPACITY, &lost);
+		ok = check_recorded(out, stamps, count);
+		versions += count > 0 ? count : 0;
+	}
+
+	stop = true;
+	for (int i = 0; i < 2; i++)
+		pthread_join(threads[i], NULL);
+
+	if (ok)
+		printf("%-8s ok, %llu versions read, %llu recorded\n", "history", (unsigned long long)versions,
+		       (unsigned long long)h->head);
+	return ok;
+}
+
+///////////////////////////////////////////////////////////////////
+// apply
+enum {
+	// Slots and batch size of the apply queue (and the combiner)
+	CHECK_SLOTS = 8,
+	CHECK_BATCH_SIZE = 256,
+	CHECK_APPLY_BATCHES = 5000
+};
+
+struct apply_check {
+	shared<data_struct> *region;
+	struct apply_queue *q;
+};
+
+// RT writes of other data, each applying pending batches at its end
+static void *apply_rt_loop(void *arg) {
+	struct apply_check *c = (struct apply_check*)arg;
+	struct data_struct *active;
+	int64_t n = 0;
+
+	while (!stop) {
+		begin_rt_write(c->region);
+		active = &c->region->data[c->region->protect.sequence & 1];
+		rt_mark_dirty(c->region, &active->arbitrary[5], sizeof(active->arbitrary[5]));
+		active->arbitrary[5] = n++;
+		end_rt_write(c->region, NULL, c->q);
+	}
+
+	return NULL;
+}
+
+// The drain thread of the service
+static void *apply_drain_loop(void *arg) {
+	static const struct timespec poll = { 0, 10 * 1000000L };
+	struct apply_check *c = (struct apply_check*)arg;
+
+	while (!stop)
+		if (apply_wait_ready(c->q, &poll) == 0)
+			apply_commit(c->region, c->q);
+
+	return NULL;
+}
+
+static struct apply_queue *new_apply_queue(void) {
+	size_t size = apply_queue_size(CHECK_SLOTS, CHECK_BATCH_SIZE);
+	struct apply_queue *q = (struct apply_queue*)map_shared(size);
+
+	init_apply_queue(q, CHECK_SLOTS, CHECK_BATCH_SIZE, sizeof(data_struct), layout_hash<data_struct>::value);
+	return q;
+}
+
+static bool check_apply(void) {
+	struct apply_check c = { new_region(), new_apply_queue() };
+	struct stats_slot total;
+	struct write_batch batch;
+	char buf[CHECK_BATCH_SIZE];
+	pthread_t threads[2];
+	seq_t start_seq;
+	uint64_t start;
+	int value, ret = 0;
+	bool ok = true;
+
+	// Nobody applies: the writer withdraws its batch and the next RT write skips it
+	batch_init(&batch, buf, sizeof(buf));
+	value = -1;
+	batch_add(&batch, offsetof(data_struct, integer), &value, sizeof(value));
+
+	start = now_ns();
+	begin_nonrt_write(c.region);
+	ret = nonrt_delegate(c.region, c.q, batch.buf, batch.used);
+	end_nonrt_write(c.region);
+	if (ret != -ETIMEDOUT || now_ns() - start < APPLY_TIMEOUT_NS)
+		return failed("apply", "undrained batch not withdrawn after the timeout: %d", ret);
+
+	begin_rt_write(c.region);
+	if (apply_pending(c.region, c.q, CHECK_SLOTS) != 1 || active_of(c.region)->integer == -1)
+		return failed("apply", "withdrawn batch was applied");
+	end_rt_write(c.region);
+
+	// Every other batch is delegated right away, the others after 0..2 failed commits
+	stop = false;
+	pthread_create(&threads[0], NULL, apply_rt_loop, &c);
+	pthread_create(&threads[1], NULL, apply_drain_loop, &c);
+
+	for (int i = 0; i < CHECK_APPLY_BATCHES && ok; i++) {
+		batch_init(&batch, buf, sizeof(buf));
+		batch_add(&batch, offsetof(data_struct, integer), &i, sizeof(i));
+
+		if (i % 2) {
+			begin_nonrt_write(c.region);
+			ret = nonrt_delegate(c.region, c.q, batch.buf, batch.used);
+			end_nonrt_write(c.region);
+		} else {
+			ret = nonrt_write_batch(c.region, &batch, NULL, c.q, i % 3);
+		}
+		if (ret != 0) {
+			ok = failed("apply", "batch %d not applied: %d", i, ret);
+			break;
+		}
+
+		// Applied before the writer returned, and not overwritten by an older batch
+		do {
+			start_seq = seq_begin(c.region);
+			value = c.region->data[start_seq & 1].integer;
+		} while (seq_doretry(c.region, start_seq));
+		if (value != i)
+			ok = failed("apply", "batch %d read back as %d", i, value);
+	}
+
+	stop = true;
+	for (int i = 0; i < 2; i++)
+		pthread_join(threads[i], NULL);
+
+	if (ok) {
+		stats_sum(region_stats_of(&c.region->header), &total);
+		printf("%-8s ok, %llu batches delegated, %llu applied\n", "apply",
+		       (unsigned long long)total.counters[STAT_NONRT_DELEGATED],
+		       (unsigned long long)total.counters[STAT_APPLIED]);
+	}
+	return ok;
+}
+
+///////////////////////////////////////////////////////////////////
+// combine
+enum {
+	CHECK_COMBINE_WRITERS = 4,
+	// Updates per writer
+	CHECK_COMBINE_UPDATES = 50000
+};
+
+struct combine_check {
+	shared<data_struct> *region;
+	struct combiner *c;
+	unsigned int id;
+	int ret;
+};
+
+// Counts element id up to CHECK_COMBINE_UPDATES, one combined RT write per step
+static void *combine_loop(void *arg) {
+	struct combine_check *w = (struct combine_check*)arg;
+	struct write_batch batch;
+	char buf[CHECK_BATCH_SIZE];
+	int slot = combine_register(w->c);
+
+	w->ret = slot < 0 ? slot : 0;
+	for (int64_t n = 1; n <= CHECK_COMBINE_UPDATES && w->ret == 0; n++) {
+		batch_init(&batch, buf, sizeof(buf));
+		batch_add(&batch, offsetof(data_struct, arbitrary) + w->id * sizeof(int64_t), &n, sizeof(n));
+		w->ret = rt_write_combined(w->region, w->c, slot, &batch);
+	}
+
+	if (slot >= 0)
+		combine_unregister(w->c, slot);
+	return NULL;
+}
+
+static bool check_combine(void) {
+	shared<data_struct> *region = new_region();
+	struct combiner *c = (struct combiner*)map_shared(combiner_size(CHECK_SLOTS, CHECK_BATCH_SIZE));
+	struct combine_check writers[CHECK_COMBINE_WRITERS];
+	pthread_t threads[CHECK_COMBINE_WRITERS];
+	struct stats_slot total;
+
+	init_combiner(c, CHECK_SLOTS, CHECK_BATCH_SIZE, sizeof(data_struct), layout_hash<data_struct>::value);
+	for (unsigned int i = 0; i < CHECK_COMBINE_WRITERS; i++) {
+		writers[i].region = region;
+		writers[i].c = c;
+		writers[i].id = i;
+		pthread_create(&threads[i], NULL, combine_loop, &writers[i]);
+	}
+	for (unsigned int i = 0; i < CHECK_COMBINE_WRITERS; i++)
+		pthread_join(threads[i], NULL);
+
+	for (unsigned int i = 0; i < CHECK_COMBINE_WRITERS; i++) {
+		if (writers[i].ret != 0)
+			return failed("combine", "writer %u failed: %d", i, writers[i].ret);
+		if (active_of(region)->arbitrary[i] != CHECK_COMBINE_UPDATES)
+			return failed("combine", "element %u is %lld", i, (long long)active_of(region)->arbitrary[i]);
+	}
+
+	stats_sum(region_stats_of(&region->header), &total);
+	printf("%-8s ok, %u updates in %llu RT writes\n", "combine", CHECK_COMBINE_WRITERS * CHECK_COMBINE_UPDATES,
+	       (unsigned long long)total.counters[STAT_RT_WRITES]);
+	return true;
+}
+
+// Ends with an entry without name
+static const struct {
+	const char *name;
+	bool (*run)(void);
+} checks[] = {
+	{ "recover", check_recover },
+	{ "dirty", check_dirty },
+	{ "history", check_history },
+	{ "apply", check_apply },
+	{ "combine", check_combine },
+	{ NULL, NULL }
+};
+
+int main(int argc, char *argv[]) {
+	bool ok = true;
+
+	for (int i = 1; i < argc; i++) {
+		size_t c;
+
+		for (c = 0; checks[c].name != NULL && strcmp(argv[i], checks[c].name) != 0; c++)
+			;
+		if (checks[c].name == NULL) {
+			fprintf(stderr, "Unknown check %s, checks are:", argv[i]);
+			for (c = 0; checks[c].name != NULL; c++)
+				fprintf(stderr, " %s", checks[c].name);
+			fprintf(stderr, "\n");
+			return 1;
+		}
+		ok = checks[c].run() && ok;
+	}
+
+	if (argc == 1)
+		for (size_t c = 0; checks[c].name != NULL; c++)
+			ok = checks[c].run() && ok;
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_HISTOGRAM_H
+#define ANDROIT_SHMEM_HISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>
+
+namespace androit {
+	/* Log-linear latency histogram (nanoseconds). Values below 64 ns get
+	 * a bucket each, every power of two above is split into 32 sub-buckets,
+	 * which bounds the relative error of reported percentiles to ~3%.
+	 * Recording is a handful of instructions and never allocates, so each
+	 * benchmark thread records into a histogram of its own; they are merged
+	 * afterwards. */
+	struct histogram {
+		enum {
+			SUB_BITS = 5,
+			SUB_BUCKETS = 1 << SUB_BITS,
+			// 64 linear buckets, then 32 sub-buckets for 2^6 .. 2^42 ns
+			BUCKETS = 2 * SUB_BUCKETS + (42 - 6) * SUB_BUCKETS
+		};
+
+		uint64_t counts[BUCKETS];
+		uint64_t count;
+		uint64_t max;
+		uint64_t sum;
+
+		histogram() {
+			reset();
+		}
+
+		void reset() {
+			memset(this, 0, sizeof(*this));
+		}
+
+		static unsigned int index(uint64_t ns) {
+			unsigned int exp;
+
+			if (ns < 2 * SUB_BUCKETS)
+				return ns;
+
+			exp = 63 - __builtin_clzll(ns); // >= SUB_BITS + 1
+			if (exp >= 42)
+				return BUCKETS - 1;
+
+			return (exp - SUB_BITS + 1) * SUB_BUCKETS +
+				((ns >> (exp - SUB_BITS)) & (SUB_BUCKETS - 1));
+		}
+
+		// Largest value that falls into bucket i
+		static uint64_t upper(unsigned int i) {
+			unsigned int exp;
+
+			if (i < 2 * SUB_BUCKETS)
+				return i;
+
+			exp = i / SUB_BUCKETS + SUB_BITS - 1;
+			return ((uint64_t)(SUB_BUCKETS + i % SUB_BUCKETS + 1) << (exp - SUB_BITS)) - 1;
+		}
+
+		void record(uint64_t ns) {
+			counts[index(ns)]++;
+			count++;
+			sum += ns;
+			if (ns > max)
+				max = ns;
+		}
+
+		void merge(const histogram &other) {
+			for (unsigned int i = 0; i < BUCKETS; i++)
+				counts[i] += other.counts[i];
+			count += other.count;
+			sum += other.sum;
+			if (other.max > max)
+				max = other.max;
+		}
+
+		// Value below which the fraction p (0..1) of all samples lies
+		uint64_t percentile(double p) const {
+			uint64_t rank, seen = 0;
+
+			if (count == 0)
+				return 0;
+
+			rank = (uint64_t)(p * count + 0.5);
+			if (rank == 0)
+				rank = 1;
+
+			for (unsigned int i = 0; i < BUCKETS; i++) {
+				seen += counts[i];
+				if (seen >= rank)
+					return upper(i) < max ? upper(i) : max;
+			}
+
+			return max;
+		}
+	};
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_HISTOGRAM_H */
@@ -0,0 +1,766 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_H
+#define ANDROIT_SHMEM_H
+
+/* Data layout and synchronisation of AndroitShmem regions. This part does
+ * not depend on Binder or any other transport, see AndroitShmemTransport.h
+ * for how clients obtain a region. */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <type_traits>
+
+#include <AndroitShmemAtomic.h>
+#include <AndroitShmemFutex.h>
+#include <AndroitShmemStats.h>
+// struct that declares the actual data to be shared, generated from schema/data_struct.schema
+#include <AndroitShmemData.h>
+
+namespace androit {
+	enum {
+		CACHE_LINE = 64,
+		// Identifies an initialised region ("ASHM")
+		REGION_MAGIC = 0x4d485341,
+		/* Version of the region layout. Bump on every change of
+		 * region_header, protect or shared<T>. */
+		LAYOUT_VERSION = 13,
+		// Statistics pages start at this alignment behind their region
+		STATS_ALIGN = 4096
+	};
+
+	// Synchronisation scheme of a region
+	enum sync_mode {
+		SYNC_SEQLOCK = 0,   // shared<T>: seqlock, 2 copies for non-RT transactions
+		SYNC_NBUF = 1,      // nbuf_shared<T, N>: N slots, see AndroitShmemNBuf.h
+		SYNC_STRIPED = 2,   // striped_shared<T, S>: S segment seqlocks, see AndroitShmemStriped.h
+		SYNC_CHANNEL = 3,   // struct channel: message queue, see AndroitShmemChannel.h
+		SYNC_HISTORY = 4,   // struct history: versions of a shared<T>, see AndroitShmemHistory.h
+		SYNC_PAGED = 5,     // paged_shared<T>: copy-on-write pages, see AndroitShmemPaged.h
+		SYNC_LEFT_RIGHT = 6,// lr_shared<T>: wait-free readers, see AndroitShmemLeftRight.h
+		SYNC_APPLY = 7,     // struct apply_queue: delegated non-RT writes, see AndroitShmemApply.h
+		SYNC_COMBINE = 8    // struct combiner: combined RT writes, see AndroitShmemCombine.h
+	};
+
+/* Locks inherit the priority of their waiters where the C library supports
+ * it, so a low-priority RT writer holding rt_wlock cannot be preempted by
+ * medium-priority tasks while a high-priority writer waits. Robust locks
+ * let the next locker recover from a writer that died holding the lock
+ * (see recover_rt_write()); bionic does not provide them. */
+#if !defined(ANDROIT_SHMEM_ROBUST) && !defined(__BIONIC__)
+#define ANDROIT_SHMEM_ROBUST 1
+#endif
+
+/* Data copies start at this alignment, define as 4096 to give every copy
+ * pages of its own. Part of the layout: all clients of a region must use
+ * the same value, attaching otherwise fails. */
+#ifndef ANDROIT_SHMEM_COPY_ALIGN
+#define ANDROIT_SHMEM_COPY_ALIGN 64
+#endif
+
+	/* First cache line of a region, only written on initialisation. Clients
+	 * check it before they use a region (see check_layout()). */
+	struct region_header {
+		uint32_t magic;
+		uint32_t layout_version;
+		uint32_t data_size;      // sizeof(T)
+		uint32_t copy_align;     // ANDROIT_SHMEM_COPY_ALIGN
+		uint64_t region_size;    // sizeof() of the region type
+		uint32_t sync_mode;      // enum sync_mode
+		uint32_t copies;         // Number of data copies
+		uint32_t layout_hash;    // layout_hash<T>, see AndroitShmemSchema.h
+		uint32_t stats_offset;   // Of the region_stats behind the region, 0: none
+	};
+
+	// Returns the statistics page of a region, NULL if it has none
+	static inline struct region_stats *region_stats_of(const struct region_header *header) {
+		if (header->stats_offset == 0)
+			return NULL;
+		return (struct region_stats*)((char*)header + header->stats_offset);
+	}
+
+	// Returns the offset of the statistics page behind a region of region_size bytes
+	static inline size_t stats_offset_for(size_t region_size) {
+		return (region_size + STATS_ALIGN - 1) / STATS_ALIGN * STATS_ALIGN;
+	}
+
+	/* Concurrency protection of a region. Every region has its own, so
+	 * writes to one region never make readers of another region retry.
+	 * Readers ensure consistent reads with the sequence counter.
+	 * RT Writers exclude each other mutually with a lock, so do non-RT
+	 * Writers. Non-RT Writers ensure consistency through transactions.
+	 * Members written by different parties live in cache lines of their
+	 * own: polling the sequence does not contend with lock traffic or
+	 * with registering waiters. */
+	struct protect {
+		/* 1-bit of sequence denotes which data copy is active,
+		 * 2-bit denotes if RT-Write is in progress. 2-bit is set/unset by
+		 * adding 2 to the sequence counter and thus increasing it. This signals
+		 * the data was updated. Futexes wait on its low 32 bits, see
+		 * seq_futex(). */
+		alignas(CACHE_LINE) seq_t sequence;
+		/* Number of readers sleeping in the kernel until the running RT
+		 * write finishes or the sequence advances (see AndroitShmemWait.h).
+		 * Commits only wake them if there are any. */
+		alignas(CACHE_LINE) unsigned int waiters;
+		alignas(CACHE_LINE) pthread_mutex_t rt_wlock;
+		/* Number of RT writers that died holding rt_wlock, and the sequence
+		 * at which the data of one was republished without being rolled
+		 * back completely (0: never). Only written under rt_wlock. */
+		unsigned int dead_writers;
+		seq_t torn;
+		alignas(CACHE_LINE) pthread_mutex_t nonrt_wlock;
+		/* synced[i]: data copy i was consistent to the active copy at this
+		 * sequence, except for blocks modified later (see dirty_gen).
+		 * Only accessed by non-RT writers, hence next to their lock. */
+		seq_t synced[2];
+	};
+
+	static_assert(offsetof(struct protect, sequence) % CACHE_LINE == 0 &&
+		      offsetof(struct protect, waiters) % CACHE_LINE == 0 &&
+		      offsetof(struct protect, rt_wlock) % CACHE_LINE == 0 &&
+		      offsetof(struct protect, nonrt_wlock) % CACHE_LINE == 0,
+		      "members of protect must not share cache lines");
+	static_assert(sizeof(pthread_mutex_t) + 2 * sizeof(seq_t) <= CACHE_LINE,
+		      "nonrt_wlock and synced must fit into one cache line");
+
+	// Options of the locks of init_protect()
+	enum {
+		PROTECT_PI = 1,      // Priority inheritance (if _POSIX_THREAD_PRIO_INHERIT)
+		PROTECT_ROBUST = 2,  // Robust (if ANDROIT_SHMEM_ROBUST)
+		PROTECT_DEFAULT = PROTECT_PI | PROTECT_ROBUST
+	};
+
+	/* Writers track modifications in blocks of DIRTY_BLOCK bytes (one cache
+	 * line) so that non-RT transactions only copy what changed since the
+	 * inactive data copy was last consistent, instead of the whole data. */
+	enum {
+		DIRTY_BLOCK = CACHE_LINE
+	};
+
+	/* One data copy of a region: T, starting at and padded to
+	 * ANDROIT_SHMEM_COPY_ALIGN so that the end of one copy does not share
+	 * a cache line (or page) with the start of the next. Converts to T*
+	 * implicitly. */
+	template <typename T>
+	struct alignas(ANDROIT_SHMEM_COPY_ALIGN) data_copy : public T {
+	};
+
+	// Region to be shared, containing concurrency protection and data of type T
+	template <typename T>
+	struct shared {
+		static_assert(std::is_class<T>::value, "region data must be a struct");
+
+		enum {
+			BLOCKS = (sizeof(T) + DIRTY_BLOCK - 1) / DIRTY_BLOCK
+		};
+
+		struct region_header header;
+		struct protect protect;
+		// Sequence at which each block of the data was last modified
+		alignas(CACHE_LINE) seq_t dirty_gen[BLOCKS];
+		/* dirty_gen of each block before the RT write that modified it last,
+		 * to roll back the writes of RT writers that died */
+		alignas(CACHE_LINE) seq_t prev_gen[BLOCKS];
+		data_copy<T> data[2]; // Store data twice for non-RT Writer transactions
+	};
+
+	// Marks blocks of [offset, offset + len) of the data as modified at sequence gen
+	template <typename T>
+	static inline void mark_dirty(shared<T> *region, size_t offset, size_t len, seq_t gen) {
+		size_t last;
+
+		if (len == 0)
+			return;
+
+		last = (offset + len - 1) / DIRTY_BLOCK;
+		for (size_t block = offset / DIRTY_BLOCK; block <= last && block < shared<T>::BLOCKS; block++)
+			region->dirty_gen[block] = gen;
+	}
+
+	///////////////////////////////////////////////////////////////////
+	// Synchronisation for concurrent RT writers
+	// Returns the futex word of the sequence: its low 32 bits, which change with every step
+	static inline unsigned int *seq_futex(const struct protect *protect) {
+		unsigned int *word = (unsigned int*)const_cast<seq_t*>(&protect->sequence);
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		word++;
+#endif
+		return word;
+	}
+
+	/* Wakes the readers sleeping in seq_wait(), if there are any, after the
+	 * caller updated the sequence. The fence orders that update before the
+	 * check of waiters (an atomic update is no store-load barrier on ARMv8
+	 * without LSE): no reader can miss the wakeup. */
+	static inline void seq_wake(struct protect *protect) {
+		fence_full();
+		if (load_relaxed(&protect->waiters) != 0)
+			futex_wake(seq_futex(protect), INT_MAX);
+	}
+
+	/* Marks a robust lock consistent again after its owner died (the caller
+	 * repaired what the owner left behind) */
+	static inline void lock_recovered(pthread_mutex_t *lock) {
+#ifdef ANDROIT_SHMEM_ROBUST
+		pthread_mutex_consistent(lock);
+#else
+		(void)lock;
+#endif
+	}
+
+	/* Repairs the region after an RT writer died holding rt_wlock, which the
+	 * caller now holds (EOWNERDEAD). If the writer died between
+	 * begin_rt_write() and end_rt_write(), every block it modified is rolled
+	 * back from the inactive copy if that still holds the block as it was
+	 * before the write (its previous generation is not newer than the
+	 * inactive copy). Blocks that cannot be rolled back are republished as
+	 * the writer left them, protect.torn records the sequence at which this
+	 * happened. Either way, the 2-bit is cleared and waiting readers are
+	 * woken, as end_rt_write() would have done. */
+	template <typename T>
+	static void recover_rt_write(shared<T> *region) {
+		struct protect *protect = &region->protect;
+		seq_t sequence = protect->sequence, synced;
+		char *active, *inactive;
+		bool rollback;
+		int ret;
+
+		protect->dead_writers++;
+		if (sequence & 2) {
+			/* Non-RT writers change the inactive copy. Without their lock
+			 * (its holder may wait for this very write), nothing is rolled
+			 * back. The dead writer did not hold it, RT writers never do. */
+			ret = pthread_mutex_trylock(&protect->nonrt_wlock);
+			if (ret == EOWNERDEAD) {
+				lock_recovered(&protect->nonrt_wlock);
+				ret = 0;
+			}
+			rollback = ret == 0;
+
+			active = (char*)&region->data[sequence & 1];
+			inactive = (char*)&region->data[1 - (sequence & 1)];
+			synced = protect->synced[1 - (sequence & 1)];
+
+			for (size_t block = 0; block < shared<T>::BLOCKS; block++) {
+				size_t offset = block * DIRTY_BLOCK;
+				size_t len = sizeof(T) - offset < DIRTY_BLOCK ? sizeof(T) - offset : (size_t)DIRTY_BLOCK;
+
+				// Only blocks the dead writer announced
+				if (region->dirty_gen[block] != sequence)
+					continue;
+
+				if (rollback && region->prev_gen[block] <= synced) {
+					memcpy(active + offset, inactive + offset, len);
+					region->dirty_gen[block] = region->prev_gen[block];
+				} else {
+					protect->torn = sequence + 2;
+				}
+			}
+
+			if (ret == 0)
+				pthread_mutex_unlock(&protect->nonrt_wlock);
+
+			add_full(&protect->sequence, (seq_t)2);
+			seq_wake(protect);
+		}
+
+		lock_recovered(&protect->rt_wlock);
+	}
+
+	/* Takes rt_wlock, recovering from a holder that died. Without wait,
+	 * returns EBUSY instead of blocking if it is held. begin_rt_write()
+	 * takes it before it starts the write; combining writers (see
+	 * AndroitShmemCombine.h) only start one if there is work left. */
+	template <typename T>
+	static inline int lock_rt_write(shared<T> *region, bool wait = true) {
+		struct region_stats *stats = region_stats_of(&region->header);
+		uint64_t start = 0;
+		int ret;
+		
+		// Only a contended lock is timed before it is taken
+		ret = pthread_mutex_trylock(&region->protect.rt_wlock);
+		if (ret == EBUSY && wait) {
+			start = stats_start(stats);
+			ret = pthread_mutex_lock(&region->protect.rt_wlock);
+		}
+		if (ret == EOWNERDEAD) {
+			recover_rt_write(region);
+			ret = 0;
+		}
+		if (ret)
+			return ret;
+
+		if (stats_timing(stats)) {
+			stats->rt_locked_ns = stats_now();
+			stats_record(stats, STAT_RT_LOCK_WAIT, start == 0 ? 0 : stats->rt_locked_ns - start);
+		} else if (stats != NULL && stats->rt_locked_ns != 0) {
+			// Timing was switched off, do not count a stale start in end_rt_write()
+			stats->rt_locked_ns = 0;
+		}
+
+		return 0;
+	}
+
+	// Releases rt_wlock taken by lock_rt_write() without writing
+	template <typename T>
+	static inline int unlock_rt_write(shared<T> *region) {
+		return pthread_mutex_unlock(&region->protect.rt_wlock);
+	}
+
+	// Starts an RT write, the caller holds rt_wlock
+	template <typename T>
+	static inline void start_rt_write(shared<T> *region) {
+		/* Set 2-bit (was unset before), denotes "RT-Write in progress". Only
+		 * rt_wlock holders and the CAS of nonrt_commit() change the
+		 * sequence: no ordering is needed but that of the modifications of
+		 * the data after it (the release fence, paired with the acquire
+		 * fence of seq_doretry()). */
+		add_relaxed(&region->protect.sequence, (seq_t)2);
+		fence_release();
+	}
+
+	template <typename T>
+	static inline int begin_rt_write(shared<T> *region) {
+		int ret = lock_rt_write(region);
+
+		if (ret)
+			return ret;
+
+		start_rt_write(region);
+		return 0;
+	}
+
+	template <typename T>
+	static inline int end_rt_write(shared<T> *region) {
+		/* Unset 2-bit by increasing the sequence counter by two,
+		 * denotes "_no_ RT-Write in progress and data was updated" */
+		struct region_stats *stats = region_stats_of(&region->header);
+		int ret;
+
+		stats_write_done(stats, STAT_RT_WRITES, STAT_RT_LOCK_HOLD, stats != NULL ? stats->rt_locked_ns : 0);
+
+		/* Readers increase waiters before they sleep on an unchanged
+		 * sequence: seq_wake() orders this update before its check */
+		add_full(&region->protect.sequence, (seq_t)2);
+		ret = pthread_mutex_unlock(&region->protect.rt_wlock);
+
+		seq_wake(&region->protect);
+
+		return ret;
+	}
+	
+	/* RT writers modify the active data copy in place and have to announce
+	 * every modification between begin_rt_write() and end_rt_write(), before
+	 * the modified data is written: addr/len lie inside the active copy.
+	 * Otherwise non-RT transactions miss the modification when they bring
+	 * the inactive copy up to date. */
+	template <typename T>
+	static inline void rt_mark_dirty(shared<T> *region, const void *addr, size_t len) {
+		seq_t sequence = region->protect.sequence;
+		const T *active = &region->data[sequence & 1];
+		size_t offset = (const char*)addr - (const char*)active, last;
+
+		if (len == 0)
+			return;
+
+		// Remember the previous generation of each block for recover_rt_write()
+		last = (offset + len - 1) / DIRTY_BLOCK;
+		for (size_t block = offset / DIRTY_BLOCK; block <= last && block < shared<T>::BLOCKS; block++) {
+			if (region->dirty_gen[block] != sequence) {
+				region->prev_gen[block] = region->dirty_gen[block];
+				compiler_barrier();
+				region->dirty_gen[block] = sequence;
+			}
+		}
+
+		/* The marks are stored before the modification they announce. Only
+		 * recover_rt_write() depends on this, after the writer died. */
+		compiler_barrier();
+	}
+
+	///////////////////////////////////////////////////////////////////
+	// Synchronisation for concurrent non-RT writers
+	template <typename T>
+	static inline int begin_nonrt_write(shared<T> *region) {
+		struct region_stats *stats = region_stats_of(&region->header);
+		uint64_t start = 0;
+		int ret = pthread_mutex_trylock(&region->protect.nonrt_wlock);
+
+		if (ret == EBUSY) {
+			start = stats_start(stats);
+			ret = pthread_mutex_lock(&region->protect.nonrt_wlock);
+		}
+
+		/* A non-RT writer that died never committed its transaction, and
+		 * the next one brings the inactive copy up to date anyway. */
+		if (ret == EOWNERDEAD) {
+			lock_recovered(&region->protect.nonrt_wlock);
+			ret = 0;
+		}
+
+		if (ret == 0 && stats_timing(stats)) {
+			stats->nonrt_locked_ns = stats_now();
+			stats_record(stats, STAT_NONRT_LOCK_WAIT, start == 0 ? 0 : stats->nonrt_locked_ns - start);
+		} else if (ret == 0 && stats != NULL && stats->nonrt_locked_ns != 0) {
+			stats->nonrt_locked_ns = 0;
+		}
+
+		return ret;
+	}
+
+	template <typename T>
+	static inline int end_nonrt_write(shared<T> *region) {
+		struct region_stats *stats = region_stats_of(&region->header);
+
+		stats_write_done(stats, STAT_NONRT_WRITES, STAT_NONRT_LOCK_HOLD, stats != NULL ? stats->nonrt_locked_ns : 0);
+
+		return pthread_mutex_unlock(&region->protect.nonrt_wlock);
+	}
+	
+	///////////////////////////////////////////////////////////////////
+	// "Synchronisation" for readers against RT writers
+	/* Default number of cpu_relax() iterations readers spin while an RT
+	 * write is in progress before they sleep in the kernel. RT writes are
+	 * short, so spinning usually wins; sleeping afterwards keeps waiting
+	 * readers from burning the CPUs the RT writers need. */
+	enum {
+		SEQ_SPIN_DEFAULT = 1000,
+		SEQ_SPIN_FOREVER = ~0U,
+		// Readers check for a dead RT writer after waiting this long
+		SEQ_RECOVER_MS = 100
+	};
+
+	/* Sleeps until sequence changes from the value sequence, at most timeout
+	 * (relative, NULL for no limit). Returns the result of futex_wait(). */
+	static inline int seq_wait(const struct protect *protect, seq_t sequence,
+				   const struct timespec *timeout = NULL) {
+		// Readers only see const regions, but registering as waiter is no modification of the data
+		struct protect *p = const_cast<struct protect*>(protect);
+		int ret;
+
+		add_full(&p->waiters, 1U);
+		// Returns immediately if sequence has changed in the meantime
+		ret = futex_wait(seq_futex(p), (unsigned int)sequence, timeout);
+		add_relaxed(&p->waiters, -1U);
+
+		return ret;
+	}
+
+	/* Called by readers an RT write keeps waiting for SEQ_RECOVER_MS: if the
+	 * writer died holding rt_wlock, recovers the region (see
+	 * recover_rt_write()). Returns true if it did. */
+	template <typename T>
+	static bool seq_try_recover(const shared<T> *region) {
+		// Like seq_wait(), the reader modifies the region only on behalf of the dead writer
+		shared<T> *r = const_cast<shared<T>*>(region);
+		int ret = pthread_mutex_trylock(&r->protect.rt_wlock);
+
+		if (ret == EOWNERDEAD) {
+			recover_rt_write(r);
+			pthread_mutex_unlock(&r->protect.rt_wlock);
+			return true;
+		}
+		if (ret == 0)
+			pthread_mutex_unlock(&r->protect.rt_wlock);
+
+		return false;
+	}
+
+	/* Wait for unfinished RT-Writes to finish, get sequence number. Spins
+	 * for spin iterations, then sleeps until end_rt_write() wakes it. */
+	template <typename T>
+	static inline seq_t seq_begin(const shared<T> *region, unsigned int spin = SEQ_SPIN_DEFAULT) {
+		static const struct timespec recover_timeout = { 0, SEQ_RECOVER_MS * 1000000L };
+		const struct region_stats *stats = region_stats_of(&region->header);
+		unsigned int spins = 0;
+		seq_t sequence;
+		
+		// Acquire: the data is read after the sequence
+		sequence = load_acquire(&region->protect.sequence);
+		
+		// Wait for 2-bit unset. This bit denotes "RT-Write in progress"
+		while (sequence & 2) {
+			if (spin > 0) {
+				if (spin != SEQ_SPIN_FOREVER)
+					spin--;
+				spins++;
+				cpu_relax();
+			} else {
+				stats_count(stats, STAT_READ_SLEEPS);
+				if (seq_wait(&region->protect, sequence, &recover_timeout) == -ETIMEDOUT &&
+				    load_relaxed(&region->protect.sequence) == sequence)
+					seq_try_recover(region);
+			}
+			sequence = load_acquire(&region->protect.sequence);
+		}
+
+		// Uncontended reads store nothing
+		if (spins != 0)
+			stats_count(stats, STAT_READ_SPINS, spins);
+			
+		return sequence;
+	}
+
+	// Compares current sequence counter with the one recorded by "start", returns true if not equal
+	template <typename T>
+	static inline bool seq_doretry(const shared<T> *region, const seq_t start) {
+		seq_t sequence;
+		bool inconsistent = false;
+
+		// The data was read before the sequence is read again
+		fence_acquire();
+		sequence = load_relaxed(&region->protect.sequence);
+
+		if (sequence != start) {
+			inconsistent = true;
+			stats_count(region_stats_of(&region->header), STAT_READ_RETRIES);
+		}
+
+        return inconsistent;
+	}
+
+	/* Copies len bytes at offset of the data into dst, consistently: retries
+	 * until no write interfered. Returns the sequence the copy is valid at.
+	 * offset + len must not exceed sizeof(T). */
+	template <typename T>
+	static inline seq_t seq_copy(const shared<T> *region, size_t offset, void *dst, size_t len,
+				     unsigned int spin = SEQ_SPIN_DEFAULT) {
+		seq_t start_seq;
+
+		do {
+			start_seq = seq_begin(region, spin);
+			memcpy(dst, (const char*)&region->data[start_seq & 1] + offset, len);
+		} while (seq_doretry(region, start_seq));
+
+		return start_seq;
+	}
+
+	///////////////////////////////////////////////////////////////////
+	// Transactions of non-RT writers (nonrt_wlock held)
+	struct transaction {
+		seq_t start_seq;        // Sequence the current attempt started at
+		seq_t resync;           // Inactive copy lacks blocks modified after this sequence
+		unsigned int copied;    // Blocks copied by the current attempt
+	};
+
+	// Starts a transaction
+	template <typename T>
+	static inline void nonrt_start(shared<T> *region, struct transaction *tx) {
+		tx->start_seq = region->protect.sequence;
+		tx->resync = region->protect.synced[1 - (tx->start_seq & 1)];
+		tx->copied = 0;
+	}
+
+	/* Starts a transaction attempt: waits for RT writes to finish and makes
+	 * the inactive data copy consistent to the active copy. Only blocks
+	 * modified since the inactive copy was last consistent are copied; for
+	 * a retry, these are just the blocks modified by the interfering RT
+	 * writes and by the failed attempt itself. Returns the inactive copy,
+	 * the caller applies its update there and announces it with
+	 * nonrt_mark_dirty(). */
+	template <typename T>
+	static inline T *nonrt_begin(shared<T> *region, struct transaction *tx) {
+		const char *active;
+		char *update;
+
+		tx->start_seq = seq_begin(region);
+		active = (const char*)&region->data[tx->start_seq & 1];
+		// The inactive data copy is updated. It is always outdated
+		update = (char*)&region->data[1 - (tx->start_seq & 1)];
+
+		tx->copied = 0;
+		for (size_t block = 0; block < shared<T>::BLOCKS; block++) {
+			size_t offset, len;
+
+			if (region->dirty_gen[block] <= tx->resync)
+				continue;
+
+			offset = block * DIRTY_BLOCK;
+			len = sizeof(T) - offset < DIRTY_BLOCK ? sizeof(T) - offset : (size_t)DIRTY_BLOCK;
+			memcpy(update + offset, active + offset, len);
+			tx->copied++;
+		}
+
+		/* Blocks RT writers modify from now on get a later generation than
+		 * start_seq and are copied by the next attempt, if there is one. */
+		tx->resync = tx->start_seq;
+
+		return (T*)update;
+	}
+
+	/* Non-RT writers announce every modification of the inactive copy
+	 * (addr/len lie inside the copy returned by nonrt_begin()). */
+	template <typename T>
+	static inline void nonrt_mark_dirty(shared<T> *region, const struct transaction *tx,
+					    const void *addr, size_t len) {
+		const T *update = &region->data[1 - (tx->start_seq & 1)];
+
+		// Generation of the commit, later than any attempt of this transaction
+		mark_dirty(region, (const char*)addr - (const char*)update, len, (tx->start_seq+4)^1);
+	}
+
+	/* Compares sequence counter value before write to inactive data copy to current value.
+	 * 		- if equal: data still consistent, make inactive data copy active (invert 1-bit) and 
+	 * 			increase sequence counter (by 4, because 2-bit denotes "RT-Write in progress").
+	 * 		- if unequal: an RT write interfered, the caller retries the update
+	 * This happens atomically (CAS, compare and swap). Returns true on success. */
+	template <typename T>
+	static inline bool nonrt_commit(shared<T> *region, const struct transaction *tx) {
+		if (!cas_full(&region->protect.sequence, tx->start_seq, (tx->start_seq+4)^1)) {
+			stats_count(region_stats_of(&region->header), STAT_NONRT_CAS_FAILS);
+			return false;
+		}
+		stats_count(region_stats_of(&region->header), STAT_NONRT_COMMITS);
+
+		// Wake readers waiting for an update
+		seq_wake(&region->protect);
+
+		/* The previously active copy is consistent up to start_seq, it only
+		 * lacks the blocks this transaction marked dirty. */
+		region->protect.synced[tx->start_seq & 1] = tx->start_seq;
+		return true;
+	}
+
+	/* Initialises the header of a region. The region is not published yet:
+	 * it fails check_header() until its owner set it up completely and
+	 * called publish_header(). */
+	static inline void init_header(struct region_header *header, enum sync_mode mode, unsigned int copies,
+				       size_t data_size, size_t region_size, uint32_t hash) {
+		store_relaxed(&header->magic, 0U);
+		header->layout_version = LAYOUT_VERSION;
+		header->data_size = data_size;
+		header->copy_align = ANDROIT_SHMEM_COPY_ALIGN;
+		header->region_size = region_size;
+		header->sync_mode = mode;
+		header->copies = copies;
+		header->layout_hash = hash;
+		header->stats_offset = 0;
+	}
+
+	/* Publishes a region whose header init_header() initialised, once the
+	 * rest of it is set up as well: clients that attach before see no
+	 * initialised region, clients that see the magic see all of it. */
+	static inline void publish_header(struct region_header *header) {
+		store_release(&header->magic, (uint32_t)REGION_MAGIC);
+	}
+
+	// Returns true if the region of header was published, its contents can be read from now on
+	static inline bool header_published(const struct region_header *header) {
+		return load_acquire(&header->magic) == (uint32_t)REGION_MAGIC;
+	}
+
+	// Checks a region header, see check_layout()
+	static inline int check_header(const struct region_header *header, size_t size, enum sync_mode mode,
+				       unsigned int copies, size_t data_size, size_t region_size, uint32_t hash) {
+		if (size < sizeof(struct region_header) || !header_published(header))
+			return -ENODEV;
+
+		if (header->layout_version != LAYOUT_VERSION ||
+		    header->copy_align != ANDROIT_SHMEM_COPY_ALIGN ||
+		    header->sync_mode != (uint32_t)mode || header->copies != copies)
+			return -EPROTO;
+
+		if (header->data_size != data_size || header->layout_hash != hash ||
+		    header->region_size != region_size || size < region_size)
+			return -EINVAL;
+
+		if (header->stats_offset != 0 && (header->stats_offset != stats_offset_for(region_size) ||
+						  size < header->stats_offset + sizeof(struct region_stats)))
+			return -EINVAL;
+
+		return 0;
+	}
+
+	// Initialises concurrency protections of a region
+	static inline int init_protect(struct protect *protect, int options = PROTECT_DEFAULT) {
+		int result;		
+		pthread_mutexattr_t attr;
+		
+		// Initialise sequence counter, both data copies are consistent
+		protect->sequence = 0;
+		protect->synced[0] = protect->synced[1] = 0;
+		protect->waiters = 0;
+		protect->dead_writers = 0;
+		protect->torn = 0;
+		
+		// Create attribute PTHREAD_PROCESS_SHARED
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#ifdef _POSIX_THREAD_PRIO_INHERIT
+        if (options & PROTECT_PI)
+            pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+#endif
+#ifdef ANDROIT_SHMEM_ROBUST
+        if (options & PROTECT_ROBUST)
+            pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+#endif
+        // Initialise _shared_ mutexes
+        result = pthread_mutex_init(&protect->rt_wlock, &attr);
+        result += pthread_mutex_init(&protect->nonrt_wlock, &attr);
+        // Destroy attribute
+        pthread_mutexattr_destroy(&attr);
+        
+		return result;
+	}
+
+	// Initialises sample values of the default region "map"
+	static inline void init_sample_data(struct data_struct *data) {
+		data->integer = 42;
+		data->fp = 23.42;
+		for (int j = 0; j < 1024; j++)
+			data->arbitrary[j] = 1024 - j;
+	}
+
+	/* Initialises concurrency protections in region (with the lock options
+	 * of init_protect()), and both data copies with init_data (or zeroes if
+	 * init_data is NULL). Regions shared with clients are published with
+	 * publish_header() afterwards. */
+	template <typename T>
+	static int init_shared(shared<T> *region, void (*init_data)(T *data) = NULL,
+			       int options = PROTECT_DEFAULT) {
+		for (int i = 0; i < 2; i++) {
+			memset(&region->data[i], 0, sizeof(T));
+			if (init_data != NULL)
+				init_data(&region->data[i]);
+		}
+		memset(region->dirty_gen, 0, sizeof(region->dirty_gen));
+		memset(region->prev_gen, 0, sizeof(region->prev_gen));
+
+		init_header(&region->header, SYNC_SEQLOCK, 2, sizeof(T), sizeof(shared<T>), layout_hash<T>::value);
+
+		return init_protect(&region->protect, options);
+	}
+
+	/* Checks that region (a mapping of size bytes) was initialised with the
+	 * same layout of shared<T> the caller was built with. Returns 0 if so,
+	 * -EPROTO if the layout version, alignment or synchronisation scheme
+	 * differ, -EINVAL if T differs in size or layout hash (see
+	 * AndroitShmemSchema.h) and -ENODEV if region was never initialised. */
+	template <typename T>
+	static inline int check_layout(const shared<T> *region, size_t size) {
+		return check_header(&region->header, size, SYNC_SEQLOCK, 2, sizeof(T), sizeof(shared<T>),
+				    layout_hash<T>::value);
+	}
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_H */
@@ -0,0 +1,458 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_APPLY_H
+#define ANDROIT_SHMEM_APPLY_H
+
+/* Apply queues (SYNC_APPLY): write batches of non-RT writers that gave up
+ * on their transaction, in a region of their own next to a shared<T>.
+ *
+ * A non-RT transaction is retried as a whole whenever an RT write lands
+ * between its start and its commit, so a steady rate of RT writes can
+ * starve it forever. nonrt_write_batch() with an apply queue tries
+ * APPLY_RETRIES times, then hands the batch to the queue and waits until
+ * it was applied. Batches are applied inside an RT write, under rt_wlock,
+ * where nothing can interfere: by the drain thread of AndroitShmemService
+ * (apply_commit(), one RT write for all pending batches) or by the next RT
+ * writer that finishes with end_rt_write(region, h, q), which applies at
+ * most APPLY_RT_MAX of them. Non-RT writers thus wait for one RT write at
+ * most, RT writers pay a bounded copy.
+ *
+ * The queue is a ring of slots like a channel (see AndroitShmemChannel.h):
+ * every slot carries a position sequence that equals the position a writer
+ * may fill it at, position + 1 once the batch is complete and position +
+ * capacity once it was applied. Writers reserve positions with a CAS on
+ * head; only rt_wlock holders advance tail. A delegating writer keeps
+ * nonrt_wlock until its batch is applied, updates of non-RT writers are
+ * applied in the order they were made.
+ *
+ * A writer waits APPLY_TIMEOUT_NS at most, e.g. if no drain thread runs.
+ * It then withdraws its batch and goes back to retrying its transaction.
+ * The state of a slot decides between the writer and the applier: both
+ * CAS it away from APPLY_PENDING, the applier before it copies the batch,
+ * and only the one that succeeds acts on it. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <AndroitShmem.h>
+#include <AndroitShmemBatch.h>
+#include <AndroitShmemFutex.h>
+#include <AndroitShmemHistory.h>
+#include <AndroitShmemWait.h>
+
+namespace androit {
+	enum {
+		APPLY_CAPACITY_MAX = 1 << 12,
+		APPLY_BATCH_MAX = 1 << 20,
+		// Failed commits of nonrt_write_batch() before it delegates
+		APPLY_RETRIES = 4,
+		// Batches end_rt_write(region, h, q) applies at most
+		APPLY_RT_MAX = 2,
+		// Time a delegating writer waits for its batch before it withdraws it
+		APPLY_TIMEOUT_NS = 100 * 1000 * 1000
+	};
+
+	// State of a complete batch
+	enum apply_state {
+		APPLY_PENDING = 0,   // Waiting, may be taken or withdrawn
+		APPLY_TAKEN = 1,     // Being applied by an rt_wlock holder
+		APPLY_WITHDRAWN = 2  // Given up by its writer, skipped
+	};
+
+	// Start of every slot, the batch follows
+	struct apply_slot {
+		unsigned int seq;    // Position sequence, see above
+		unsigned int used;   // Bytes of records of the batch
+		unsigned int state;  // enum apply_state
+	};
+
+	struct apply_queue {
+		struct region_header header;
+		uint32_t capacity;    // Number of slots, a power of 2
+		uint32_t batch_size;  // Largest batch
+		uint32_t slot_size;   // Distance of slots, whole cache lines
+		// Next position to fill, only written by delegating writers
+		alignas(CACHE_LINE) unsigned int head;
+		// Drain threads sleep on ready, writers increase it for every complete batch
+		alignas(CACHE_LINE) unsigned int ready;
+		unsigned int ready_waiters;
+		// Next position to apply, only written by rt_wlock holders; delegating writers sleep on it
+		alignas(CACHE_LINE) unsigned int tail;
+		unsigned int tail_waiters;
+		// capacity slots of slot_size bytes follow, starting at a cache line
+	};
+
+	static_assert(sizeof(struct apply_queue) % CACHE_LINE == 0, "slots must start at a cache line");
+
+	// Returns the distance of slots for batches of batch_size bytes
+	static inline size_t apply_slot_size(size_t batch_size) {
+		return (sizeof(struct apply_slot) + batch_size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+	}
+
+	// Returns the size of an apply queue region
+	static inline size_t apply_queue_size(unsigned int capacity, size_t batch_size) {
+		return sizeof(struct apply_queue) + capacity * apply_slot_size(batch_size);
+	}
+
+	// Returns the slot of position pos
+	static inline struct apply_slot *apply_slot_at(const struct apply_queue *q, unsigned int pos) {
+		return (struct apply_slot*)((char*)q + sizeof(struct apply_queue) +
+					    (size_t)(pos & (q->capacity - 1)) * q->slot_size);
+	}
+
+	///////////////////////////////////////////////////////////////////
+	// Delegating writers
+	/* Queues the used bytes of records at buf (validated by the caller) and
+	 * stores the position it got in *ticket, for apply_wait(). Returns 0,
+	 * -EAGAIN if the queue is full or -E2BIG. */
+	static inline int apply_enqueue(struct apply_queue *q, const void *buf, size_t used,
+					unsigned int *ticket) {
+		struct apply_slot *slot;
+		unsigned int pos;
+		int dif;
+
+		if (used > q->batch_size)
+			return -E2BIG;
+
+		pos = load_relaxed(&q->head);
+		for (;;) {
+			slot = apply_slot_at(q, pos);
+			dif = (int)(load_acquire(&slot->seq) - pos);
+
+			if (dif < 0)
+				return -EAGAIN;
+			if (dif == 0 && cas_acquire(&q->head, pos, pos + 1))
+				break;
+
+			// Another writer took pos
+			pos = load_relaxed(&q->head);
+		}
+
+		memcpy(slot + 1, buf, used);
+		slot->used = used;
+		slot->state = APPLY_PENDING;
+		store_release(&slot->seq, pos + 1);
+
+		/* Ordered before the check of ready_waiters: drain threads increase
+		 * it before they check for a complete batch, see apply_wait_ready() */
+		add_full(&q->ready, 1U);
+		fence_full();
+		if (load_relaxed(&q->ready_waiters) != 0)
+			futex_wake(&q->ready, INT_MAX);
+
+		*ticket = pos;
+		return 0;
+	}
+
+	// Returns true if the batch queued at position ticket was applied
+	static inline bool apply_done(const struct apply_queue *q, unsigned int ticket) {
+		return (int)(load_acquire(&q->tail) - ticket) > 0;
+	}
+
+	/* Blocks until the batch queued at position ticket was applied, at
+	 * most timeout (relative, NULL for no limit). Returns 0 or -ETIMEDOUT. */
+	static inline int apply_wait(struct apply_queue *q, unsigned int ticket,
+				     const struct timespec *timeout = NULL) {
+		struct timespec deadline, left;
+		unsigned int tail;
+
+		if (timeout != NULL)
+			deadline_after(&deadline, timeout);
+
+		while (!apply_done(q, ticket)) {
+			if (timeout != NULL && !time_left(&deadline, &left))
+				return -ETIMEDOUT;
+
+			add_full(&q->tail_waiters, 1U);
+			tail = load_acquire(&q->tail);
+			// Appliers check for waiters after advancing tail, see apply_pending()
+			if ((int)(tail - ticket) <= 0)
+				futex_wait(&q->tail, tail, timeout != NULL ? &left : NULL);
+			add_full(&q->tail_waiters, -1U);
+		}
+
+		return 0;
+	}
+
+	/* Withdraws the batch queued at position ticket, which was not applied
+	 * yet. Returns false if an rt_wlock holder already took it: it is
+	 * applied, wait for it with apply_wait(). */
+	static inline bool apply_withdraw(struct apply_queue *q, unsigned int ticket) {
+		return cas_full(&apply_slot_at(q, ticket)->state, (unsigned int)APPLY_PENDING,
+				(unsigned int)APPLY_WITHDRAWN);
+	}
+
+	// Returns true if a complete batch is waiting
+	static inline bool apply_readable(const struct apply_queue *q) {
+		unsigned int pos = load_acquire(&q->tail);
+
+		return load_acquire(&apply_slot_at(q, pos)->seq) == pos + 1;
+	}
+
+	///////////////////////////////////////////////////////////////////
+	// Appliers, between begin_rt_write() and end_rt_write()
+	/* Applies up to max complete batches of q to the active copy of region
+	 * and advances tail behind them, withdrawn ones are skipped. The caller
+	 * holds rt_wlock and has begun an RT write: writers that see their
+	 * batch applied read it after the commit, their seq_begin() waits for
+	 * it. Returns the number of batches taken off q. */
+	template <typename T>
+	static inline unsigned int apply_pending(shared<T> *region, struct apply_queue *q, unsigned int max) {
+		const struct batch_record *record;
+		const char *pos, *end;
+		struct apply_slot *slot;
+		char *active = (char*)&region->data[region->protect.sequence & 1];
+		unsigned int tail = q->tail, taken, applied = 0;
+		bool valid;
+
+		for (taken = 0; taken < max; taken++) {
+			slot = apply_slot_at(q, tail + taken);
+			if (load_acquire(&slot->seq) != tail + taken + 1)
+				break;
+
+			// Filled by other processes: checked again, a malformed batch is skipped
+			valid = slot->used <= q->batch_size && batch_validate(slot + 1, slot->used, sizeof(T)) >= 0;
+			if (valid && cas_acquire(&slot->state, (unsigned int)APPLY_PENDING, (unsigned int)APPLY_TAKEN)) {
+				end = (const char*)(slot + 1) + slot->used;
+				for (pos = (const char*)(slot + 1); (record = batch_next(&pos, end)) != NULL;) {
+					rt_mark_dirty(region, active + record->offset, record->len);
+					memcpy(active + record->offset, record + 1, record->len);
+				}
+				applied++;
+			}
+
+			// The batch is copied before the slot may be refilled
+			store_release(&slot->seq, tail + taken + q->capacity);
+		}
+
+		if (taken != 0) {
+			// Delegating writers increase tail_waiters before they check tail, see apply_wake()
+			add_full(&q->tail, taken);
+			stats_count(region_stats_of(&region->header), STAT_APPLIED, applied);
+		}
+
+		return taken;
+	}
+
+	/* Wakes the writers waiting for their batches, after the RT write that
+	 * applied them released rt_wlock: they do not contend for the CPU of
+	 * the RT writer while it holds the lock. */
+	static inline void apply_wake(struct apply_queue *q) {
+		// The advance of tail is ordered before the check of waiters, see seq_wake()
+		fence_full();
+		if (load_relaxed(&q->tail_waiters) != 0)
+			futex_wake(&q->tail, INT_MAX);
+	}
+
+	/* Finishes an RT write like end_rt_write(region, h), after applying up
+	 * to APPLY_RT_MAX batches q holds. Returns the result of end_rt_write(). */
+	template <typename T>
+	static inline int end_rt_write(shared<T> *region, struct history *h, struct apply_queue *q) {
+		unsigned int applied = apply_pending(region, q, APPLY_RT_MAX);
+		int ret = end_rt_write(region, h);
+
+		if (applied != 0)
+			apply_wake(q);
+		return ret;
+	}
+
+	/* Applies every batch q holds in a single RT write, recorded into
+	 * history h if it is not NULL. Used by the drain thread of the service.
+	 * Returns the number of batches applied or -errno. */
+	template <typename T>
+	static inline int apply_commit(shared<T> *region, struct apply_queue *q, struct history *h = NULL) {
+		unsigned int applied;
+		int ret;
+
+		// Nothing to do: do not bump the sequence, readers would retry in vain
+		if (!apply_readable(q))
+			return 0;
+
+		ret = begin_rt_write(region);
+		if (ret)
+			return -ret;
+
+		applied = apply_pending(region, q, q->capacity);
+		ret = end_rt_write(region, h);
+
+		if (applied != 0)
+			apply_wake(q);
+		return ret != 0 ? -ret : (int)applied;
+	}
+
+	/* Blocks until a complete batch is waiting, at most timeout (relative,
+	 * NULL for no limit). Returns 0 or -ETIMEDOUT. */
+	static inline int apply_wait_ready(struct apply_queue *q, const struct timespec *timeout = NULL) {
+		struct timespec deadline, left;
+		unsigned int ready;
+
+		if (timeout != NULL)
+			deadline_after(&deadline, timeout);
+
+		while (!apply_readable(q)) {
+			if (timeout != NULL && !time_left(&deadline, &left))
+				return -ETIMEDOUT;
+
+			add_full(&q->ready_waiters, 1U);
+			ready = load_acquire(&q->ready);
+			// Writers check for waiters after completing a slot, see apply_enqueue()
+			if (!apply_readable(q))
+				futex_wait(&q->ready, ready, timeout != NULL ? &left : NULL);
+			add_full(&q->ready_waiters, -1U);
+		}
+
+		return 0;
+	}
+
+	///////////////////////////////////////////////////////////////////
+	// Non-RT writers with a latency bound
+	/* Has the used bytes of records at buf applied to region through q
+	 * instead of committing a transaction, and waits until they are. The
+	 * caller holds nonrt_wlock, so later non-RT updates cannot overtake the
+	 * batch. If nobody applies it within APPLY_TIMEOUT_NS, the batch is
+	 * withdrawn. Returns 0, -EAGAIN if q is full, -E2BIG or -ETIMEDOUT if
+	 * the batch was withdrawn; callers then go back to retrying. */
+	template <typename T>
+	static inline int nonrt_delegate(shared<T> *region, struct apply_queue *q, const void *buf, size_t used) {
+		static const struct timespec timeout = { 0, APPLY_TIMEOUT_NS };
+		unsigned int ticket;
+		int ret = apply_enqueue(q, buf, used, &ticket);
+
+		if (ret != 0)
+			return ret;
+
+		stats_count(region_stats_of(&region->header), STAT_NONRT_DELEGATED);
+		if (apply_wait(q, ticket, &timeout) == 0)
+			return 0;
+
+		if (apply_withdraw(q, ticket))
+			return -ETIMEDOUT;
+
+		// Taken by an rt_wlock holder right now, the wait is short
+		return apply_wait(q, ticket);
+	}
+
+	/* Like nonrt_write_batch(region, buf, used, h), but gives up on the
+	 * transaction after retries failed commits and has the batch applied
+	 * through q instead (see above). Falls back to retrying if q is full,
+	 * and for the rest of the write if nobody applied the batch in time
+	 * (no drain thread runs).
+	 * Returns 0, -EINVAL for a malformed batch or the error of
+	 * begin_nonrt_write(). */
+	template <typename T>
+	static inline int nonrt_write_batch(shared<T> *region, const void *buf, size_t used,
+					    struct history *h, struct apply_queue *q,
+					    unsigned int retries = APPLY_RETRIES) {
+		const struct batch_record *record;
+		const char *pos, *end = (const char*)buf + used;
+		struct transaction tx;
+		unsigned int attempts = 0;
+		char *update;
+		int ret;
+
+		if (batch_validate(buf, used, sizeof(T)) < 0)
+			return -EINVAL;
+
+		ret = begin_nonrt_write(region);
+		if (ret)
+			return ret;
+
+		nonrt_start(region, &tx);
+		for (;;) {
+			update = (char*)nonrt_begin(region, &tx);
+			for (pos = (const char*)buf; (record = batch_next(&pos, end)) != NULL;) {
+				nonrt_mark_dirty(region, &tx, update + record->offset, record->len);
+				memcpy(update + record->offset, record + 1, record->len);
+			}
+			if (nonrt_commit(region, &tx, h))
+				break;
+
+			if (q != NULL && ++attempts >= retries) {
+				ret = nonrt_delegate(region, q, buf, used);
+				if (ret == 0)
+					break;
+				if (ret == -ETIMEDOUT)
+					q = NULL;
+			}
+		}
+
+		return end_nonrt_write(region);
+	}
+
+	template <typename T>
+	static inline int nonrt_write_batch(shared<T> *region, const struct write_batch *batch,
+					    struct history *h, struct apply_queue *q,
+					    unsigned int retries = APPLY_RETRIES) {
+		return nonrt_write_batch(region, batch->buf, batch->used, h, q, retries);
+	}
+
+	///////////////////////////////////////////////////////////////////
+	// Setup
+	static inline bool apply_queue_valid(unsigned int capacity, size_t batch_size) {
+		return capacity >= 2 && capacity <= APPLY_CAPACITY_MAX && (capacity & (capacity - 1)) == 0 &&
+		       batch_size >= batch_record_size(0) && batch_size <= APPLY_BATCH_MAX;
+	}
+
+	/* Initialises an apply queue region of apply_queue_size(capacity,
+	 * batch_size) bytes for the data of a region of data_size bytes with
+	 * layout hash. capacity must be a power of 2. Returns 0 or -EINVAL. */
+	static inline int init_apply_queue(struct apply_queue *q, unsigned int capacity, size_t batch_size,
+					   size_t data_size, uint32_t hash) {
+		if (!apply_queue_valid(capacity, batch_size))
+			return -EINVAL;
+
+		memset(q, 0, sizeof(struct apply_queue));
+		q->capacity = capacity;
+		q->batch_size = batch_size;
+		q->slot_size = apply_slot_size(batch_size);
+
+		for (unsigned int i = 0; i < capacity; i++) {
+			apply_slot_at(q, i)->seq = i;
+			apply_slot_at(q, i)->used = 0;
+		}
+
+		init_header(&q->header, SYNC_APPLY, 0, data_size, apply_queue_size(capacity, batch_size), hash);
+		return 0;
+	}
+
+	/* Checks that q (a mapping of size bytes) is an apply queue for the
+	 * data of a shared<T>, set up by a compatible version, see
+	 * check_layout(). */
+	template <typename T>
+	static inline int check_apply_queue(const struct apply_queue *q, size_t size) {
+		int ret;
+
+		// The fields the header is checked against are read once it was published
+		if (size < sizeof(struct apply_queue) || !header_published(&q->header))
+			return -ENODEV;
+
+		ret = check_header(&q->header, size, SYNC_APPLY, 0, sizeof(T),
+				   apply_queue_size(q->capacity, q->batch_size), layout_hash<T>::value);
+		if (ret != 0)
+			return ret;
+
+		if (!apply_queue_valid(q->capacity, q->batch_size) || q->slot_size != apply_slot_size(q->batch_size))
+			return -EINVAL;
+
+		return 0;
+	}
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_APPLY_H */
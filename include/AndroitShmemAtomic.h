@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_ATOMIC_H
+#define ANDROIT_SHMEM_ATOMIC_H
+
+/* Atomic operations on words of shared memory, with explicit memory
+ * ordering. Regions are plain structs mapped by several processes, so the
+ * __atomic built-ins are applied to ordinary members instead of wrapping
+ * them in std::atomic (which would change the layout guarantees Java and
+ * C clients rely on).
+ *
+ * The seqlock needs:
+ * 	- readers: an acquire load of the sequence before the data is read,
+ * 	  and an acquire fence after it, before the sequence is read again
+ * 	- writers: a release fence after the 2-bit is set, before the data
+ * 	  is modified, and a release increment once it is done
+ * Only the futex wakeup protocol (see seq_wait() and seq_wake()) needs full
+ * barriers: an update of a futex word followed by a check of its waiters
+ * counter takes an atomic update and fence_full(). A sequentially
+ * consistent read-modify-write alone does not order a later relaxed load
+ * on ARMv8 without LSE (ldaxr/stlxr, then ldr). */
+
+#include <stdint.h>
+
+namespace androit {
+	/* Sequence of a seqlock. 64 bits: a reader that is preempted while
+	 * 2^30 commits (of 4 steps each) happen would otherwise see the same
+	 * sequence again and take a torn read for consistent. */
+	typedef uint64_t seq_t;
+
+	template <typename V>
+	static inline V load_acquire(const V *addr) {
+		return __atomic_load_n(addr, __ATOMIC_ACQUIRE);
+	}
+
+	template <typename V>
+	static inline V load_relaxed(const V *addr) {
+		return __atomic_load_n(addr, __ATOMIC_RELAXED);
+	}
+
+	template <typename V>
+	static inline void store_release(V *addr, V val) {
+		__atomic_store_n(addr, val, __ATOMIC_RELEASE);
+	}
+
+	template <typename V>
+	static inline void store_relaxed(V *addr, V val) {
+		__atomic_store_n(addr, val, __ATOMIC_RELAXED);
+	}
+
+	// Adds val to *addr without ordering other accesses, returns the new value
+	template <typename V>
+	static inline V add_relaxed(V *addr, V val) {
+		return __atomic_add_fetch(addr, val, __ATOMIC_RELAXED);
+	}
+
+	// Adds val to *addr, earlier accesses become visible first, returns the new value
+	template <typename V>
+	static inline V add_release(V *addr, V val) {
+		return __atomic_add_fetch(addr, val, __ATOMIC_RELEASE);
+	}
+
+	// Xors val into *addr, earlier accesses become visible first, returns the old value
+	template <typename V>
+	static inline V xor_release(V *addr, V val) {
+		return __atomic_fetch_xor(addr, val, __ATOMIC_RELEASE);
+	}
+
+	// Xors val into *addr as a full barrier, returns the old value
+	template <typename V>
+	static inline V xor_full(V *addr, V val) {
+		return __atomic_fetch_xor(addr, val, __ATOMIC_SEQ_CST);
+	}
+
+	// Adds val to *addr as a full barrier, returns the new value
+	template <typename V>
+	static inline V add_full(V *addr, V val) {
+		return __atomic_add_fetch(addr, val, __ATOMIC_SEQ_CST);
+	}
+
+	// Replaces *addr by desired if it holds expected, later accesses are performed after it
+	template <typename V>
+	static inline bool cas_acquire(V *addr, V expected, V desired) {
+		return __atomic_compare_exchange_n(addr, &expected, desired, false, __ATOMIC_ACQUIRE,
+						   __ATOMIC_RELAXED);
+	}
+
+	// Replaces *addr by desired if it holds expected, as a full barrier if it does
+	template <typename V>
+	static inline bool cas_full(V *addr, V expected, V desired) {
+		return __atomic_compare_exchange_n(addr, &expected, desired, false, __ATOMIC_SEQ_CST,
+						   __ATOMIC_RELAXED);
+	}
+
+	// Later loads are not performed before earlier ones
+	static inline void fence_acquire() {
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	}
+
+	// Later stores become visible after earlier loads and stores
+	static inline void fence_release() {
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+	}
+
+	// Later loads and stores are performed after earlier ones
+	static inline void fence_full() {
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	}
+
+	// Keeps the compiler from reordering memory accesses, does not order the CPU
+	static inline void compiler_barrier() {
+		__atomic_signal_fence(__ATOMIC_SEQ_CST);
+	}
+
+	/* Hint to the CPU that the caller is busy waiting: frees resources for
+	 * the sibling hardware thread and saves power while spinning. */
+	static inline void cpu_relax() {
+#if defined(__i386__) || defined(__x86_64__)
+		__asm__ __volatile__("pause" ::: "memory");
+#elif defined(__aarch64__) || (defined(__arm__) && (__ARM_ARCH >= 7 || defined(__ARM_ARCH_6K__)))
+		__asm__ __volatile__("yield" ::: "memory");
+#else
+		compiler_barrier();
+#endif
+	}
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_ATOMIC_H */
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_ATTACH_H
+#define ANDROIT_SHMEM_ATTACH_H
+
+/* Attaching clients to regions. Asking the service (getRegionAs(), see
+ * AndroitShmemTransport.h) costs a ServiceManager lookup and a Binder
+ * transaction on Android, which RT processes should not depend on. They
+ * attach directly instead: the file backing the region is opened by name
+ * (/mnt/shm/<name> on Android, POSIX shared memory or hugetlbfs
+ * elsewhere, see backing_attach()) or a descriptor passed by the parent is
+ * mapped, then the layout is checked like getRegionAs() does. The service
+ * is only asked if the region has no file, i.e., the server keeps its
+ * regions anonymous (AndroitShmemServer -m).
+ *
+ * A restarted server creates new files for its regions (see
+ * RegionRegistry::create()), the mappings of its previous instance stay
+ * valid but are no longer served. attach_stale() notices this, and
+ * reattach_region() replaces the mapping. Callers must not use the
+ * previous mapping afterwards, so they reattach at points where no
+ * pointer into the region is held, e.g. at the start of a cycle. */
+
+#include <stddef.h>
+
+#include <AndroitShmem.h>
+#include <AndroitShmemLog.h>
+
+namespace androit {
+	// Options of attach_name() and attach_fd()
+	enum {
+		ATTACH_DIRECT = 1,    // Open the backing file of the region by name
+		ATTACH_SERVICE = 2,   // Ask the service (Transport) if there is no such file
+		ATTACH_LOCK = 4,      // Prefault the mapping and lock it into memory (RT processes)
+		ATTACH_DEFAULT = ATTACH_DIRECT | ATTACH_SERVICE
+	};
+
+	// A mapping of a region in this process
+	struct attachment {
+		void *base;       // NULL if not attached
+		size_t size;
+		int fd;           // Backing file, -1 if the mapping belongs to the transport
+		int flags;        // Options it was attached with
+	};
+
+	static inline void attachment_init(struct attachment *a) {
+		a->base = NULL;
+		a->size = 0;
+		a->fd = -1;
+		a->flags = 0;
+	}
+
+	/* Maps the region backed by fd (which the attachment takes over on
+	 * success). Returns 0 or -errno. */
+	int attach_fd(int fd, struct attachment *a, int flags = ATTACH_LOCK);
+
+	/* Maps region name: directly if flags has ATTACH_DIRECT and the region
+	 * has a backing file, through the service if ATTACH_SERVICE. Returns 0
+	 * or -errno. */
+	int attach_name(const char *name, struct attachment *a, int flags = ATTACH_DEFAULT);
+
+	/* Returns true if the region was removed or replaced by a restarted
+	 * server since it was attached. Always false for mappings of the
+	 * transport, which the process keeps for its lifetime. */
+	bool attach_stale(const struct attachment *a);
+
+	// Unmaps a direct attachment, mappings of the transport stay
+	void detach(struct attachment *a);
+
+	/* Attaches region name (see attach_name()) as Region and checks its
+	 * layout (see check_layout()). Returns the region, or NULL if it is not
+	 * available or has another layout. */
+	template <typename Region>
+	static inline Region *attach_region(const char *name, struct attachment *a, int flags = ATTACH_DEFAULT) {
+		int ret = attach_name(name, a, flags);
+
+		if (ret != 0) {
+			LOGE("Could not attach region %s: %d (%s)", name, -ret, strerror(-ret));
+			return NULL;
+		}
+
+		ret = check_layout((Region*)a->base, a->size);
+		if (ret != 0) {
+			LOGE("Layout of region %s does not match this client: %d (%s)", name, -ret, strerror(-ret));
+			detach(a);
+			return NULL;
+		}
+
+		return (Region*)a->base;
+	}
+
+	/* Returns region name attached in a, attaching it first if a is not
+	 * attached or the attachment is stale (flags as for attach_name()).
+	 * Returns NULL if the region is not available. */
+	template <typename Region>
+	static inline Region *reattach_region(const char *name, struct attachment *a, int flags = ATTACH_DEFAULT) {
+		if (a->base != NULL) {
+			if (!attach_stale(a))
+				return (Region*)a->base;
+
+			LOGD("Region %s was recreated by the server, reattaching", name);
+			detach(a);
+		}
+
+		return attach_region<Region>(name, a, flags);
+	}
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_ATTACH_H */
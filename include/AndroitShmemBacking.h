@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_BACKING_H
+#define ANDROIT_SHMEM_BACKING_H
+
+/* Backing memory of regions. Small regions live in 4 KB pages of a tmpfs
+ * file or memfd. Regions of several MB (process images) spend much of
+ * their accesses on TLB misses and first-touch page faults instead, so
+ * they can be backed by huge pages:
+ * 	- BACKING_THP:     transparent huge pages of the shmem file, used if
+ * 	                   /sys/kernel/mm/transparent_hugepage/shmem_enabled
+ * 	                   is advise (or always, within_size)
+ * 	- BACKING_HUGETLB: a hugetlbfs file or MFD_HUGETLB memfd, needs pages
+ * 	                   reserved in /proc/sys/vm/nr_hugepages
+ * Region sizes are rounded up to whole huge pages. Every page is faulted in
+ * when the region is mapped (prefault), by the server on creation and by
+ * clients on attach, so no RT access takes a first-touch fault. The pages
+ * can be bound to the NUMA node of the CPUs of the RT tasks. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+namespace androit {
+	enum backing_pages {
+		BACKING_DEFAULT = 0,   // Base pages
+		BACKING_THP = 1,       // Transparent huge pages
+		BACKING_HUGETLB = 2    // hugetlbfs pages
+	};
+
+	struct region_backing {
+		enum backing_pages pages;
+		bool prefault;          // Fault all pages in when mapping
+		int numa_node;          // Bind the pages to this node, -1: no binding
+	};
+
+	static inline struct region_backing default_backing(void) {
+		struct region_backing backing = { BACKING_DEFAULT, true, -1 };
+
+		return backing;
+	}
+
+	/* Opens (and creates if necessary) the file backing region name:
+	 * /mnt/shm on Android, else a memfd if anonymous, a hugetlbfs file for
+	 * BACKING_HUGETLB (ANDROIT_SHMEM_HUGETLBFS, default /dev/hugepages)
+	 * or POSIX shared memory. Returns the descriptor or -errno. */
+	int backing_open(const char *name, const struct region_backing *backing, bool anonymous);
+
+	/* Opens the existing file backing region name, as created by
+	 * backing_open() of a server that does not use anonymous regions.
+	 * Returns the descriptor or -errno (-ENOENT if there is none). */
+	int backing_attach(const char *name);
+
+	/* Removes the file backing region name, if any. Mappings of it stay
+	 * valid, but backing_open() creates a new file afterwards. Returns 0
+	 * or -errno. */
+	int backing_unlink(const char *name, const struct region_backing *backing);
+
+	// Returns the size of a mapping of size bytes with backing, in whole pages of it
+	size_t backing_size(size_t size, const struct region_backing *backing);
+
+	/* Sizes the file fd to size (from backing_size()) and maps it with
+	 * backing: huge pages, NUMA binding and prefaulting are applied before
+	 * the pages are locked. Returns the mapping or MAP_FAILED (errno set). */
+	void *backing_map(int fd, size_t size, const struct region_backing *backing);
+
+	/* Faults in all pages of the mapping [base, base + size), writable, so
+	 * later accesses take no page fault. Returns 0 or -errno. */
+	int backing_prefault(void *base, size_t size);
+
+	// Parses "4k", "thp" or "huge" into *pages, returns false for anything else
+	bool backing_parse_pages(const char *arg, enum backing_pages *pages);
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_BACKING_H */
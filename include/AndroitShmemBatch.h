@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_BATCH_H
+#define ANDROIT_SHMEM_BATCH_H
+
+/* Write batches: many updates of a region's data (fields or ranges of
+ * arrays) collected first and applied under a single writer lock and a
+ * single sequence bump, i.e., readers are invalidated once per batch
+ * instead of once per update.
+ *
+ * A batch is a buffer of records, each a batch_record followed by len
+ * bytes to store at offset of the data, padded to BATCH_ALIGN. The format
+ * is shared with java (com.androit.WriteBatch), which fills it in a direct
+ * buffer and commits it with a single JNI call. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <AndroitShmem.h>
+#include <AndroitShmemHistory.h>
+
+namespace androit {
+	enum {
+		BATCH_ALIGN = 8
+	};
+
+	struct batch_record {
+		uint32_t offset;  // Offset in the data
+		uint32_t len;     // Bytes following the record
+	};
+
+	struct write_batch {
+		char *buf;
+		size_t size;      // Capacity of buf
+		size_t used;      // Bytes of records in buf
+		unsigned int count;
+	};
+
+	// Returns the space a record of len bytes takes
+	static inline size_t batch_record_size(size_t len) {
+		return (sizeof(struct batch_record) + len + BATCH_ALIGN - 1) / BATCH_ALIGN * BATCH_ALIGN;
+	}
+
+	// Prepares an empty batch in buf of size bytes
+	static inline void batch_init(struct write_batch *batch, void *buf, size_t size) {
+		batch->buf = (char*)buf;
+		batch->size = size;
+		batch->used = 0;
+		batch->count = 0;
+	}
+
+	static inline void batch_clear(struct write_batch *batch) {
+		batch->used = 0;
+		batch->count = 0;
+	}
+
+	/* Adds storing len bytes of src at offset of the data. Returns 0 or
+	 * -ENOSPC if the batch is full. */
+	static inline int batch_add(struct write_batch *batch, size_t offset, const void *src, size_t len) {
+		struct batch_record *record;
+		size_t size = batch_record_size(len);
+
+		if (size > batch->size - batch->used)
+			return -ENOSPC;
+
+		record = (struct batch_record*)(batch->buf + batch->used);
+		record->offset = offset;
+		record->len = len;
+		memcpy(record + 1, src, len);
+
+		batch->used += size;
+		batch->count++;
+		return 0;
+	}
+
+	/* Checks that the used bytes of records at buf are well-formed and stay
+	 * inside data_size bytes of data. Returns the number of records or
+	 * -EINVAL. Batches from other processes (java) are checked before any
+	 * lock is taken. */
+	static inline int batch_validate(const void *buf, size_t used, size_t data_size) {
+		const char *pos = (const char*)buf, *end = pos + used;
+		int count = 0;
+
+		while (pos < end) {
+			const struct batch_record *record = (const struct batch_record*)pos;
+
+			if ((size_t)(end - pos) < sizeof(*record) ||
+			    batch_record_size(record->len) > (size_t)(end - pos) ||
+			    record->offset > data_size || record->len > data_size - record->offset)
+				return -EINVAL;
+
+			pos += batch_record_size(record->len);
+			count++;
+		}
+
+		return count;
+	}
+
+	// Returns the record at *pos and moves *pos behind it, NULL at end
+	static inline const struct batch_record *batch_next(const char **pos, const char *end) {
+		const struct batch_record *record = (const struct batch_record*)*pos;
+
+		if (*pos >= end)
+			return NULL;
+
+		*pos += batch_record_size(record->len);
+		return record;
+	}
+
+	/* Applies a batch as a single RT write: one lock, one sequence bump.
+	 * The result is recorded into history h, if it is not NULL. Returns 0,
+	 * -EINVAL for a malformed batch or the error of begin_rt_write(). */
+	template <typename T>
+	static inline int rt_write_batch(shared<T> *region, const void *buf, size_t used,
+					 struct history *h = NULL) {
+		const struct batch_record *record;
+		const char *pos, *end = (const char*)buf + used;
+		char *active;
+		int ret;
+
+		if (batch_validate(buf, used, sizeof(T)) < 0)
+			return -EINVAL;
+
+		ret = begin_rt_write(region);
+		if (ret)
+			return ret;
+
+		active = (char*)&region->data[region->protect.sequence & 1];
+		for (pos = (const char*)buf; (record = batch_next(&pos, end)) != NULL;) {
+			rt_mark_dirty(region, active + record->offset, record->len);
+			memcpy(active + record->offset, record + 1, record->len);
+		}
+
+		return end_rt_write(region, h);
+	}
+
+	template <typename T>
+	static inline int rt_write_batch(shared<T> *region, const struct write_batch *batch,
+					 struct history *h = NULL) {
+		return rt_write_batch(region, batch->buf, batch->used, h);
+	}
+
+	/* Applies a batch as a single non-RT transaction: one commit, one
+	 * sequence bump, retried as a whole if an RT write interferes. The
+	 * result is recorded into history h, if it is not NULL. Returns 0,
+	 * -EINVAL for a malformed batch or the error of begin_nonrt_write(). */
+	template <typename T>
+	static inline int nonrt_write_batch(shared<T> *region, const void *buf, size_t used,
+					    struct history *h = NULL) {
+		const struct batch_record *record;
+		const char *pos, *end = (const char*)buf + used;
+		struct transaction tx;
+		char *update;
+		int ret;
+
+		if (batch_validate(buf, used, sizeof(T)) < 0)
+			return -EINVAL;
+
+		ret = begin_nonrt_write(region);
+		if (ret)
+			return ret;
+
+		nonrt_start(region, &tx);
+		do {
+			update = (char*)nonrt_begin(region, &tx);
+			for (pos = (const char*)buf; (record = batch_next(&pos, end)) != NULL;) {
+				nonrt_mark_dirty(region, &tx, update + record->offset, record->len);
+				memcpy(update + record->offset, record + 1, record->len);
+			}
+		} while (!nonrt_commit(region, &tx, h));
+
+		return end_nonrt_write(region);
+	}
+
+	template <typename T>
+	static inline int nonrt_write_batch(shared<T> *region, const struct write_batch *batch,
+					    struct history *h = NULL) {
+		return nonrt_write_batch(region, batch->buf, batch->used, h);
+	}
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_BATCH_H */
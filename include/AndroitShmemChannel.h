@@ -0,0 +1,357 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_CHANNEL_H
+#define ANDROIT_SHMEM_CHANNEL_H
+
+/* Event channels (SYNC_CHANNEL): bounded queues of messages in a region of
+ * their own, for events that must not be lost between two reads of a
+ * region's latest value (alarm edges, commands, ...).
+ *
+ * A channel is a ring of capacity slots, each holding one message of up to
+ * msg_size bytes. Every slot carries a position sequence: it equals the
+ * position a producer may fill it at, position + 1 once the message is
+ * complete, and position + capacity once it was received (the bounded
+ * queue of D. Vyukov). Producers reserve positions by advancing head (with
+ * a CAS if several producers send concurrently, with a plain store for a
+ * single producer), consumers take any number of complete messages at
+ * once by advancing tail with a single CAS. Neither side takes a lock.
+ *
+ * When the ring is full, the overflow policy of the channel decides:
+ * 	- CHANNEL_FAIL:        channel_send() returns -EAGAIN
+ * 	- CHANNEL_BLOCK:       channel_send() sleeps until a slot is free
+ * 	- CHANNEL_DROP_OLDEST: channel_send() discards the oldest message, or
+ * 	  returns -EAGAIN if consumers keep its slot taken for too long
+ * Consumers sleep in channel_wait() until a message arrives. Producers and
+ * consumers only make system calls if the other side sleeps. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <AndroitShmem.h>
+#include <AndroitShmemFutex.h>
+#include <AndroitShmemWait.h>
+
+namespace androit {
+	enum channel_policy {
+		CHANNEL_FAIL = 0,
+		CHANNEL_BLOCK = 1,
+		CHANNEL_DROP_OLDEST = 2
+	};
+
+	enum {
+		CHANNEL_CAPACITY_MAX = 1 << 20,
+		CHANNEL_MSG_MAX = 1 << 16,
+		/* cpu_relax() iterations a CHANNEL_DROP_OLDEST producer waits for
+		 * a consumer that took the oldest messages but did not free their
+		 * slots yet (it may be preempted) */
+		CHANNEL_DROP_SPIN = 1000
+	};
+
+	// Start of every slot, the message follows
+	struct channel_slot {
+		unsigned int seq;  // Position sequence, see above
+		unsigned int len;  // Length of the message
+	};
+
+	struct channel {
+		struct region_header header;
+		uint32_t capacity;       // Number of slots, a power of 2
+		uint32_t msg_size;       // Largest message
+		uint32_t slot_size;      // Distance of slots, whole cache lines
+		uint32_t policy;         // enum channel_policy
+		uint32_t multi_producer; // Several producers send concurrently
+		// Next position to send to, only written by producers
+		alignas(CACHE_LINE) unsigned int head;
+		// Next position to receive from, written by consumers (and dropping producers)
+		alignas(CACHE_LINE) unsigned int tail;
+		// Consumers sleep on data_seq, producers increase it to wake them
+		alignas(CACHE_LINE) unsigned int data_seq;
+		unsigned int data_waiters;
+		// Blocked producers sleep on space_seq, consumers increase it to wake them
+		alignas(CACHE_LINE) unsigned int space_seq;
+		unsigned int space_waiters;
+		// Messages discarded by CHANNEL_DROP_OLDEST
+		alignas(CACHE_LINE) unsigned int dropped;
+		// capacity slots of slot_size bytes follow, starting at a cache line
+	};
+
+	static_assert(sizeof(struct channel) % CACHE_LINE == 0, "slots must start at a cache line");
+
+	// Returns the distance of slots for messages of msg_size bytes
+	static inline size_t channel_slot_size(size_t msg_size) {
+		return (sizeof(struct channel_slot) + msg_size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+	}
+
+	// Returns the size of a channel region
+	static inline size_t channel_size(unsigned int capacity, size_t msg_size) {
+		return sizeof(struct channel) + capacity * channel_slot_size(msg_size);
+	}
+
+	// Returns the slot of position pos
+	static inline struct channel_slot *channel_slot_at(const struct channel *ch, unsigned int pos) {
+		return (struct channel_slot*)((char*)ch + sizeof(struct channel) +
+					      (size_t)(pos & (ch->capacity - 1)) * ch->slot_size);
+	}
+
+	static inline char *channel_msg(struct channel_slot *slot) {
+		return (char*)(slot + 1);
+	}
+
+	// Increases *seq and wakes the sleepers on it, if there are any
+	static inline void channel_wake(unsigned int *seq, const unsigned int *waiters) {
+		// Orders the preceding release of a slot before the check, see seq_wake()
+		fence_full();
+		if (load_relaxed(waiters) != 0) {
+			add_full(seq, 1U);
+			futex_wake(seq, INT_MAX);
+		}
+	}
+
+	/* Sends len bytes of msg if a slot is free. Returns 0, -EAGAIN if the
+	 * channel is full or -EMSGSIZE. */
+	static inline int channel_try_send(struct channel *ch, const void *msg, size_t len) {
+		struct channel_slot *slot;
+		unsigned int pos;
+		int dif;
+
+		if (len > ch->msg_size)
+			return -EMSGSIZE;
+
+		pos = load_relaxed(&ch->head);
+		for (;;) {
+			slot = channel_slot_at(ch, pos);
+			// The consumer copied the previous message out before it freed the slot
+			dif = (int)(load_acquire(&slot->seq) - pos);
+
+			if (dif < 0)
+				return -EAGAIN;
+
+			if (dif == 0) {
+				if (!ch->multi_producer) {
+					store_relaxed(&ch->head, pos + 1);
+					break;
+				}
+				if (cas_acquire(&ch->head, pos, pos + 1))
+					break;
+			}
+
+			// Another producer took pos
+			pos = load_relaxed(&ch->head);
+		}
+
+		memcpy(channel_msg(slot), msg, len);
+		slot->len = len;
+		// The message is complete before the slot is
+		store_release(&slot->seq, pos + 1);
+
+		channel_wake(&ch->data_seq, &ch->data_waiters);
+		return 0;
+	}
+
+	/* Discards the oldest message, returns true if there was one. Used by
+	 * producers of CHANNEL_DROP_OLDEST channels. */
+	static inline bool channel_drop_oldest(struct channel *ch) {
+		unsigned int pos = load_relaxed(&ch->tail);
+		struct channel_slot *slot = channel_slot_at(ch, pos);
+
+		if (load_acquire(&slot->seq) != pos + 1 || !cas_acquire(&ch->tail, pos, pos + 1))
+			return false;
+
+		store_release(&slot->seq, pos + ch->capacity);
+		add_relaxed(&ch->dropped, 1U);
+
+		channel_wake(&ch->space_seq, &ch->space_waiters);
+		return true;
+	}
+
+	/* Sends len bytes of msg, applying the overflow policy of the channel if
+	 * it is full. CHANNEL_BLOCK waits at most timeout (relative, NULL for no
+	 * limit). Returns 0, -EAGAIN (full, CHANNEL_FAIL, or CHANNEL_DROP_OLDEST
+	 * after CHANNEL_DROP_SPIN iterations without a message to drop),
+	 * -ETIMEDOUT or -EMSGSIZE. */
+	static inline int channel_send(struct channel *ch, const void *msg, size_t len,
+				       const struct timespec *timeout = NULL) {
+		struct timespec deadline, left;
+		bool deadline_set = false;
+		unsigned int space_seq, pos, spin = 0;
+		int ret;
+
+		for (;;) {
+			ret = channel_try_send(ch, msg, len);
+			if (ret != -EAGAIN)
+				return ret;
+
+			switch (ch->policy) {
+			case CHANNEL_DROP_OLDEST:
+				/* Only drop if the ring is really full: a consumer may
+				 * be about to release the slot at head. */
+				pos = load_relaxed(&ch->head);
+				if (pos - load_relaxed(&ch->tail) < ch->capacity ||
+				    !channel_drop_oldest(ch)) {
+					// The producer does not wait for a preempted consumer
+					if (++spin >= CHANNEL_DROP_SPIN)
+						return -EAGAIN;
+					cpu_relax();
+				}
+				break;
+			case CHANNEL_BLOCK:
+				if (timeout != NULL && !deadline_set) {
+					deadline_after(&deadline, timeout);
+					deadline_set = true;
+				}
+				if (timeout != NULL && !time_left(&deadline, &left))
+					return -ETIMEDOUT;
+
+				add_full(&ch->space_waiters, 1U);
+				space_seq = load_acquire(&ch->space_seq);
+				// Sleep only if the slot at head is still taken, see channel_wake()
+				pos = load_relaxed(&ch->head);
+				if ((int)(load_acquire(&channel_slot_at(ch, pos)->seq) - pos) < 0)
+					futex_wait(&ch->space_seq, space_seq, timeout != NULL ? &left : NULL);
+				add_full(&ch->space_waiters, -1U);
+				break;
+			default:
+				return -EAGAIN;
+			}
+		}
+	}
+
+	/* Receives up to max messages at once without waiting. Message i is
+	 * copied to buf + i * msg_size, its length stored in lens[i]. Returns
+	 * the number of messages received. */
+	static inline unsigned int channel_receive(struct channel *ch, void *buf, unsigned int *lens,
+						   unsigned int max) {
+		struct channel_slot *slot;
+		unsigned int pos, count;
+
+		for (;;) {
+			pos = load_relaxed(&ch->tail);
+			for (count = 0; count < max && count < ch->capacity; count++) {
+				slot = channel_slot_at(ch, pos + count);
+				if (load_acquire(&slot->seq) != pos + count + 1)
+					break;
+			}
+
+			if (count == 0)
+				return 0;
+
+			// Take all complete messages with one CAS, fails only if a producer dropped the oldest
+			if (cas_acquire(&ch->tail, pos, pos + count))
+				break;
+		}
+
+		for (unsigned int i = 0; i < count; i++) {
+			slot = channel_slot_at(ch, pos + i);
+			lens[i] = slot->len;
+			memcpy((char*)buf + (size_t)i * ch->msg_size, channel_msg(slot), slot->len);
+		}
+
+		// The messages are copied before their slots are free
+		fence_release();
+		for (unsigned int i = 0; i < count; i++)
+			store_relaxed(&channel_slot_at(ch, pos + i)->seq, pos + i + ch->capacity);
+
+		channel_wake(&ch->space_seq, &ch->space_waiters);
+		return count;
+	}
+
+	// Returns true if a complete message is waiting
+	static inline bool channel_readable(const struct channel *ch) {
+		unsigned int pos = load_acquire(&ch->tail);
+
+		return load_acquire(&channel_slot_at(ch, pos)->seq) == pos + 1;
+	}
+
+	/* Blocks until a message is waiting, at most timeout (relative, NULL
+	 * for no limit). Returns 0 or -ETIMEDOUT. */
+	static inline int channel_wait(struct channel *ch, const struct timespec *timeout = NULL) {
+		struct timespec deadline, left;
+		unsigned int data_seq;
+
+		if (timeout != NULL)
+			deadline_after(&deadline, timeout);
+
+		while (!channel_readable(ch)) {
+			if (timeout != NULL && !time_left(&deadline, &left))
+				return -ETIMEDOUT;
+
+			add_full(&ch->data_waiters, 1U);
+			data_seq = load_acquire(&ch->data_seq);
+			// Producers check for waiters after completing a slot, see channel_wake()
+			if (!channel_readable(ch))
+				futex_wait(&ch->data_seq, data_seq, timeout != NULL ? &left : NULL);
+			add_full(&ch->data_waiters, -1U);
+		}
+
+		return 0;
+	}
+
+	// Returns true if a channel can be set up with these parameters
+	static inline bool channel_valid(unsigned int capacity, size_t msg_size, enum channel_policy policy) {
+		return capacity >= 2 && capacity <= CHANNEL_CAPACITY_MAX && (capacity & (capacity - 1)) == 0 &&
+		       msg_size > 0 && msg_size <= CHANNEL_MSG_MAX && policy <= CHANNEL_DROP_OLDEST;
+	}
+
+	/* Initialises a channel region of channel_size(capacity, msg_size)
+	 * bytes. capacity must be a power of 2. Returns 0 or -EINVAL. */
+	static inline int init_channel(struct channel *ch, unsigned int capacity, size_t msg_size,
+				       enum channel_policy policy, bool multi_producer) {
+		if (!channel_valid(capacity, msg_size, policy))
+			return -EINVAL;
+
+		memset(ch, 0, sizeof(struct channel));
+		ch->capacity = capacity;
+		ch->msg_size = msg_size;
+		ch->slot_size = channel_slot_size(msg_size);
+		ch->policy = policy;
+		ch->multi_producer = multi_producer;
+
+		for (unsigned int i = 0; i < capacity; i++) {
+			channel_slot_at(ch, i)->seq = i;
+			channel_slot_at(ch, i)->len = 0;
+		}
+
+		init_header(&ch->header, SYNC_CHANNEL, 0, msg_size, channel_size(capacity, msg_size), 0);
+		return 0;
+	}
+
+	/* Checks that ch (a mapping of size bytes) is a channel set up by a
+	 * compatible version, see check_layout(). */
+	static inline int check_channel(const struct channel *ch, size_t size) {
+		int ret;
+
+		// The fields the header is checked against are read once it was published
+		if (size < sizeof(struct channel) || !header_published(&ch->header))
+			return -ENODEV;
+
+		ret = check_header(&ch->header, size, SYNC_CHANNEL, 0, ch->msg_size,
+				   channel_size(ch->capacity, ch->msg_size), 0);
+		if (ret != 0)
+			return ret;
+
+		if (ch->capacity == 0 || (ch->capacity & (ch->capacity - 1)) != 0 ||
+		    ch->slot_size != channel_slot_size(ch->msg_size))
+			return -EINVAL;
+
+		return 0;
+	}
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_CHANNEL_H */
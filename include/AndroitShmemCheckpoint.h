@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_CHECKPOINT_H
+#define ANDROIT_SHMEM_CHECKPOINT_H
+
+/* Checkpoints of the data of regions, so that a restarted server publishes
+ * the last process image instead of initial values (warm restart).
+ *
+ * A snapshot of the data is copied out like readers do (seq_copy() and its
+ * counterparts), writers never wait for it. The file is written afterwards
+ * by the thread taking the checkpoint: a checkpoint_file header followed
+ * by the data, written to <name>.ckpt.tmp, synced and renamed to
+ * <name>.ckpt, so a crash leaves the previous checkpoint intact. The
+ * header carries the size and layout hash of T (see AndroitShmemSchema.h)
+ * and a CRC-32 of the data; files that do not match the region or fail the
+ * check are not restored. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <AndroitShmem.h>
+#include <AndroitShmemLeftRight.h>
+#include <AndroitShmemNBuf.h>
+#include <AndroitShmemPaged.h>
+#include <AndroitShmemStriped.h>
+
+namespace androit {
+	enum {
+		// Identifies a checkpoint file ("ASCP")
+		CHECKPOINT_MAGIC = 0x50435341,
+		CHECKPOINT_VERSION = 2
+	};
+
+	struct checkpoint_file {
+		uint32_t magic;
+		uint32_t version;        // CHECKPOINT_VERSION
+		uint64_t data_size;      // sizeof(T)
+		uint32_t layout_hash;    // layout_hash<T>
+		uint32_t crc;            // CRC-32 of the data
+		uint64_t sequence;       // Sequence (or epoch) the snapshot is consistent at
+		uint64_t time_ns;        // CLOCK_REALTIME of the snapshot
+	};
+
+	/* Copies the data of region to dst (sizeof(T) bytes) consistently, like
+	 * a reader. Returns the sequence the copy is valid at. */
+	template <typename T>
+	static inline seq_t region_snapshot(const shared<T> *region, void *dst) {
+		return seq_copy(region, 0, dst, sizeof(T));
+	}
+
+	template <typename T>
+	static inline seq_t region_snapshot(const lr_shared<T> *region, void *dst) {
+		seq_t seq = load_acquire(&region->protect.sequence);
+		unsigned int indicator;
+
+		memcpy(dst, lr_read_begin(region, &indicator), sizeof(T));
+		lr_read_end(region, indicator);
+
+		return seq;
+	}
+
+	template <typename T, unsigned int N>
+	static inline seq_t region_snapshot(const nbuf_shared<T, N> *region, void *dst) {
+		unsigned int slot;
+		seq_t seq;
+		const T *data = nbuf_read_begin(region, &slot, &seq);
+
+		memcpy(dst, data, sizeof(T));
+		nbuf_read_end(region, slot);
+
+		return seq;
+	}
+
+	template <typename T, unsigned int S>
+	static inline seq_t region_snapshot(const striped_shared<T, S> *region, void *dst) {
+		seq_t epoch;
+
+		do {
+			epoch = striped_epoch_begin(region);
+			memcpy(dst, (const T*)&region->data, sizeof(T));
+		} while (striped_epoch_doretry(region, epoch));
+
+		return epoch;
+	}
+
+	template <typename T>
+	static inline seq_t region_snapshot(const paged_shared<T> *region, void *dst) {
+		return paged_copy(region, 0, dst, sizeof(T));
+	}
+
+	/* Replaces the data of a region that was just initialised (and is not
+	 * published yet) with src */
+	template <typename T>
+	static inline void region_restore(shared<T> *region, const void *src) {
+		memcpy((T*)&region->data[0], src, sizeof(T));
+		memcpy((T*)&region->data[1], src, sizeof(T));
+	}
+
+	template <typename T>
+	static inline void region_restore(lr_shared<T> *region, const void *src) {
+		memcpy((T*)&region->data[0], src, sizeof(T));
+		memcpy((T*)&region->data[1], src, sizeof(T));
+	}
+
+	template <typename T, unsigned int N>
+	static inline void region_restore(nbuf_shared<T, N> *region, const void *src) {
+		for (unsigned int i = 0; i < N; i++)
+			memcpy((T*)&region->slots[i], src, sizeof(T));
+	}
+
+	template <typename T, unsigned int S>
+	static inline void region_restore(striped_shared<T, S> *region, const void *src) {
+		memcpy((T*)&region->data, src, sizeof(T));
+	}
+
+	// Both maps of an initialised region refer to bank 0, which holds T in order
+	template <typename T>
+	static inline void region_restore(paged_shared<T> *region, const void *src) {
+		memcpy(region->frames[0], src, sizeof(T));
+	}
+
+	// Returns the CRC-32 (IEEE 802.3) of len bytes at data
+	uint32_t checkpoint_crc(const void *data, size_t len);
+
+	/* Writes a checkpoint of the snapshot data (header filled in but for
+	 * magic, version and crc) to dir/name.ckpt. Returns 0 or -errno. */
+	int checkpoint_write(const char *dir, const char *name, struct checkpoint_file *header, const void *data);
+
+	/* Reads checkpoint dir/name.ckpt into data if it holds data_size bytes
+	 * of layout hash and passes the CRC check. Stores its header in
+	 * *header. Returns 0, -ENOENT if there is no checkpoint, -EINVAL if it
+	 * does not match and -EIO if it is corrupt. */
+	int checkpoint_read(const char *dir, const char *name, size_t data_size, uint32_t hash,
+			    struct checkpoint_file *header, void *data);
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_CHECKPOINT_H */
@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_COMBINE_H
+#define ANDROIT_SHMEM_COMBINE_H
+
+/* Combining RT writes (SYNC_COMBINE): a region of per-thread slots next to
+ * a shared<T>, through which RT writers that write at high rates share
+ * their RT writes (flat combining).
+ *
+ * Every RT writer on its own takes rt_wlock, bumps the sequence twice and
+ * hands the lock to the next one: under contention, lock transfers and the
+ * cache line of the sequence dominate, and readers retry once per write.
+ * A combining writer registers a slot once (combine_register()) and then
+ * publishes every update as a write batch into it (rt_write_combined()).
+ * Whichever writer gets rt_wlock applies the pending batches of all slots
+ * in a single RT write; the others spin until theirs is applied and only
+ * take the lock themselves if nobody combines, or after COMBINE_SPIN
+ * iterations (blocking on the lock, with priority inheritance).
+ *
+ * Every slot carries three counters: request, increased by its owner when
+ * it publishes a batch, taken, set to request by the combiner (with a CAS)
+ * before it applies the batch, and done, set to request once the batch is
+ * applied. The owner only writes the batch while request and done are
+ * equal, the combiner only reads it while they differ and it took it. An
+ * owner that cannot take rt_wlock withdraws its batch by taking it itself
+ * (see combine_withdraw()). Combining and plain RT writers can write the
+ * same region, they serialise on rt_wlock. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <AndroitShmem.h>
+#include <AndroitShmemBatch.h>
+#include <AndroitShmemHistory.h>
+
+namespace androit {
+	enum {
+		COMBINE_SLOTS_MAX = 256,
+		COMBINE_BATCH_MAX = 1 << 16,
+		// cpu_relax() iterations a writer waits for a combiner before it blocks on rt_wlock
+		COMBINE_SPIN = 100
+	};
+
+	// Start of every slot, the batch follows
+	struct combine_slot {
+		unsigned int owner;    // Thread id of the writer the slot is registered to, 0: free
+		unsigned int request;  // Batches published by the owner
+		unsigned int taken;    // Batches taken by combiners or withdrawn by the owner
+		unsigned int done;     // Batches applied or withdrawn, request == done: none is pending
+		unsigned int used;     // Bytes of records of the pending batch
+	};
+
+	struct combiner {
+		struct region_header header;
+		uint32_t capacity;     // Number of slots
+		uint32_t batch_size;   // Largest batch
+		uint32_t slot_size;    // Distance of slots, whole cache lines
+		// Set while an rt_wlock holder applies the slots, waiting writers do not try the lock then
+		alignas(CACHE_LINE) unsigned int combining;
+		// capacity slots of slot_size bytes follow, starting at a cache line
+	};
+
+	static_assert(sizeof(struct combiner) % CACHE_LINE == 0, "slots must start at a cache line");
+
+	// Returns the distance of slots for batches of batch_size bytes
+	static inline size_t combine_slot_size(size_t batch_size) {
+		return (sizeof(struct combine_slot) + batch_size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+	}
+
+	// Returns the size of a combiner region
+	static inline size_t combiner_size(unsigned int capacity, size_t batch_size) {
+		return sizeof(struct combiner) + capacity * combine_slot_size(batch_size);
+	}
+
+	static inline struct combine_slot *combine_slot_at(const struct combiner *c, unsigned int index) {
+		return (struct combine_slot*)((char*)c + sizeof(struct combiner) + (size_t)index * c->slot_size);
+	}
+
+	/* Registers a slot for the calling thread. Returns its index or -ENOSPC
+	 * if all slots are taken. Slots of threads that died stay taken. */
+	static inline int combine_register(struct combiner *c) {
+		unsigned int tid = (unsigned int)syscall(SYS_gettid);
+
+		for (unsigned int index = 0; index < c->capacity; index++)
+			if (cas_full(&combine_slot_at(c, index)->owner, 0U, tid))
+				return index;
+
+		return -ENOSPC;
+	}
+
+	// Frees slot index, no batch of it may be pending
+	static inline void combine_unregister(struct combiner *c, unsigned int index) {
+		store_release(&combine_slot_at(c, index)->owner, 0U);
+	}
+
+	/* Applies the pending batches of all slots to the active copy of region.
+	 * The caller holds rt_wlock and has begun an RT write. Returns the
+	 * number of batches applied. */
+	template <typename T>
+	static inline unsigned int combine_pending(shared<T> *region, struct combiner *c) {
+		const struct batch_record *record;
+		const char *pos, *end;
+		struct combine_slot *slot;
+		char *active = (char*)&region->data[region->protect.sequence & 1];
+		unsigned int request, applied = 0;
+
+		for (unsigned int index = 0; index < c->capacity; index++) {
+			slot = combine_slot_at(c, index);
+			request = load_acquire(&slot->request);
+			if (request == slot->done)
+				continue;
+
+			// Withdrawn by its owner, see combine_withdraw()
+			if (!cas_full(&slot->taken, request - 1, request))
+				continue;
+
+			// Filled by other processes: checked again, a malformed batch is skipped
+			if (slot->used <= c->batch_size && batch_validate(slot + 1, slot->used, sizeof(T)) >= 0) {
+				end = (const char*)(slot + 1) + slot->used;
+				for (pos = (const char*)(slot + 1); (record = batch_next(&pos, end)) != NULL;) {
+					rt_mark_dirty(region, active + record->offset, record->len);
+					memcpy(active + record->offset, record + 1, record->len);
+				}
+			}
+
+			/* The batch is copied before its owner may reuse the slot. It
+			 * returns before the commit, but its reads wait for it in
+			 * seq_begin(). */
+			store_release(&slot->done, request);
+			applied++;
+		}
+
+		stats_count(region_stats_of(&region->header), STAT_RT_COMBINED, applied);
+		return applied;
+	}
+
+	/* Withdraws batch request published in slot, which was not applied yet.
+	 * Returns false if a combiner already took it: it is being applied. */
+	static inline bool combine_withdraw(struct combine_slot *slot, unsigned int request) {
+		if (!cas_full(&slot->taken, request - 1, request))
+			return false;
+
+		store_release(&slot->done, request);
+		return true;
+	}
+
+	/* Applies the used bytes of records at buf as an RT write, combined with
+	 * the RT writes of the other slots of c. index is the slot of the
+	 * calling thread (see combine_register()). The result is recorded into
+	 * history h, if it is not NULL and this thread combines. Returns 0,
+	 * -EINVAL for a malformed batch or -errno of taking or releasing
+	 * rt_wlock. If rt_wlock cannot be taken, the batch is withdrawn: it is
+	 * not applied later by another combiner. */
+	template <typename T>
+	static inline int rt_write_combined(shared<T> *region, struct combiner *c, unsigned int index,
+					    const void *buf, size_t used, struct history *h = NULL) {
+		struct combine_slot *slot = combine_slot_at(c, index);
+		unsigned int request, spin;
+		int ret = EBUSY;
+
+		if (used > c->batch_size || batch_validate(buf, used, sizeof(T)) < 0)
+			return -EINVAL;
+
+		memcpy(slot + 1, buf, used);
+		slot->used = used;
+		request = slot->request + 1;
+		store_release(&slot->request, request);
+
+		for (spin = 0; ret == EBUSY; spin++) {
+			if (load_acquire(&slot->done) == request)
+				return 0;
+
+			// Only try the lock if nobody combines: a failed try still takes its cache line
+			if (spin >= COMBINE_SPIN)
+				ret = lock_rt_write(region);
+			else if (load_relaxed(&c->combining) == 0)
+				ret = lock_rt_write(region, false);
+
+			if (ret == EBUSY)
+				cpu_relax();
+		}
+		if (ret) {
+			if (combine_withdraw(slot, request))
+				return -ret;
+
+			// Taken by an rt_wlock holder right now, the wait is short
+			while (load_acquire(&slot->done) != request)
+				cpu_relax();
+			return 0;
+		}
+
+		// The previous holder may have applied it
+		if (load_acquire(&slot->done) == request)
+			return -unlock_rt_write(region);
+
+		start_rt_write(region);
+		store_relaxed(&c->combining, 1U);
+		combine_pending(region, c);
+		store_relaxed(&c->combining, 0U);
+
+		return -end_rt_write(region, h);
+	}
+
+	template <typename T>
+	static inline int rt_write_combined(shared<T> *region, struct combiner *c, unsigned int index,
+					    const struct write_batch *batch, struct history *h = NULL) {
+		return rt_write_combined(region, c, index, batch->buf, batch->used, h);
+	}
+
+	///////////////////////////////////////////////////////////////////
+	// Setup
+	static inline bool combiner_valid(unsigned int capacity, size_t batch_size) {
+		return capacity >= 1 && capacity <= COMBINE_SLOTS_MAX &&
+		       batch_size >= batch_record_size(0) && batch_size <= COMBINE_BATCH_MAX;
+	}
+
+	/* Initialises a combiner region of combiner_size(capacity, batch_size)
+	 * bytes for the data of a region of data_size bytes with layout hash.
+	 * Returns 0 or -EINVAL. */
+	static inline int init_combiner(struct combiner *c, unsigned int capacity, size_t batch_size,
+					size_t data_size, uint32_t hash) {
+		if (!combiner_valid(capacity, batch_size))
+			return -EINVAL;
+
+		memset(c, 0, combiner_size(capacity, batch_size));
+		c->capacity = capacity;
+		c->batch_size = batch_size;
+		c->slot_size = combine_slot_size(batch_size);
+
+		init_header(&c->header, SYNC_COMBINE, 0, data_size, combiner_size(capacity, batch_size), hash);
+		return 0;
+	}
+
+	/* Checks that c (a mapping of size bytes) is a combiner for the data of
+	 * a shared<T>, set up by a compatible version, see check_layout(). */
+	template <typename T>
+	static inline int check_combiner(const struct combiner *c, size_t size) {
+		int ret;
+
+		// The fields the header is checked against are read once it was published
+		if (size < sizeof(struct combiner) || !header_published(&c->header))
+			return -ENODEV;
+
+		ret = check_header(&c->header, size, SYNC_COMBINE, 0, sizeof(T),
+				   combiner_size(c->capacity, c->batch_size), layout_hash<T>::value);
+		if (ret != 0)
+			return ret;
+
+		if (!combiner_valid(c->capacity, c->batch_size) || c->slot_size != combine_slot_size(c->batch_size))
+			return -EINVAL;
+
+		return 0;
+	}
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_COMBINE_H */
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_DATA_H
+#define ANDROIT_SHMEM_DATA_H
+
+// Generated by tools/shmemgen.py from schema/data_struct.schema, do not edit.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <AndroitShmemSchema.h>
+
+namespace androit {
+	// Data of the default region "map"
+	struct data_struct {
+		int32_t integer;
+		float fp;
+		int64_t arbitrary[1024];
+	};
+
+	// Layout of data_struct as laid down in the schema
+	struct data_struct_layout {
+		static constexpr size_t integer = 0;
+		static constexpr size_t fp = 4;
+		static constexpr size_t arbitrary = 8;
+		static constexpr size_t arbitrary_length = 1024;
+		static constexpr size_t size = 8200;
+		static constexpr uint32_t hash = 0xd8aaff74U;
+	};
+
+	static_assert(offsetof(struct data_struct, integer) == data_struct_layout::integer,
+		      "layout of data_struct differs from its schema");
+	static_assert(offsetof(struct data_struct, fp) == data_struct_layout::fp,
+		      "layout of data_struct differs from its schema");
+	static_assert(offsetof(struct data_struct, arbitrary) == data_struct_layout::arbitrary,
+		      "layout of data_struct differs from its schema");
+	static_assert(sizeof(struct data_struct) == data_struct_layout::size,
+		      "layout of data_struct differs from its schema");
+
+	template <>
+	struct layout_hash<data_struct> {
+		static const uint32_t value = data_struct_layout::hash;
+	};
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_DATA_H */
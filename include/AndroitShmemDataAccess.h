@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_DATA_ACCESS_H
+#define ANDROIT_SHMEM_DATA_ACCESS_H
+
+// Generated by tools/shmemgen.py from schema/data_struct.schema, do not edit.
+
+/* Accessors of the fields of regions holding the data structs of the
+ * schema: reads are consistent (see seq_copy()), writes are added to a
+ * write batch (see AndroitShmemBatch.h). */
+
+#include <errno.h>
+
+#include <AndroitShmem.h>
+#include <AndroitShmemBatch.h>
+
+namespace androit {
+	static inline int32_t data_struct_integer_read(const shared<data_struct> *region,
+						       unsigned int spin = SEQ_SPIN_DEFAULT) {
+		int32_t value;
+
+		seq_copy(region, data_struct_layout::integer, &value, sizeof(value), spin);
+		return value;
+	}
+
+	static inline int data_struct_integer_write(struct write_batch *batch, int32_t value) {
+		return batch_add(batch, data_struct_layout::integer, &value, sizeof(value));
+	}
+
+	static inline float data_struct_fp_read(const shared<data_struct> *region,
+						unsigned int spin = SEQ_SPIN_DEFAULT) {
+		float value;
+
+		seq_copy(region, data_struct_layout::fp, &value, sizeof(value), spin);
+		return value;
+	}
+
+	static inline int data_struct_fp_write(struct write_batch *batch, float value) {
+		return batch_add(batch, data_struct_layout::fp, &value, sizeof(value));
+	}
+
+	/* Copies count elements from first on to dst, returns the sequence
+	 * the copy is valid at or -EINVAL. */
+	static inline int64_t data_struct_arbitrary_read(const shared<data_struct> *region, size_t first, size_t count,
+							 int64_t *dst, unsigned int spin = SEQ_SPIN_DEFAULT) {
+		if (first > data_struct_layout::arbitrary_length || count > data_struct_layout::arbitrary_length - first)
+			return -EINVAL;
+
+		return seq_copy(region, data_struct_layout::arbitrary + first * sizeof(int64_t), dst,
+				count * sizeof(int64_t), spin);
+	}
+
+	static inline int data_struct_arbitrary_write(struct write_batch *batch, size_t first,
+						      const int64_t *src, size_t count) {
+		if (first > data_struct_layout::arbitrary_length || count > data_struct_layout::arbitrary_length - first)
+			return -EINVAL;
+
+		return batch_add(batch, data_struct_layout::arbitrary + first * sizeof(int64_t), src,
+				 count * sizeof(int64_t));
+	}
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_DATA_ACCESS_H */
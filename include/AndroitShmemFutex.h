@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_FUTEX_H
+#define ANDROIT_SHMEM_FUTEX_H
+
+/* Thin wrappers around the futex system call. Regions are mapped by
+ * several processes, so only the process-shared (non-private) operations
+ * are used; the kernel identifies the word by its backing file and offset. */
+
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <stdint.h>
+#include <linux/futex.h>
+
+#ifndef __NR_futex_waitv
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__) || defined(__arm__)
+#define __NR_futex_waitv 449
+#endif
+#endif
+
+namespace androit {
+	/* Sleeps as long as *addr contains val, at most timeout (relative, NULL
+	 * for no limit). Returns 0 if woken up, -EAGAIN if *addr did not
+	 * contain val, -ETIMEDOUT or -EINTR. */
+	static inline int futex_wait(volatile unsigned int *addr, unsigned int val,
+				     const struct timespec *timeout) {
+		if (syscall(__NR_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0) < 0)
+			return -errno;
+		return 0;
+	}
+
+	// Wakes up to count waiters sleeping on addr, returns their number
+	static inline int futex_wake(volatile unsigned int *addr, int count) {
+		long ret = syscall(__NR_futex, addr, FUTEX_WAKE, count, NULL, NULL, 0);
+
+		return ret < 0 ? -errno : (int)ret;
+	}
+
+	// One word of futex_waitv(), same layout as struct futex_waitv of Linux 5.16
+	struct futex_waiter {
+		uint64_t val;
+		uint64_t uaddr;
+		uint32_t flags;
+		uint32_t reserved;
+	};
+
+	/* Sleeps until one of the words of waiters no longer contains its val
+	 * or one of them is woken, at most until deadline (absolute,
+	 * CLOCK_MONOTONIC, NULL for no limit). Returns the index of the woken
+	 * word, -EAGAIN if a word did not contain its val, -ETIMEDOUT, -EINTR,
+	 * or -ENOSYS on kernels before 5.16. */
+	static inline int futex_waitv(struct futex_waiter *waiters, unsigned int count,
+				      const struct timespec *deadline) {
+#ifdef __NR_futex_waitv
+		long ret;
+
+		for (unsigned int i = 0; i < count; i++)
+			waiters[i].flags = 2; // FUTEX2_SIZE_U32, process-shared
+
+		ret = syscall(__NR_futex_waitv, waiters, count, 0, deadline, CLOCK_MONOTONIC);
+		return ret < 0 ? -errno : (int)ret;
+#else
+		return -ENOSYS;
+#endif
+	}
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_FUTEX_H */
@@ -0,0 +1,333 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_HISTORY_H
+#define ANDROIT_SHMEM_HISTORY_H
+
+/* Version histories (SYNC_HISTORY): the last capacity committed versions
+ * of a seqlock region, each stamped with the sequence it was committed at
+ * and its CLOCK_MONOTONIC commit time, in a region of their own. Readers
+ * that poll slower than the writers commit (e.g. a UI) fetch all versions
+ * since the last one they saw in one call, instead of only the latest.
+ *
+ * Writers record into the history by passing it to end_rt_write(),
+ * nonrt_commit() or the write batch functions. RT writers and a non-RT
+ * writer record concurrently without a common lock, and a non-RT writer
+ * may be preempted while it fills its entry. Every entry therefore has a
+ * state word: the index it was last claimed for and whether a writer still
+ * fills it. A writer claims the entry of index head with a CAS on its
+ * state, and only if no writer fills it; if one does (a non-RT writer of
+ * an earlier lap of the ring), index is marked as skipped instead and the
+ * writer moves on to the next one. Either way head is advanced behind
+ * index, so every index below head is decided once. A reader of index i
+ * checks the state is "complete for i" before and after its copy; an
+ * entry still being written for i is skipped and reported as a possible
+ * loss once a later version is returned. head and the states count
+ * indices in 64 bits and do not wrap.
+ *
+ * Each commit advances the sequence of the region by 4 (see end_rt_write()
+ * and nonrt_commit()), so readers know whether versions between the one
+ * they saw and the oldest one the ring still holds were lost. Recovering
+ * from a dead writer advances it by 2, which readers report as a loss as
+ * well. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <AndroitShmem.h>
+
+namespace androit {
+	enum {
+		HISTORY_CAPACITY_MAX = 1 << 16
+	};
+
+	// since of history_read() for all versions the ring holds
+	static const seq_t HISTORY_ALL = ~(seq_t)0;
+
+	// Flags of the state of an entry, below (index + 1) << HISTORY_STATE_SHIFT
+	enum {
+		HISTORY_BUSY = 1,     // A writer fills the entry
+		HISTORY_SKIPPED = 2,  // Index was skipped, the entry was busy then
+		HISTORY_STATE_SHIFT = 2
+	};
+
+	// Start of every entry, the recorded data follows
+	struct history_entry {
+		uint64_t state;       // (Index + 1) << HISTORY_STATE_SHIFT | flags, see above
+		seq_t seq;            // Sequence of the region at the commit
+		uint64_t time_ns;     // CLOCK_MONOTONIC time of the commit
+		unsigned int valid;   // 0 if the commit failed (non-RT transaction)
+	};
+
+	// Stamp of a version returned by history_read()
+	struct history_stamp {
+		seq_t seq;
+		uint64_t time_ns;
+	};
+
+	struct history {
+		struct region_header header;
+		uint32_t capacity;    // Number of entries
+		uint32_t entry_size;  // Distance of entries, whole cache lines
+		// Next index to claim, only written by writers
+		alignas(CACHE_LINE) uint64_t head;
+		// capacity entries of entry_size bytes follow, starting at a cache line
+	};
+
+	static_assert(sizeof(struct history) % CACHE_LINE == 0, "entries must start at a cache line");
+	static_assert(sizeof(struct history_entry) <= CACHE_LINE, "entry stamps must fit into a cache line");
+
+	// Returns the distance of entries recording data_size bytes
+	static inline size_t history_entry_size(size_t data_size) {
+		return CACHE_LINE + (data_size + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+	}
+
+	// Returns the size of a history region
+	static inline size_t history_size(unsigned int capacity, size_t data_size) {
+		return sizeof(struct history) + capacity * history_entry_size(data_size);
+	}
+
+	// Returns the entry of index
+	static inline struct history_entry *history_entry_at(const struct history *h, uint64_t index) {
+		return (struct history_entry*)((char*)h + sizeof(struct history) +
+					       (size_t)(index % h->capacity) * h->entry_size);
+	}
+
+	// Returns the state of an entry complete for index, flags adds HISTORY_*
+	static inline uint64_t history_state(uint64_t index, uint64_t flags = 0) {
+		return (index + 1) << HISTORY_STATE_SHIFT | flags;
+	}
+
+	static inline char *history_data(struct history_entry *entry) {
+		return (char*)entry + CACHE_LINE;
+	}
+
+	static inline uint64_t history_now(void) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+
+	///////////////////////////////////////////////////////////////////
+	// Writers
+	/* Claims the entry of the next index and copies data into it, returns
+	 * the entry for history_publish(). Indices whose entry a writer of an
+	 * earlier lap still fills are skipped; at most one RT and one non-RT
+	 * writer record at a time, so a writer skips one index at most. */
+	static inline struct history_entry *history_record(struct history *h, uint64_t *index,
+							   const void *data, seq_t seq) {
+		struct history_entry *entry;
+		uint64_t state;
+
+		for (;;) {
+			*index = load_acquire(&h->head);
+			entry = history_entry_at(h, *index);
+			state = load_acquire(&entry->state);
+
+			// Decided already (head is stale or its writer did not advance it yet)
+			if ((state >> HISTORY_STATE_SHIFT) >= *index + 1) {
+				cas_full(&h->head, *index, *index + 1);
+				continue;
+			}
+
+			if (state & HISTORY_BUSY) {
+				// Keep BUSY: its writer still owns the data, see history_publish()
+				if (cas_full(&entry->state, state, history_state(*index, HISTORY_BUSY | HISTORY_SKIPPED)))
+					cas_full(&h->head, *index, *index + 1);
+				continue;
+			}
+
+			// A full barrier: readers that see the new state after their copy discard it
+			if (cas_full(&entry->state, state, history_state(*index, HISTORY_BUSY))) {
+				cas_full(&h->head, *index, *index + 1);
+				break;
+			}
+		}
+
+		entry->seq = seq;
+		memcpy(history_data(entry), data, h->header.data_size);
+
+		return entry;
+	}
+
+	/* Completes an entry of history_record(), valid is false for a failed
+	 * commit. If a writer skipped index meanwhile, the version is dropped
+	 * and the entry only released. */
+	static inline void history_publish(struct history_entry *entry, uint64_t index, bool valid) {
+		uint64_t state;
+
+		entry->valid = valid;
+		entry->time_ns = history_now();
+		// The entry is complete before the state announces it
+		if (cas_full(&entry->state, history_state(index, HISTORY_BUSY), history_state(index)))
+			return;
+
+		do
+			state = load_relaxed(&entry->state);
+		while (!cas_full(&entry->state, state, state & ~(uint64_t)HISTORY_BUSY));
+	}
+
+	/* Finishes an RT write like end_rt_write() and records the data as
+	 * committed into h, if h is not NULL. */
+	template <typename T>
+	static inline int end_rt_write(shared<T> *region, struct history *h) {
+		struct history_entry *entry;
+		uint64_t index;
+
+		if (h != NULL) {
+			// rt_wlock keeps the active copy stable, end_rt_write() commits at sequence + 2
+			entry = history_record(h, &index, &region->data[region->protect.sequence & 1],
+					       region->protect.sequence + 2);
+			history_publish(entry, index, true);
+		}
+
+		return end_rt_write(region);
+	}
+
+	/* Commits a transaction like nonrt_commit() and records the data it
+	 * committed into h, if h is not NULL. The update is recorded before the
+	 * CAS, once the commit succeeded RT writers may modify it right away. */
+	template <typename T>
+	static inline bool nonrt_commit(shared<T> *region, const struct transaction *tx, struct history *h) {
+		struct history_entry *entry;
+		uint64_t index;
+		bool committed;
+
+		if (h == NULL)
+			return nonrt_commit(region, tx);
+
+		// Do not fill the ring with attempts that are bound to fail
+		if (region->protect.sequence != tx->start_seq)
+			return false;
+
+		entry = history_record(h, &index, &region->data[1 - (tx->start_seq & 1)], (tx->start_seq + 4) ^ 1);
+		committed = nonrt_commit(region, tx);
+		history_publish(entry, index, committed);
+
+		return committed;
+	}
+
+	///////////////////////////////////////////////////////////////////
+	// Readers
+	/* Copies bytes [offset, offset + len) of every version committed after
+	 * sequence since (HISTORY_ALL: of every version h holds), oldest first,
+	 * to dst + i * len and their stamps to stamps[i], at most max versions.
+	 * Pass the seq of the last version returned to continue. *lost is set
+	 * if versions after since were overwritten before they could be read,
+	 * or if an entry before a returned version was still being written (it
+	 * may hold a version older than the returned ones, or a failed commit).
+	 * Returns the number of versions, or -EINVAL. */
+	static inline int history_read(const struct history *h, seq_t since, size_t offset, size_t len,
+				       void *dst, struct history_stamp *stamps, unsigned int max, bool *lost) {
+		uint64_t head, index, state;
+		unsigned int count = 0;
+		bool pending = false;
+
+		*lost = false;
+		if (offset > h->header.data_size || len > h->header.data_size - offset)
+			return -EINVAL;
+
+		head = load_acquire(&h->head);
+		index = head > h->capacity ? head - h->capacity : 0;
+
+		for (; index != head && count < max; index++) {
+			struct history_entry *entry = history_entry_at(h, index);
+			seq_t seq;
+
+			state = load_acquire(&entry->state);
+			if (state != history_state(index)) {
+				if ((state >> HISTORY_STATE_SHIFT) > index + 1)
+					*lost = true;   // Overwritten since head was read
+				else if (!(state & HISTORY_SKIPPED))
+					pending = true; // Still being written
+				continue;
+			}
+
+			seq = entry->seq;
+			if (!entry->valid || (since != HISTORY_ALL && seq <= since))
+				continue;
+
+			memcpy((char*)dst + count * len, history_data(entry) + offset, len);
+			stamps[count].seq = seq;
+			stamps[count].time_ns = entry->time_ns;
+
+			// Claimed again during the copy
+			fence_acquire();
+			if (load_relaxed(&entry->state) != state) {
+				*lost = true;
+				continue;
+			}
+
+			// The version committed right after since is gone
+			if (count == 0 && since != HISTORY_ALL && ((seq ^ (since + 4)) & ~(seq_t)1) != 0)
+				*lost = true;
+			if (pending)
+				*lost = true;
+
+			count++;
+		}
+
+		return count;
+	}
+
+	///////////////////////////////////////////////////////////////////
+	// Setup
+	static inline bool history_valid(unsigned int capacity, size_t data_size) {
+		return capacity >= 2 && capacity <= HISTORY_CAPACITY_MAX && data_size > 0;
+	}
+
+	/* Initialises a history region of history_size(capacity, data_size)
+	 * bytes for the data of a region with layout hash. Returns 0 or -EINVAL. */
+	static inline int init_history(struct history *h, unsigned int capacity, size_t data_size, uint32_t hash) {
+		if (!history_valid(capacity, data_size))
+			return -EINVAL;
+
+		memset(h, 0, history_size(capacity, data_size));
+		h->capacity = capacity;
+		h->entry_size = history_entry_size(data_size);
+
+		init_header(&h->header, SYNC_HISTORY, 0, data_size, history_size(capacity, data_size), hash);
+		return 0;
+	}
+
+	/* Checks that h (a mapping of size bytes) is a history of the data of
+	 * a shared<T>, set up by a compatible version, see check_layout(). */
+	template <typename T>
+	static inline int check_history(const struct history *h, size_t size) {
+		int ret;
+
+		// The fields the header is checked against are read once it was published
+		if (size < sizeof(struct history) || !header_published(&h->header))
+			return -ENODEV;
+
+		ret = check_header(&h->header, size, SYNC_HISTORY, 0, sizeof(T),
+				   history_size(h->capacity, sizeof(T)), layout_hash<T>::value);
+		if (ret != 0)
+			return ret;
+
+		if (!history_valid(h->capacity, sizeof(T)) || h->entry_size != history_entry_size(sizeof(T)))
+			return -EINVAL;
+
+		return 0;
+	}
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_HISTORY_H */
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_LEFT_RIGHT_H
+#define ANDROIT_SHMEM_LEFT_RIGHT_H
+
+/* Left-right regions (SYNC_LEFT_RIGHT): two copies of T, readers are
+ * wait-free and never retry, writers wait for readers instead.
+ *
+ * Readers announce themselves in one of two read indicators (the one
+ * selected by version), read the copy selected by left_right in place and
+ * leave the indicator again. A writer (serialised by protect.rt_wlock)
+ * modifies the copy readers do not use, publishes it by toggling
+ * left_right and then drains the readers of the previous copy: it toggles
+ * version and waits until both indicators were empty once, so no reader
+ * that could have seen the previous copy is left. Then it brings that
+ * copy up to date with the blocks it modified, for the next writer.
+ *
+ * Writers thus wait for the longest read in progress; readers must keep
+ * their reads short, and a reader that dies while reading blocks all
+ * writers. (Thesis-style seqlock regions make the opposite trade-off.) */
+
+#include <AndroitShmem.h>
+
+namespace androit {
+	// A read indicator, in a cache line of its own
+	struct alignas(CACHE_LINE) lr_indicator {
+		unsigned int readers;
+	};
+
+	template <typename T>
+	struct lr_shared {
+		static_assert(std::is_class<T>::value, "region data must be a struct");
+
+		enum {
+			BLOCKS = (sizeof(T) + DIRTY_BLOCK - 1) / DIRTY_BLOCK
+		};
+
+		struct region_header header;
+		/* sequence (increased by 4 per commit) and waiters serve
+		 * wait_for_update(), rt_wlock serialises all writers. nonrt_wlock
+		 * and synced are unused. */
+		struct protect protect;
+		// Copy readers read
+		alignas(CACHE_LINE) unsigned int left_right;
+		// Indicator readers arrive at
+		alignas(CACHE_LINE) unsigned int version;
+		struct lr_indicator indicators[2];
+		// Sequence of the commit that last modified each block
+		alignas(CACHE_LINE) seq_t dirty_gen[BLOCKS];
+		data_copy<T> data[2];
+	};
+
+	///////////////////////////////////////////////////////////////////
+	// Readers
+	/* Returns the published copy, which stays unchanged until lr_read_end()
+	 * with the indicator stored in *indicator. Never waits. */
+	template <typename T>
+	static inline const T *lr_read_begin(const lr_shared<T> *region, unsigned int *indicator) {
+		// Arriving is no modification of the data
+		lr_shared<T> *r = const_cast<lr_shared<T>*>(region);
+
+		*indicator = load_relaxed(&r->version) & 1;
+		// Full barrier: left_right is read after arriving
+		add_full(&r->indicators[*indicator].readers, 1U);
+
+		return &region->data[load_relaxed(&r->left_right) & 1];
+	}
+
+	template <typename T>
+	static inline void lr_read_end(const lr_shared<T> *region, unsigned int indicator) {
+		// Release: the copy is read before leaving
+		add_release(&const_cast<lr_shared<T>*>(region)->indicators[indicator].readers, -1U);
+	}
+
+	///////////////////////////////////////////////////////////////////
+	// Writers (RT and non-RT)
+	// Waits until no reader can still use the copy that is not published
+	template <typename T>
+	static inline void lr_drain(lr_shared<T> *region) {
+		unsigned int prev = region->version & 1, next = 1 - prev;
+
+		while (load_acquire(&region->indicators[next].readers) != 0)
+			cpu_relax();
+		// Full barrier: the indicator is checked after readers arrive at the other one
+		store_relaxed(&region->version, next);
+		fence_full();
+		while (load_acquire(&region->indicators[prev].readers) != 0)
+			cpu_relax();
+	}
+
+	/* Locks out other writers and returns the copy to modify, which no
+	 * reader uses. Returns NULL if the writer lock could not be taken. */
+	template <typename T>
+	static inline T *lr_begin_write(lr_shared<T> *region) {
+		switch (pthread_mutex_lock(&region->protect.rt_wlock)) {
+		case 0:
+			break;
+		case EOWNERDEAD:
+			/* The dead writer may have left the copies different and
+			 * readers on either: drain them and start over from the
+			 * published copy. */
+			region->protect.dead_writers++;
+			lr_drain(region);
+			memcpy((T*)&region->data[1 - (region->left_right & 1)],
+			       (const T*)&region->data[region->left_right & 1], sizeof(T));
+			lock_recovered(&region->protect.rt_wlock);
+			break;
+		default:
+			return NULL;
+		}
+
+		return &region->data[1 - (region->left_right & 1)];
+	}
+
+	// Announces a modification of the copy returned by lr_begin_write()
+	template <typename T>
+	static inline void lr_mark_dirty(lr_shared<T> *region, const void *addr, size_t len) {
+		size_t offset = (const char*)addr - (const char*)&region->data[1 - (region->left_right & 1)], last;
+
+		if (len == 0)
+			return;
+
+		last = (offset + len - 1) / DIRTY_BLOCK;
+		for (size_t block = offset / DIRTY_BLOCK; block <= last && block < lr_shared<T>::BLOCKS; block++)
+			region->dirty_gen[block] = region->protect.sequence + 4;
+	}
+
+	/* Publishes the modified copy, waits for the readers of the previous
+	 * one and copies the modified blocks into it. Lets in the next writer. */
+	template <typename T>
+	static inline int lr_commit(lr_shared<T> *region) {
+		seq_t gen = region->protect.sequence + 4;
+		const char *published;
+		char *previous;
+		int ret;
+
+		// Full barrier: the copy is complete before readers can see it
+		xor_full(&region->left_right, 1U);
+		lr_drain(region);
+
+		published = (const char*)&region->data[region->left_right & 1];
+		previous = (char*)&region->data[1 - (region->left_right & 1)];
+		for (size_t block = 0; block < lr_shared<T>::BLOCKS; block++) {
+			size_t offset, len;
+
+			if (region->dirty_gen[block] != gen)
+				continue;
+
+			offset = block * DIRTY_BLOCK;
+			len = sizeof(T) - offset < DIRTY_BLOCK ? sizeof(T) - offset : (size_t)DIRTY_BLOCK;
+			memcpy(previous + offset, published + offset, len);
+		}
+
+		add_full(&region->protect.sequence, (seq_t)4);
+		ret = pthread_mutex_unlock(&region->protect.rt_wlock);
+
+		// Wake readers waiting for an update
+		seq_wake(&region->protect);
+
+		return ret;
+	}
+
+	// Initialises a left-right region, both copies hold init_data (or zeroes)
+	template <typename T>
+	static int init_shared(lr_shared<T> *region, void (*init_data)(T *data) = NULL,
+			       int options = PROTECT_DEFAULT) {
+		for (int i = 0; i < 2; i++) {
+			memset(&region->data[i], 0, sizeof(T));
+			if (init_data != NULL)
+				init_data(&region->data[i]);
+			region->indicators[i].readers = 0;
+		}
+		memset(region->dirty_gen, 0, sizeof(region->dirty_gen));
+		region->left_right = 0;
+		region->version = 0;
+
+		init_header(&region->header, SYNC_LEFT_RIGHT, 2, sizeof(T), sizeof(lr_shared<T>), layout_hash<T>::value);
+
+		return init_protect(&region->protect, options);
+	}
+
+	template <typename T>
+	static inline int check_layout(const lr_shared<T> *region, size_t size) {
+		return check_header(&region->header, size, SYNC_LEFT_RIGHT, 2, sizeof(T), sizeof(lr_shared<T>),
+				    layout_hash<T>::value);
+	}
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_LEFT_RIGHT_H */
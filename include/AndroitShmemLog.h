@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_LOG_H
+#define ANDROIT_SHMEM_LOG_H
+
+/* LOGD/LOGE for code that is shared between the Android build and the
+ * plain Linux build. On Android, the macros come from liblog; elsewhere
+ * messages go to stderr, prefixed with LOG_TAG. */
+
+#ifdef __ANDROID__
+#include <utils/Log.h>
+#else
+#include <stdio.h>
+#include <stdarg.h>
+
+#ifndef LOG_TAG
+#define LOG_TAG "AndroitShmem"
+#endif
+
+namespace androit {
+	static inline void log_print(char level, const char *tag, const char *fmt, ...)
+		__attribute__((format(printf, 3, 4)));
+
+	static inline void log_print(char level, const char *tag, const char *fmt, ...) {
+		va_list args;
+
+		va_start(args, fmt);
+		fprintf(stderr, "%c/%s: ", level, tag);
+		vfprintf(stderr, fmt, args);
+		fputc('\n', stderr);
+		va_end(args);
+	}
+}; // namespace androit
+
+#ifndef LOGD
+#define LOGD(...) androit::log_print('D', LOG_TAG, __VA_ARGS__)
+#endif
+#ifndef LOGE
+#define LOGE(...) androit::log_print('E', LOG_TAG, __VA_ARGS__)
+#endif
+#endif /* __ANDROID__ */
+
+#endif /* ANDROIT_SHMEM_LOG_H */
@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_NBUF_H
+#define ANDROIT_SHMEM_NBUF_H
+
+/* N-buffer regions (SYNC_NBUF), an alternative to the 2-copy seqlock of
+ * shared<T> for regions whose readers must never wait and whose non-RT
+ * writers must never retry.
+ *
+ * The region holds N >= 3 copies (slots) of T. A packed 64-bit state word
+ * holds the index of the published slot and a pin count per slot:
+ * 	bits 0-1:              published slot
+ * 	bits 2+14*i .. 15+14*i: number of readers pinning slot i
+ * Readers pin the published slot with a single CAS on the state word and
+ * read it in place; a pinned slot is never written. Writers (RT and non-RT
+ * alike, serialised by protect.rt_wlock) prepare an unpinned, unpublished
+ * slot and publish it with a single atomic XOR on the state word.
+ *
+ * Readers only ever pin the published slot, but may still be reading a
+ * slot after it was superseded. A writer finds a free slot as long as at
+ * most N - 2 readers lag behind like that at once: choose N for the
+ * number of readers that may be preempted during a read. Otherwise the
+ * writer waits NBUF_SPIN iterations for a reader to unpin and then gives
+ * up (nbuf_begin_write() returns NULL) instead of spinning under
+ * rt_wlock. A reader that dies while it pins a slot leaks its pin; the
+ * slot stays unusable until the region is initialised again.
+ *
+ * All writers hold rt_wlock while they prepare their slot, copy included:
+ * an RT writer waits for a non-RT writer that prepares a slot just like
+ * for another RT writer. Regions with large non-RT updates that RT
+ * writers must not wait for belong into shared<T>.
+ *
+ * Writers announce their modifications (nbuf_mark_dirty()) like writers
+ * of shared<T>, so preparing a slot only copies the blocks that changed
+ * since the slot was last published. */
+
+#include <AndroitShmem.h>
+
+namespace androit {
+	enum {
+		NBUF_MAX = 4,
+		NBUF_INDEX_MASK = 3,
+		NBUF_PIN_SHIFT = 2,
+		NBUF_PIN_BITS = 14,
+		// cpu_relax() iterations a writer waits for a reader to unpin a slot
+		NBUF_SPIN = 1000
+	};
+
+	static inline unsigned int nbuf_published(uint64_t state) {
+		return state & NBUF_INDEX_MASK;
+	}
+
+	static inline unsigned int nbuf_pins(uint64_t state, unsigned int slot) {
+		return (state >> (NBUF_PIN_SHIFT + slot * NBUF_PIN_BITS)) & ((1U << NBUF_PIN_BITS) - 1);
+	}
+
+	// Value to add to the state word to pin slot once
+	static inline uint64_t nbuf_pin(unsigned int slot) {
+		return 1ULL << (NBUF_PIN_SHIFT + slot * NBUF_PIN_BITS);
+	}
+
+	template <typename T, unsigned int N = 3>
+	struct nbuf_shared {
+		static_assert(N >= 3 && N <= NBUF_MAX, "N-buffer regions have 3 or 4 slots");
+		static_assert(std::is_class<T>::value, "region data must be a struct");
+
+		enum {
+			BLOCKS = (sizeof(T) + DIRTY_BLOCK - 1) / DIRTY_BLOCK
+		};
+
+		struct region_header header;
+		/* sequence (increased by 4 per commit, never has the 2-bit set) and
+		 * waiters serve wait_for_update(), rt_wlock serialises all writers.
+		 * nonrt_wlock and synced are unused. */
+		struct protect protect;
+		// Packed slot state, see above
+		alignas(CACHE_LINE) uint64_t state;
+		// Sequence at which each slot was published
+		alignas(CACHE_LINE) seq_t slot_seq[N];
+		// Sequence at which each block of the data was last modified
+		alignas(CACHE_LINE) seq_t dirty_gen[BLOCKS];
+		data_copy<T> slots[N];
+	};
+
+	/* Loads the state word atomically (plain 64-bit loads are not on 32-bit
+	 * CPUs). Acquire: a writer reuses a slot only after the readers that
+	 * unpinned it are done with it. */
+	static inline uint64_t nbuf_load_state(const uint64_t *state) {
+		return load_acquire(state);
+	}
+
+	///////////////////////////////////////////////////////////////////
+	// Readers
+	/* Pins the published slot and returns its data, which stays unchanged
+	 * until nbuf_read_end(). Never waits for writers. Stores the slot in
+	 * *slot and (if seq is not NULL) the sequence it was published at. */
+	template <typename T, unsigned int N>
+	static inline const T *nbuf_read_begin(const nbuf_shared<T, N> *region, unsigned int *slot,
+					       seq_t *seq = NULL) {
+		// Pinning is no modification of the data
+		uint64_t *state = const_cast<uint64_t*>(&region->state);
+		uint64_t old = load_relaxed(state);
+
+		/* CAS fails only if the state changed in between, the data is not
+		 * read twice. Acquire: the slot is read after it is pinned. */
+		while (!cas_acquire(state, old, old + nbuf_pin(nbuf_published(old))))
+			old = load_relaxed(state);
+
+		*slot = nbuf_published(old);
+		if (seq != NULL)
+			*seq = region->slot_seq[*slot];
+
+		return &region->slots[*slot];
+	}
+
+	template <typename T, unsigned int N>
+	static inline void nbuf_read_end(const nbuf_shared<T, N> *region, unsigned int slot) {
+		// Release: the slot is read before it is unpinned
+		add_release(const_cast<uint64_t*>(&region->state), -nbuf_pin(slot));
+	}
+
+	///////////////////////////////////////////////////////////////////
+	// Writers (RT and non-RT)
+	/* Locks out other writers and returns a slot to prepare the next version
+	 * in, holding the published data. Stores the slot in *slot. Returns NULL
+	 * if the writer lock could not be taken, or if readers still pinned all
+	 * other slots after NBUF_SPIN iterations (see above). */
+	template <typename T, unsigned int N>
+	static inline T *nbuf_begin_write(nbuf_shared<T, N> *region, unsigned int *slot) {
+		const char *published;
+		char *update;
+		uint64_t state;
+		unsigned int pub, next = N, spin = 0;
+		seq_t base;
+
+		switch (pthread_mutex_lock(&region->protect.rt_wlock)) {
+		case 0:
+			break;
+		case EOWNERDEAD:
+			/* A dead writer only touched a slot it did not publish, and
+			 * slots are brought up to date before every write */
+			region->protect.dead_writers++;
+			lock_recovered(&region->protect.rt_wlock);
+			break;
+		default:
+			return NULL;
+		}
+
+		// Only writers change the published slot, it is stable from here on
+		state = nbuf_load_state(&region->state);
+		pub = nbuf_published(state);
+
+		// Find a slot no reader pins, starting with the one published longest ago
+		while (next == N) {
+			for (unsigned int i = 1; i < N; i++) {
+				unsigned int candidate = (pub + i) % N;
+
+				if (nbuf_pins(state, candidate) == 0 &&
+				    (next == N || region->slot_seq[candidate] < region->slot_seq[next]))
+					next = candidate;
+			}
+
+			if (next == N) {
+				if (++spin > NBUF_SPIN) {
+					pthread_mutex_unlock(&region->protect.rt_wlock);
+					return NULL;
+				}
+				cpu_relax();
+				state = nbuf_load_state(&region->state);
+			}
+		}
+
+		/* Readers only pin the published slot (checked atomically by their
+		 * CAS), so next stays unpinned. Bring it up to date. */
+		published = (const char*)&region->slots[pub];
+		update = (char*)&region->slots[next];
+		base = region->slot_seq[next];
+
+		for (size_t block = 0; block < nbuf_shared<T, N>::BLOCKS; block++) {
+			size_t offset, len;
+
+			if (region->dirty_gen[block] <= base)
+				continue;
+
+			offset = block * DIRTY_BLOCK;
+			len = sizeof(T) - offset < DIRTY_BLOCK ? sizeof(T) - offset : (size_t)DIRTY_BLOCK;
+			memcpy(update + offset, published + offset, len);
+		}
+
+		*slot = next;
+		return (T*)update;
+	}
+
+	// Announces a modification of the slot returned by nbuf_begin_write()
+	template <typename T, unsigned int N>
+	static inline void nbuf_mark_dirty(nbuf_shared<T, N> *region, unsigned int slot,
+					   const void *addr, size_t len) {
+		size_t offset = (const char*)addr - (const char*)&region->slots[slot], last;
+
+		if (len == 0)
+			return;
+
+		// Generation of the upcoming commit
+		last = (offset + len - 1) / DIRTY_BLOCK;
+		for (size_t block = offset / DIRTY_BLOCK; block <= last && block < nbuf_shared<T, N>::BLOCKS; block++)
+			region->dirty_gen[block] = region->protect.sequence + 4;
+	}
+
+	/* Publishes slot with a single atomic operation on the state word and
+	 * lets in the next writer. */
+	template <typename T, unsigned int N>
+	static inline int nbuf_commit(nbuf_shared<T, N> *region, unsigned int slot) {
+		unsigned int pub = nbuf_published(nbuf_load_state(&region->state));
+		int ret;
+
+		region->slot_seq[slot] = region->protect.sequence + 4;
+		// Release: the slot contents are visible before it is published
+		xor_release(&region->state, (uint64_t)(pub ^ slot));
+		add_full(&region->protect.sequence, (seq_t)4);
+
+		ret = pthread_mutex_unlock(&region->protect.rt_wlock);
+
+		// Wake readers waiting for an update
+		seq_wake(&region->protect);
+
+		return ret;
+	}
+
+	// Initialises an N-buffer region, all slots hold init_data (or zeroes)
+	template <typename T, unsigned int N>
+	static int init_shared(nbuf_shared<T, N> *region, void (*init_data)(T *data) = NULL) {
+		for (unsigned int i = 0; i < N; i++) {
+			memset(&region->slots[i], 0, sizeof(T));
+			if (init_data != NULL)
+				init_data(&region->slots[i]);
+			region->slot_seq[i] = 0;
+		}
+		memset(region->dirty_gen, 0, sizeof(region->dirty_gen));
+		region->state = 0;
+
+		init_header(&region->header, SYNC_NBUF, N, sizeof(T), sizeof(nbuf_shared<T, N>), layout_hash<T>::value);
+
+		return init_protect(&region->protect);
+	}
+
+	template <typename T, unsigned int N>
+	static inline int check_layout(const nbuf_shared<T, N> *region, size_t size) {
+		return check_header(&region->header, size, SYNC_NBUF, N, sizeof(T), sizeof(nbuf_shared<T, N>),
+				    layout_hash<T>::value);
+	}
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_NBUF_H */
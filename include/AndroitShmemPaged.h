@@ -0,0 +1,355 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_PAGED_H
+#define ANDROIT_SHMEM_PAGED_H
+
+/* Page-mapped regions (SYNC_PAGED) for data of several MB, where even
+ * scanning the dirty blocks of shared<T> in every non-RT transaction is
+ * too expensive.
+ *
+ * The data is split into pages of PAGED_PAGE bytes. Every page p owns two
+ * frames, p in bank 0 and p + PAGES in bank 1. Two page maps translate
+ * pages to frames, map[i][p] is the frame holding page p of version i; the
+ * 1-bit of the sequence selects the published map. Both maps share the
+ * frame of every page that was not modified since the last commit.
+ *
+ * RT writers lock rt_wlock and modify the frames of the published map in
+ * place, like writers of shared<T>, with the 2-bit of the sequence set.
+ * Non-RT transactions copy a page into its other frame the first time they
+ * modify it (copy on write) and enter that frame in the unpublished map;
+ * the commit publishes the map with the same single CAS on the sequence
+ * as nonrt_commit(). A transaction thus costs O(pages it modifies): the
+ * next one only has to reshare the frames of the pages the previous one
+ * diverged.
+ *
+ * Readers translate offsets through the published map and detect
+ * interference with the sequence, see paged_copy(). The data has no
+ * contiguous address, it is accessed by offset. */
+
+#include <AndroitShmem.h>
+
+namespace androit {
+	enum {
+		PAGED_PAGE = 4096
+	};
+
+	template <typename T>
+	struct paged_shared {
+		static_assert(std::is_class<T>::value, "region data must be a struct");
+
+		enum {
+			PAGES = (sizeof(T) + PAGED_PAGE - 1) / PAGED_PAGE
+		};
+
+		struct region_header header;
+		/* rt_wlock serialises RT writers, nonrt_wlock non-RT writers, who
+		 * alone access diverged and pages. synced is unused. */
+		struct protect protect;
+		// Frames of the pages of either version, indexed by the 1-bit of the sequence
+		alignas(CACHE_LINE) uint32_t map[2][PAGES];
+		/* Pages whose frame differs between the two maps: diverged by the
+		 * last commit or by a transaction attempt that failed */
+		alignas(CACHE_LINE) uint32_t diverged;
+		uint32_t pages[PAGES];
+		// Bank 0 holds the initial version, the data of T in order
+		alignas(PAGED_PAGE) char frames[2 * PAGES][PAGED_PAGE];
+	};
+
+	// Returns the bytes of page page of version version (0 or 1)
+	template <typename T>
+	static inline char *paged_page(paged_shared<T> *region, unsigned int version, size_t page) {
+		return region->frames[region->map[version][page]];
+	}
+
+	template <typename T>
+	static inline const char *paged_page(const paged_shared<T> *region, unsigned int version, size_t page) {
+		return region->frames[region->map[version][page]];
+	}
+
+	// Copies len bytes at offset of version version to dst, pages may change meanwhile
+	template <typename T>
+	static inline void paged_gather(const paged_shared<T> *region, unsigned int version, size_t offset,
+					void *dst, size_t len) {
+		char *to = (char*)dst;
+
+		while (len > 0) {
+			size_t in_page = offset % PAGED_PAGE;
+			size_t chunk = PAGED_PAGE - in_page < len ? PAGED_PAGE - in_page : len;
+
+			memcpy(to, paged_page(region, version, offset / PAGED_PAGE) + in_page, chunk);
+			to += chunk;
+			offset += chunk;
+			len -= chunk;
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////
+	// RT writers
+	/* Repairs the region after an RT writer died holding rt_wlock, which the
+	 * caller now holds (EOWNERDEAD). RT writers modify the published frames
+	 * in place, so the write cannot be rolled back: the 2-bit is cleared and
+	 * protect.torn records the sequence the partial write is visible at. */
+	template <typename T>
+	static void paged_recover_rt_write(paged_shared<T> *region) {
+		struct protect *protect = &region->protect;
+
+		protect->dead_writers++;
+		if (protect->sequence & 2) {
+			protect->torn = protect->sequence + 2;
+			add_full(&protect->sequence, (seq_t)2);
+			seq_wake(protect);
+		}
+		lock_recovered(&protect->rt_wlock);
+	}
+
+	// Locks out other RT writers and marks an RT write in progress, see begin_rt_write()
+	template <typename T>
+	static inline int paged_begin_rt_write(paged_shared<T> *region) {
+		int ret = pthread_mutex_lock(&region->protect.rt_wlock);
+
+		if (ret == EOWNERDEAD) {
+			paged_recover_rt_write(region);
+			ret = 0;
+		}
+		if (ret)
+			return ret;
+
+		add_relaxed(&region->protect.sequence, (seq_t)2);
+		fence_release();
+		return 0;
+	}
+
+	/* Copies len bytes of src to offset of the published version, between
+	 * paged_begin_rt_write() and paged_end_rt_write() */
+	template <typename T>
+	static inline void paged_rt_write(paged_shared<T> *region, size_t offset, const void *src, size_t len) {
+		unsigned int active = region->protect.sequence & 1;
+		const char *from = (const char*)src;
+
+		while (len > 0) {
+			size_t in_page = offset % PAGED_PAGE;
+			size_t chunk = PAGED_PAGE - in_page < len ? PAGED_PAGE - in_page : len;
+
+			memcpy(paged_page(region, active, offset / PAGED_PAGE) + in_page, from, chunk);
+			from += chunk;
+			offset += chunk;
+			len -= chunk;
+		}
+	}
+
+	// Publishes an RT write and lets in the next RT writer, see end_rt_write()
+	template <typename T>
+	static inline int paged_end_rt_write(paged_shared<T> *region) {
+		int ret;
+
+		add_full(&region->protect.sequence, (seq_t)2);
+		ret = pthread_mutex_unlock(&region->protect.rt_wlock);
+
+		seq_wake(&region->protect);
+
+		return ret;
+	}
+
+	///////////////////////////////////////////////////////////////////
+	// Readers
+	// Waits for RT writes to finish and returns the sequence, see seq_begin()
+	template <typename T>
+	static inline seq_t paged_seq_begin(const paged_shared<T> *region, unsigned int spin = SEQ_SPIN_DEFAULT) {
+		static const struct timespec recover_timeout = { 0, SEQ_RECOVER_MS * 1000000L };
+		seq_t sequence = load_acquire(&region->protect.sequence);
+
+		while (sequence & 2) {
+			if (spin > 0) {
+				if (spin != SEQ_SPIN_FOREVER)
+					spin--;
+				cpu_relax();
+			} else if (seq_wait(&region->protect, sequence, &recover_timeout) == -ETIMEDOUT &&
+				   load_relaxed(&region->protect.sequence) == sequence) {
+				// The writer may have died, see seq_try_recover()
+				paged_shared<T> *r = const_cast<paged_shared<T>*>(region);
+
+				if (pthread_mutex_trylock(&r->protect.rt_wlock) == EOWNERDEAD) {
+					paged_recover_rt_write(r);
+					pthread_mutex_unlock(&r->protect.rt_wlock);
+				}
+			}
+			sequence = load_acquire(&region->protect.sequence);
+		}
+
+		return sequence;
+	}
+
+	// Returns true if the region was written since paged_seq_begin() returned start
+	template <typename T>
+	static inline bool paged_seq_doretry(const paged_shared<T> *region, seq_t start) {
+		fence_acquire();
+		return load_relaxed(&region->protect.sequence) != start;
+	}
+
+	/* Copies len bytes at offset of the data into dst, consistently: retries
+	 * until no write interfered. Returns the sequence the copy is valid at.
+	 * offset + len must not exceed sizeof(T). */
+	template <typename T>
+	static inline seq_t paged_copy(const paged_shared<T> *region, size_t offset, void *dst, size_t len,
+				       unsigned int spin = SEQ_SPIN_DEFAULT) {
+		seq_t start_seq;
+
+		do {
+			start_seq = paged_seq_begin(region, spin);
+			paged_gather(region, start_seq & 1, offset, dst, len);
+		} while (paged_seq_doretry(region, start_seq));
+
+		return start_seq;
+	}
+
+	///////////////////////////////////////////////////////////////////
+	// Transactions of non-RT writers
+	// Locks out other non-RT writers, see begin_nonrt_write()
+	template <typename T>
+	static inline int paged_begin_nonrt_write(paged_shared<T> *region) {
+		int ret = pthread_mutex_lock(&region->protect.nonrt_wlock);
+
+		/* A non-RT writer that died never published its map, the next
+		 * transaction reshares every page it may have diverged */
+		if (ret == EOWNERDEAD) {
+			lock_recovered(&region->protect.nonrt_wlock);
+			ret = 0;
+		}
+
+		return ret;
+	}
+
+	template <typename T>
+	static inline int paged_end_nonrt_write(paged_shared<T> *region) {
+		return pthread_mutex_unlock(&region->protect.nonrt_wlock);
+	}
+
+	/* Starts a transaction attempt: waits for RT writes to finish and makes
+	 * the unpublished map equal to the published one by resharing the
+	 * pages diverged by the last commit or the failed attempt before. The
+	 * caller applies its update with paged_nonrt_write() or
+	 * paged_nonrt_page() and commits with paged_nonrt_commit().
+	 * tx->copied counts the pages copied by the attempt. */
+	template <typename T>
+	static inline void paged_nonrt_begin(paged_shared<T> *region, struct transaction *tx) {
+		unsigned int active, update;
+
+		tx->start_seq = paged_seq_begin(region);
+		active = tx->start_seq & 1;
+		update = 1 - active;
+
+		for (uint32_t i = 0; i < region->diverged; i++) {
+			uint32_t page = region->pages[i];
+
+			region->map[update][page] = region->map[active][page];
+		}
+		region->diverged = 0;
+
+		tx->resync = tx->start_seq;
+		tx->copied = 0;
+	}
+
+	/* Returns page page of the unpublished version for modification,
+	 * copying it into its other frame first if the transaction did not
+	 * modify it yet. If the caller overwrites the whole page, whole is true
+	 * and the copy is skipped. */
+	template <typename T>
+	static inline char *paged_nonrt_page(paged_shared<T> *region, struct transaction *tx, size_t page,
+					     bool whole = false) {
+		unsigned int active = tx->start_seq & 1, update = 1 - active;
+		uint32_t frame = region->map[active][page];
+
+		if (region->map[update][page] != frame)
+			return region->frames[region->map[update][page]];
+
+		/* Record the page before diverging it: a writer dying in between
+		 * leaves at most a page resharing does not need. */
+		region->pages[region->diverged] = page;
+		region->diverged++;
+		compiler_barrier();
+
+		frame = frame < paged_shared<T>::PAGES ? frame + paged_shared<T>::PAGES : frame - paged_shared<T>::PAGES;
+		if (!whole) {
+			memcpy(region->frames[frame], region->frames[region->map[active][page]], PAGED_PAGE);
+			tx->copied++;
+		}
+		region->map[update][page] = frame;
+
+		return region->frames[frame];
+	}
+
+	// Copies len bytes of src to offset of the unpublished version
+	template <typename T>
+	static inline void paged_nonrt_write(paged_shared<T> *region, struct transaction *tx, size_t offset,
+					     const void *src, size_t len) {
+		const char *from = (const char*)src;
+
+		while (len > 0) {
+			size_t in_page = offset % PAGED_PAGE;
+			size_t chunk = PAGED_PAGE - in_page < len ? PAGED_PAGE - in_page : len;
+
+			memcpy(paged_nonrt_page(region, tx, offset / PAGED_PAGE, chunk == PAGED_PAGE) + in_page,
+			       from, chunk);
+			from += chunk;
+			offset += chunk;
+			len -= chunk;
+		}
+	}
+
+	/* Publishes the unpublished map if no write interfered since
+	 * paged_nonrt_begin(), like nonrt_commit(). Returns true on success,
+	 * otherwise the caller retries from paged_nonrt_begin(). */
+	template <typename T>
+	static inline bool paged_nonrt_commit(paged_shared<T> *region, const struct transaction *tx) {
+		if (!cas_full(&region->protect.sequence, tx->start_seq, (tx->start_seq+4)^1)) {
+			stats_count(region_stats_of(&region->header), STAT_NONRT_CAS_FAILS);
+			return false;
+		}
+		stats_count(region_stats_of(&region->header), STAT_NONRT_COMMITS);
+
+		seq_wake(&region->protect);
+
+		return true;
+	}
+
+	/* Initialises a page-mapped region, the data is initialised by init_data
+	 * (or zeroed). Both maps start out with bank 0. */
+	template <typename T>
+	static int init_shared(paged_shared<T> *region, void (*init_data)(T *data) = NULL,
+			       int options = PROTECT_DEFAULT) {
+		memset(region->frames, 0, sizeof(region->frames));
+		if (init_data != NULL)
+			init_data((T*)region->frames[0]);
+
+		for (uint32_t page = 0; page < paged_shared<T>::PAGES; page++)
+			region->map[0][page] = region->map[1][page] = page;
+		region->diverged = 0;
+
+		init_header(&region->header, SYNC_PAGED, 2, sizeof(T), sizeof(paged_shared<T>), layout_hash<T>::value);
+
+		return init_protect(&region->protect, options);
+	}
+
+	template <typename T>
+	static inline int check_layout(const paged_shared<T> *region, size_t size) {
+		return check_header(&region->header, size, SYNC_PAGED, 2, sizeof(T), sizeof(paged_shared<T>),
+				    layout_hash<T>::value);
+	}
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_PAGED_H */
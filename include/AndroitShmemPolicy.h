@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_POLICY_H
+#define ANDROIT_SHMEM_POLICY_H
+
+/* Synchronisation policies: one reader/writer API over the region types,
+ * with the type chosen at compile time per region. Regions differ a lot
+ * in size and read/write ratio, so does the best scheme:
+ * 	- seqlock_policy:    shared<T>, the default. Readers retry after
+ * 	                     interfering writes, RT writers never wait for
+ * 	                     readers, non-RT writers have 2-copy transactions
+ * 	- left_right_policy: lr_shared<T>. Readers are wait-free and never
+ * 	                     retry, writers wait for the readers of the
+ * 	                     previous copy
+ * 	- rcu_policy:        nbuf_shared<T, 3>. Writers prepare a free slot of
+ * 	                     a pool and publish it with a pointer swap,
+ * 	                     readers pin the published slot
+ * 	- single_policy:     striped_shared<T, 1>. One copy written in place
+ * 	                     under a seqlock: half the memory and cache
+ * 	                     footprint of shared<T>, for regions without
+ * 	                     non-RT transactions
+ *
+ * 	typedef policy_region<my_signals, left_right_policy>::type my_region;
+ *
+ * 	struct sync_read rd;
+ * 	do {
+ * 		const my_signals *data = sync_read_begin(region, &rd);
+ * 		// copy what is needed from data
+ * 	} while (sync_read_retry(region, &rd));
+ *
+ * 	struct sync_write wr;
+ * 	my_signals *data = sync_write_begin(region, &wr);
+ * 	sync_write_mark(region, &wr, &data->value, sizeof(data->value));
+ * 	data->value = 42;
+ * 	sync_write_commit(region, &wr);
+ *
+ * Writers go through the RT path of each scheme; the scheme specific
+ * functions (e.g., non-RT transactions of shared<T>) remain available. */
+
+#include <AndroitShmem.h>
+#include <AndroitShmemLeftRight.h>
+#include <AndroitShmemNBuf.h>
+#include <AndroitShmemStriped.h>
+
+namespace androit {
+	struct seqlock_policy {};
+	struct left_right_policy {};
+	struct rcu_policy {};
+	struct single_policy {};
+
+	// Region type of data T under Policy
+	template <typename T, typename Policy = seqlock_policy>
+	struct policy_region;
+
+	template <typename T>
+	struct policy_region<T, seqlock_policy> {
+		typedef shared<T> type;
+	};
+
+	template <typename T>
+	struct policy_region<T, left_right_policy> {
+		typedef lr_shared<T> type;
+	};
+
+	template <typename T>
+	struct policy_region<T, rcu_policy> {
+		typedef nbuf_shared<T, 3> type;
+	};
+
+	template <typename T>
+	struct policy_region<T, single_policy> {
+		typedef striped_shared<T, 1> type;
+	};
+
+	// State of a read between sync_read_begin() and sync_read_retry()
+	struct sync_read {
+		seq_t seq;              // Sequence of seqlocks
+		unsigned int slot;      // Pinned slot or read indicator
+	};
+
+	// State of a write between sync_write_begin() and sync_write_commit()
+	struct sync_write {
+		unsigned int slot;      // Slot of N-buffer regions
+	};
+
+	/* Operations of the policy API for every region type, see the free
+	 * functions below */
+	template <typename Region>
+	struct sync_ops;
+
+	template <typename T>
+	struct sync_ops<shared<T> > {
+		typedef T data;
+
+		static inline const T *read_begin(const shared<T> *region, struct sync_read *rd, unsigned int spin) {
+			rd->seq = seq_begin(region, spin);
+			return &region->data[rd->seq & 1];
+		}
+
+		static inline bool read_retry(const shared<T> *region, struct sync_read *rd) {
+			return seq_doretry(region, rd->seq);
+		}
+
+		static inline T *write_begin(shared<T> *region, struct sync_write *) {
+			if (begin_rt_write(region) != 0)
+				return NULL;
+			return &region->data[region->protect.sequence & 1];
+		}
+
+		static inline void write_mark(shared<T> *region, struct sync_write *, const void *addr, size_t len) {
+			rt_mark_dirty(region, addr, len);
+		}
+
+		static inline int write_commit(shared<T> *region, struct sync_write *) {
+			return end_rt_write(region);
+		}
+	};
+
+	template <typename T>
+	struct sync_ops<lr_shared<T> > {
+		typedef T data;
+
+		static inline const T *read_begin(const lr_shared<T> *region, struct sync_read *rd, unsigned int) {
+			return lr_read_begin(region, &rd->slot);
+		}
+
+		static inline bool read_retry(const lr_shared<T> *region, struct sync_read *rd) {
+			lr_read_end(region, rd->slot);
+			return false;
+		}
+
+		static inline T *write_begin(lr_shared<T> *region, struct sync_write *) {
+			return lr_begin_write(region);
+		}
+
+		static inline void write_mark(lr_shared<T> *region, struct sync_write *, const void *addr, size_t len) {
+			lr_mark_dirty(region, addr, len);
+		}
+
+		static inline int write_commit(lr_shared<T> *region, struct sync_write *) {
+			return lr_commit(region);
+		}
+	};
+
+	template <typename T, unsigned int N>
+	struct sync_ops<nbuf_shared<T, N> > {
+		typedef T data;
+
+		static inline const T *read_begin(const nbuf_shared<T, N> *region, struct sync_read *rd, unsigned int) {
+			return nbuf_read_begin(region, &rd->slot, &rd->seq);
+		}
+
+		static inline bool read_retry(const nbuf_shared<T, N> *region, struct sync_read *rd) {
+			nbuf_read_end(region, rd->slot);
+			return false;
+		}
+
+		static inline T *write_begin(nbuf_shared<T, N> *region, struct sync_write *wr) {
+			return nbuf_begin_write(region, &wr->slot);
+		}
+
+		static inline void write_mark(nbuf_shared<T, N> *region, struct sync_write *wr, const void *addr,
+					      size_t len) {
+			nbuf_mark_dirty(region, wr->slot, addr, len);
+		}
+
+		static inline int write_commit(nbuf_shared<T, N> *region, struct sync_write *wr) {
+			return nbuf_commit(region, wr->slot);
+		}
+	};
+
+	// Striped regions as a whole: every write locks all segments
+	template <typename T, unsigned int S>
+	struct sync_ops<striped_shared<T, S> > {
+		typedef T data;
+
+		static inline const T *read_begin(const striped_shared<T, S> *region, struct sync_read *rd,
+						  unsigned int spin) {
+			rd->seq = striped_epoch_begin(region, spin);
+			return &region->data;
+		}
+
+		static inline bool read_retry(const striped_shared<T, S> *region, struct sync_read *rd) {
+			return striped_epoch_doretry(region, rd->seq);
+		}
+
+		static inline T *write_begin(striped_shared<T, S> *region, struct sync_write *) {
+			if (striped_begin_write(region, 0, S - 1) != 0)
+				return NULL;
+			return &region->data;
+		}
+
+		static inline void write_mark(striped_shared<T, S> *, struct sync_write *, const void *, size_t) {
+		}
+
+		static inline int write_commit(striped_shared<T, S> *region, struct sync_write *) {
+			return striped_end_write(region, 0, S - 1);
+		}
+	};
+
+	/* Starts a read: returns the data to read from. Seqlock policies spin
+	 * for spin iterations while a write is in progress, see seq_begin(). */
+	template <typename Region>
+	static inline const typename sync_ops<Region>::data *sync_read_begin(const Region *region, struct sync_read *rd,
+									  unsigned int spin = SEQ_SPIN_DEFAULT) {
+		return sync_ops<Region>::read_begin(region, rd, spin);
+	}
+
+	/* Ends a read. Returns true if a write interfered and the read must be
+	 * repeated from sync_read_begin(); policies whose readers never retry
+	 * always return false. */
+	template <typename Region>
+	static inline bool sync_read_retry(const Region *region, struct sync_read *rd) {
+		return sync_ops<Region>::read_retry(region, rd);
+	}
+
+	/* Locks out other writers and returns the data to modify, NULL if the
+	 * writer lock could not be taken (or, for N-buffer regions, no slot was
+	 * free, see nbuf_begin_write()) */
+	template <typename Region>
+	static inline typename sync_ops<Region>::data *sync_write_begin(Region *region, struct sync_write *wr) {
+		return sync_ops<Region>::write_begin(region, wr);
+	}
+
+	// Announces a modification of [addr, addr + len), before it is made
+	template <typename Region>
+	static inline void sync_write_mark(Region *region, struct sync_write *wr, const void *addr, size_t len) {
+		sync_ops<Region>::write_mark(region, wr, addr, len);
+	}
+
+	// Publishes the modifications and lets in the next writer
+	template <typename Region>
+	static inline int sync_write_commit(Region *region, struct sync_write *wr) {
+		return sync_ops<Region>::write_commit(region, wr);
+	}
+
+	/* Copies len bytes at offset of the data into dst, consistently. Returns
+	 * the sequence of seqlock policies, 0 for the others. */
+	template <typename Region>
+	static inline seq_t sync_copy(const Region *region, size_t offset, void *dst, size_t len,
+				      unsigned int spin = SEQ_SPIN_DEFAULT) {
+		struct sync_read rd;
+
+		rd.seq = 0;
+		do {
+			memcpy(dst, (const char*)sync_read_begin(region, &rd, spin) + offset, len);
+		} while (sync_read_retry(region, &rd));
+
+		return rd.seq;
+	}
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_POLICY_H */
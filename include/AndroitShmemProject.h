@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_PROJECT_H
+#define ANDROIT_SHMEM_PROJECT_H
+
+/* Projection reads: a list of fields and ranges of arrays of a seqlock
+ * region, copied back to back into a buffer of the caller between a single
+ * seq_begin() and seq_doretry(). Readers that work on the values compute
+ * on their copy: the retry window only covers the copy, and only the bytes
+ * they need are read.
+ *
+ * The list is checked once with projection_size(), seq_project() then
+ * trusts it. Ranges are copied with project_copy(): fields of up to 16
+ * bytes inline with two overlapping loads and stores, longer ranges with
+ * memcpy(). The C libraries pick a vectorised memcpy() for the CPU at run
+ * time (SSE2/AVX2/AVX-512 or ERMS on x86, NEON on ARM); a kernel of our
+ * own was slower for ranges beyond a few hundred bytes. */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <AndroitShmem.h>
+
+namespace androit {
+	enum {
+		// Ranges of a projection at most, bounds the lists of JNI callers on the stack
+		PROJECTION_MAX = 64
+	};
+
+	// A range of the data, same layout as the offset/length pairs of SharedMem.readProjection()
+	struct projection {
+		uint32_t offset;
+		uint32_t len;
+	};
+
+	/* Copies len bytes from src to dst. Ranges of up to 16 bytes (the fields)
+	 * take no call: two loads and stores of the largest power of 2 that
+	 * fits, overlapping in the middle. */
+	static inline void project_copy(void *dst, const void *src, size_t len) {
+		char *d = (char*)dst;
+		const char *s = (const char*)src;
+
+		if (len >= 8 && len <= 16) {
+			uint64_t head, tail;
+
+			memcpy(&head, s, 8);
+			memcpy(&tail, s + len - 8, 8);
+			memcpy(d, &head, 8);
+			memcpy(d + len - 8, &tail, 8);
+		} else if (len >= 4 && len < 8) {
+			uint32_t head, tail;
+
+			memcpy(&head, s, 4);
+			memcpy(&tail, s + len - 4, 4);
+			memcpy(d, &head, 4);
+			memcpy(d + len - 4, &tail, 4);
+		} else if (len < 4) {
+			for (size_t i = 0; i < len; i++)
+				d[i] = s[i];
+		} else {
+			memcpy(d, s, len);
+		}
+	}
+
+	/* Checks that the count ranges of list lie inside data_size bytes of
+	 * data. Returns the bytes seq_project() copies or -EINVAL. */
+	static inline ssize_t projection_size(const struct projection *list, unsigned int count, size_t data_size) {
+		size_t total = 0;
+
+		if (count > PROJECTION_MAX)
+			return -EINVAL;
+
+		for (unsigned int i = 0; i < count; i++) {
+			if (list[i].offset > data_size || list[i].len > data_size - list[i].offset)
+				return -EINVAL;
+			total += list[i].len;
+		}
+
+		return total;
+	}
+
+	/* Copies the count ranges of list back to back into dst, consistently:
+	 * all of them between one seq_begin() and seq_doretry(), retried as a
+	 * whole. list must be checked by projection_size(), dst hold the size
+	 * it returned. Returns the sequence the copy is valid at. */
+	template <typename T>
+	static inline seq_t seq_project(const shared<T> *region, const struct projection *list, unsigned int count,
+					void *dst, unsigned int spin = SEQ_SPIN_DEFAULT) {
+		const char *data;
+		char *pos;
+		seq_t start_seq;
+
+		do {
+			start_seq = seq_begin(region, spin);
+			data = (const char*)&region->data[start_seq & 1];
+
+			pos = (char*)dst;
+			for (unsigned int i = 0; i < count; i++) {
+				project_copy(pos, data + list[i].offset, list[i].len);
+				pos += list[i].len;
+			}
+		} while (seq_doretry(region, start_seq));
+
+		return start_seq;
+	}
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_PROJECT_H */
@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_REGISTRY_H
+#define ANDROIT_SHMEM_REGISTRY_H
+
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <AndroitShmem.h>
+#include <AndroitShmemApply.h>
+#include <AndroitShmemBacking.h>
+#include <AndroitShmemChannel.h>
+#include <AndroitShmemCheckpoint.h>
+#include <AndroitShmemCombine.h>
+#include <AndroitShmemHistory.h>
+#include <AndroitShmemLeftRight.h>
+#include <AndroitShmemNBuf.h>
+#include <AndroitShmemPaged.h>
+#include <AndroitShmemStriped.h>
+#include <AndroitShmemLog.h>
+
+namespace androit {
+	// A region created by the server
+	struct region_entry {
+		std::string name;
+		int fd;      // Backing file descriptor, handed out to clients
+		void *base;  // Mapping in the server
+		size_t size;
+		/* Copies the data out consistently, see region_snapshot(). NULL for
+		 * channels and histories, which are not checkpointed. */
+		seq_t (*snapshot)(const void *region, void *dst);
+		size_t data_size;
+		uint32_t hash;
+		// Sequence of the last checkpoint written, valid if checkpointed
+		seq_t checkpoint_seq;
+		bool checkpointed;
+	};
+
+	// An apply queue and the region its drain thread applies it to
+	struct apply_drain {
+		struct apply_queue *queue;
+		void *region;           // shared<T> the batches are for
+		struct history *history; // Records the drained commits, may be NULL
+		// apply_commit() for the type of region
+		int (*commit)(void *region, struct apply_queue *queue, struct history *history);
+		const bool *stop;       // Set by the registry to stop the drain thread
+		pthread_t thread;
+	};
+
+	/* Registry of the named regions served by AndroitShmemService. Every
+	 * region is a mapping of its own: a file in /mnt/shm on Android, POSIX
+	 * shared memory (or an anonymous memfd) elsewhere. Regions are added
+	 * before the registry is published; lookups afterwards are read-only
+	 * and need no locking. */
+	class RegionRegistry {
+	public:
+		/* anonymous: back regions by memfds instead of named POSIX shared
+		 * memory, they are then only reachable through the transport. */
+		RegionRegistry(bool anonymous = false);
+		~RegionRegistry();
+
+		/* Creates region name holding a shared<T>, data is initialised by
+		 * init_data. The region gets a statistics page (see
+		 * AndroitShmemStats.h). Returns 0 on success, -errno otherwise. */
+		template <typename T>
+		int add(const char *name, void (*init_data)(T *data) = NULL) {
+			return addRegion<shared<T> >(name, init_data, true);
+		}
+
+		// Like add(), but the region holds an nbuf_shared<T, N>
+		template <typename T, unsigned int N>
+		int addNBuf(const char *name, void (*init_data)(T *data) = NULL) {
+			return addRegion<nbuf_shared<T, N> >(name, init_data);
+		}
+
+		// Like add(), but the region holds a striped_shared<T, S>
+		template <typename T, unsigned int S>
+		int addStriped(const char *name, void (*init_data)(T *data) = NULL) {
+			return addRegion<striped_shared<T, S> >(name, init_data);
+		}
+
+		// Like add(), but the region holds an lr_shared<T>
+		template <typename T>
+		int addLeftRight(const char *name, void (*init_data)(T *data) = NULL) {
+			return addRegion<lr_shared<T> >(name, init_data);
+		}
+
+		// Like add(), but the region holds a paged_shared<T>
+		template <typename T>
+		int addPaged(const char *name, void (*init_data)(T *data) = NULL) {
+			return addRegion<paged_shared<T> >(name, init_data);
+		}
+
+		/* Creates channel name with capacity slots (a power of 2) for
+		 * messages of up to msg_size bytes. Returns 0 on success, -errno
+		 * otherwise. */
+		int addChannel(const char *name, unsigned int capacity, size_t msg_size,
+			       enum channel_policy policy, bool multi_producer);
+
+		/* Creates history name of the last capacity versions of a
+		 * shared<T>, see AndroitShmemHistory.h. Returns 0 on success, -errno
+		 * otherwise. */
+		template <typename T>
+		int addHistory(const char *name, unsigned int capacity) {
+			return addHistory(name, capacity, sizeof(T), layout_hash<T>::value);
+		}
+
+		/* Creates apply queue name with capacity slots (a power of 2) for
+		 * the delegated batches of up to batch_size bytes of the shared<T>
+		 * region, see AndroitShmemApply.h. Their commits are recorded into
+		 * history, if it is not NULL. startApply() starts its drain thread.
+		 * Returns 0 on success, -errno otherwise. */
+		template <typename T>
+		int addApplyQueue(const char *name, const char *region, unsigned int capacity, size_t batch_size,
+				  const char *history = NULL) {
+			const region_entry *target = find(region), *h = history != NULL ? find(history) : NULL;
+			struct apply_drain drain;
+			int ret;
+
+			if (target == NULL || check_layout((const shared<T>*)target->base, target->size) != 0 ||
+			    (history != NULL && (h == NULL || check_history<T>((const struct history*)h->base, h->size) != 0))) {
+				LOGE("Apply queue %s needs the shared region %s%s%s", name, region,
+				     history != NULL ? " and the history " : "", history != NULL ? history : "");
+				return -EINVAL;
+			}
+
+			ret = addApplyQueue(name, capacity, batch_size, sizeof(T), layout_hash<T>::value);
+			if (ret != 0)
+				return ret;
+
+			drain.queue = (struct apply_queue*)find(name)->base;
+			drain.region = target->base;
+			drain.history = h != NULL ? (struct history*)h->base : NULL;
+			drain.commit = commitOf<T>;
+			drain.stop = &applyStop;
+			drains.push_back(drain);
+			return 0;
+		}
+
+		/* Creates combiner name with capacity slots for the RT writes of up
+		 * to batch_size bytes of a shared<T>, see AndroitShmemCombine.h.
+		 * Returns 0 on success, -errno otherwise. */
+		template <typename T>
+		int addCombiner(const char *name, unsigned int capacity, size_t batch_size) {
+			return addCombiner(name, capacity, batch_size, sizeof(T), layout_hash<T>::value);
+		}
+
+		/* Starts a thread per apply queue that applies the delegated batches
+		 * as soon as they arrive. Returns 0 or -errno. */
+		int startApply();
+
+		/* Keeps checkpoints of the data regions in directory dir (see
+		 * AndroitShmemCheckpoint.h): regions added from now on start with
+		 * the data of their last checkpoint, if it matches their layout,
+		 * and startCheckpoints() writes new ones every period_s seconds. */
+		void setCheckpoints(const char *dir, unsigned int period_s) {
+			checkpointDir = dir;
+			checkpointPeriod = period_s;
+		}
+
+		/* Writes a checkpoint of every data region that changed since its
+		 * last one. Returns the number of checkpoints written, -errno if
+		 * one failed. */
+		int checkpoint();
+
+		/* Starts a thread taking checkpoints periodically, see
+		 * setCheckpoints(). Returns 0 or -errno. */
+		int startCheckpoints();
+
+		/* Sets the backing of the regions added from now on, see
+		 * AndroitShmemBacking.h. Regions are prefaulted 4 KB pages by
+		 * default. */
+		void setBacking(const struct region_backing &backing) {
+			this->backing = backing;
+		}
+
+		// Returns the region registered under name, NULL if there is none
+		const region_entry *find(const char *name) const;
+
+	private:
+		template <typename Region, typename T>
+		int addRegion(const char *name, void (*init_data)(T *data), bool stats = false) {
+			size_t size = stats ? stats_offset_for(sizeof(Region)) + sizeof(struct region_stats) : sizeof(Region);
+			region_entry *entry;
+
+			if (find(name) != NULL) {
+				LOGE("Region %s is already registered", name);
+				return -EEXIST;
+			}
+
+			entry = create(name, size);
+			if (entry == NULL)
+				return -ENOMEM;
+
+			// use allocated "raw" memory as Region
+			if (init_shared((Region*)entry->base, init_data) != 0) {
+				LOGE("Concurrency protections of region %s could not be initialised correctly", name);
+				destroy(entry);
+				return -EINVAL;
+			}
+
+			if (stats) {
+				struct region_header *header = &((Region*)entry->base)->header;
+
+				init_stats((struct region_stats*)((char*)entry->base + stats_offset_for(sizeof(Region))));
+				header->stats_offset = stats_offset_for(sizeof(Region));
+			}
+
+			entry->snapshot = snapshotOf<Region>;
+			entry->data_size = sizeof(T);
+			entry->hash = layout_hash<T>::value;
+			if (!checkpointDir.empty()) {
+				std::vector<char> data(sizeof(T));
+
+				// The region is not published yet, nobody attaches: the data is replaced in place
+				if (readCheckpoint(entry, &data[0]))
+					region_restore((Region*)entry->base, &data[0]);
+			}
+
+			/* Direct attachers see the file from create() on, but only use
+			 * the region once it is set up completely */
+			publish_header(&((Region*)entry->base)->header);
+
+			LOGD("Region %s (%zu bytes) registered", name, entry->size);
+			return 0;
+		}
+
+		template <typename Region>
+		static seq_t snapshotOf(const void *region, void *dst) {
+			return region_snapshot((const Region*)region, dst);
+		}
+
+		template <typename T>
+		static int commitOf(void *region, struct apply_queue *queue, struct history *history) {
+			return apply_commit((shared<T>*)region, queue, history);
+		}
+
+		int addHistory(const char *name, unsigned int capacity, size_t data_size, uint32_t hash);
+		int addApplyQueue(const char *name, unsigned int capacity, size_t batch_size, size_t data_size,
+				  uint32_t hash);
+		int addCombiner(const char *name, unsigned int capacity, size_t batch_size, size_t data_size,
+				uint32_t hash);
+		region_entry *create(const char *name, size_t size);
+		void destroy(region_entry *entry);
+		bool readCheckpoint(region_entry *entry, void *data);
+		static void *checkpointLoop(void *arg);
+		static void *applyLoop(void *arg);
+
+		std::map<std::string, region_entry> regions;
+		struct region_backing backing;
+		bool anonymous;
+
+		std::string checkpointDir;
+		unsigned int checkpointPeriod;
+		// Serialises checkpoint(), guards checkpointStop
+		pthread_mutex_t checkpointLock;
+		pthread_cond_t checkpointCond;
+		pthread_t checkpointThread;
+		bool checkpointRunning;
+		bool checkpointStop;
+
+		std::list<struct apply_drain> drains;
+		bool applyRunning;
+		// Set to stop the drain threads, which check it between their waits
+		bool applyStop;
+	};
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_REGISTRY_H */
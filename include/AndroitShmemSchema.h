@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_SCHEMA_H
+#define ANDROIT_SHMEM_SCHEMA_H
+
+#include <stdint.h>
+
+namespace androit {
+	/* Layout hash of the data type of a region, recorded in the region header
+	 * and checked when clients attach. Types generated from a schema (see
+	 * tools/shmemgen.py) specialise this, all others have hash 0, which only
+	 * matches 0. */
+	template <typename T>
+	struct layout_hash {
+		static const uint32_t value = 0;
+	};
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_SCHEMA_H */
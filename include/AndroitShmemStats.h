@@ -0,0 +1,184 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_STATS_H
+#define ANDROIT_SHMEM_STATS_H
+
+/* Statistics pages: counters of the operations on a region, in pages of
+ * their own behind the region in the same mapping (region_header.
+ * stats_offset, 0 if a region has none). The synchronisation functions
+ * count into the page of the region they operate on, AndroitShmemStat
+ * dumps the pages of a running service.
+ *
+ * Counters are kept per CPU: every slot only takes the increments of the
+ * tasks running on its CPU, so counting does not make the cache lines of
+ * the counters bounce between CPUs. Increments are atomic nevertheless,
+ * a task may migrate or be preempted by another one on the same CPU.
+ * Durations are counted in histograms of power-of-2 buckets of
+ * nanoseconds.
+ *
+ * The hot paths only pay for what is cheap: writes are counted, reads only
+ * when they spin, sleep or retry, so an uncontended reader stores nothing.
+ * Lock wait and hold times take clock_gettime() calls per write and are
+ * only recorded while region_stats.timing is set (AndroitShmemStat -t).
+ * Define ANDROIT_SHMEM_NO_STATS to compile counting out. */
+
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <AndroitShmemAtomic.h>
+
+namespace androit {
+	enum {
+		// Slots of a statistics page, CPUs share slots beyond
+		STATS_CPUS = 64,
+		// Bucket b counts durations of [2^(b-1), 2^b) ns, the last one all longer ones
+		STATS_BUCKETS = 32
+	};
+
+	// Counters of a region
+	enum stats_counter {
+		STAT_RT_WRITES,         // end_rt_write()
+		STAT_NONRT_WRITES,      // end_nonrt_write()
+		STAT_NONRT_COMMITS,     // Successful nonrt_commit()
+		STAT_NONRT_CAS_FAILS,   // nonrt_commit() an RT write interfered with
+		STAT_READ_RETRIES,      // seq_doretry() returning true
+		STAT_READ_SPINS,        // Iterations seq_begin() spun for an RT write
+		STAT_READ_SLEEPS,       // Times seq_begin() slept for an RT write
+		STAT_NONRT_DELEGATED,   // Non-RT batches handed to an apply queue
+		STAT_APPLIED,           // Delegated batches applied by RT writes
+		STAT_RT_COMBINED,       // Batches of combining RT writers, applied by any of them
+		STAT_COUNTERS
+	};
+
+	// Duration histograms of a region, only kept while timing is set
+	enum stats_histogram {
+		STAT_RT_LOCK_WAIT,      // begin_rt_write() until rt_wlock is taken
+		STAT_RT_LOCK_HOLD,      // rt_wlock taken until end_rt_write()
+		STAT_NONRT_LOCK_WAIT,   // begin_nonrt_write() until nonrt_wlock is taken
+		STAT_NONRT_LOCK_HOLD,   // nonrt_wlock taken until end_nonrt_write()
+		STAT_HISTOGRAMS
+	};
+
+	// Counters of the tasks of one CPU
+	struct stats_slot {
+		alignas(64) uint64_t counters[STAT_COUNTERS];
+		uint32_t histograms[STAT_HISTOGRAMS][STATS_BUCKETS];
+	};
+
+	struct region_stats {
+		// Nonzero: lock wait and hold times are recorded, off by default
+		alignas(64) uint32_t timing;
+		// Start of the current lock holders, only written by them while timing is set
+		uint64_t rt_locked_ns;
+		uint64_t nonrt_locked_ns;
+		struct stats_slot slots[STATS_CPUS];
+	};
+
+	static inline uint64_t stats_now(void) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+
+	// Returns the slot of the calling task
+	static inline struct stats_slot *stats_slot_of(const struct region_stats *stats) {
+		int cpu = sched_getcpu();
+
+		return const_cast<struct stats_slot*>(&stats->slots[(cpu < 0 ? 0 : cpu) % STATS_CPUS]);
+	}
+
+	// Returns the histogram bucket of a duration of ns nanoseconds
+	static inline unsigned int stats_bucket(uint64_t ns) {
+		unsigned int bucket = ns == 0 ? 0 : 64 - __builtin_clzll(ns);
+
+		return bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1;
+	}
+
+#ifndef ANDROIT_SHMEM_NO_STATS
+	/* Counters are only summed up by readers of the page, nothing else is
+	 * ordered by them: relaxed increments, no barriers on the hot paths. */
+	static inline void stats_count(const struct region_stats *stats, enum stats_counter counter,
+				       uint64_t n = 1) {
+		if (stats != NULL)
+			add_relaxed(&stats_slot_of(stats)->counters[counter], n);
+	}
+
+	static inline void stats_record(const struct region_stats *stats, enum stats_histogram histogram,
+					uint64_t ns) {
+		if (stats != NULL)
+			add_relaxed(&stats_slot_of(stats)->histograms[histogram][stats_bucket(ns)], 1U);
+	}
+
+	// Returns true if lock times are recorded into stats
+	static inline bool stats_timing(const struct region_stats *stats) {
+		return stats != NULL && load_relaxed(&stats->timing) != 0;
+	}
+
+	// Returns the current time if lock times are recorded, 0 otherwise
+	static inline uint64_t stats_start(const struct region_stats *stats) {
+		return stats_timing(stats) ? stats_now() : 0;
+	}
+
+	/* Counts a write, with one slot lookup. Its writer took its lock at
+	 * locked_ns, 0 if lock times were not recorded then. */
+	static inline void stats_write_done(const struct region_stats *stats, enum stats_counter counter,
+					    enum stats_histogram histogram, uint64_t locked_ns) {
+		struct stats_slot *slot;
+
+		if (stats == NULL)
+			return;
+
+		slot = stats_slot_of(stats);
+		add_relaxed(&slot->counters[counter], (uint64_t)1);
+		if (locked_ns != 0)
+			add_relaxed(&slot->histograms[histogram][stats_bucket(stats_now() - locked_ns)], 1U);
+	}
+#else
+	static inline bool stats_timing(const struct region_stats *) { return false; }
+	static inline void stats_count(const struct region_stats *, enum stats_counter, uint64_t = 1) {}
+	static inline void stats_record(const struct region_stats *, enum stats_histogram, uint64_t) {}
+	static inline uint64_t stats_start(const struct region_stats *) { return 0; }
+	static inline void stats_write_done(const struct region_stats *, enum stats_counter,
+					    enum stats_histogram, uint64_t) {}
+#endif
+
+	static inline void init_stats(struct region_stats *stats) {
+		memset(stats, 0, sizeof(*stats));
+	}
+
+	// Sums the slots of stats into total (slot layout, CPU independent)
+	static inline void stats_sum(const struct region_stats *stats, struct stats_slot *total) {
+		memset(total, 0, sizeof(*total));
+
+		for (unsigned int cpu = 0; cpu < STATS_CPUS; cpu++) {
+			const struct stats_slot *slot = &stats->slots[cpu];
+
+			for (unsigned int c = 0; c < STAT_COUNTERS; c++)
+				total->counters[c] += load_relaxed(&slot->counters[c]);
+			for (unsigned int h = 0; h < STAT_HISTOGRAMS; h++)
+				for (unsigned int b = 0; b < STATS_BUCKETS; b++)
+					total->histograms[h][b] += load_relaxed(&slot->histograms[h][b]);
+		}
+	}
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_STATS_H */
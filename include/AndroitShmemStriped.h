@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_STRIPED_H
+#define ANDROIT_SHMEM_STRIPED_H
+
+/* Striped regions (SYNC_STRIPED): the data of a region is split into S
+ * segments of consecutive bytes, each protected by a seqlock of its own
+ * (a struct protect). Writers lock only the segments they modify, so RT
+ * writers updating disjoint segments run in parallel and readers of one
+ * segment are not made to retry by writes to other segments.
+ *
+ * There is a single data copy that writers (RT and non-RT alike) modify in
+ * place; non-RT writers hold a segment lock as long as their update, there
+ * are no transactions.
+ *
+ * The epoch of a region is the sum of all segment sequences. Sequences only
+ * increase, so the epoch changes whenever any segment does, without writers
+ * ever sharing a cache line. Readers that need a consistent snapshot of the
+ * whole region use striped_epoch_begin() and striped_epoch_doretry(). */
+
+#include <AndroitShmem.h>
+#include <AndroitShmemWait.h>
+
+namespace androit {
+	enum {
+		SEGMENTS_MAX = 64
+	};
+
+	template <typename T, unsigned int S>
+	struct striped_shared {
+		static_assert(S >= 1 && S <= SEGMENTS_MAX, "striped regions have 1 to 64 segments");
+		static_assert(std::is_class<T>::value, "region data must be a struct");
+
+		enum {
+			// Bytes of T per segment, whole blocks so that segments do not share cache lines
+			SEGMENT_SIZE = ((sizeof(T) + S - 1) / S + DIRTY_BLOCK - 1) / DIRTY_BLOCK * DIRTY_BLOCK
+		};
+
+		struct region_header header;
+		/* Seqlock of every segment. rt_wlock serialises the writers of a
+		 * segment, nonrt_wlock and synced are unused. */
+		struct protect segments[S];
+		data_copy<T> data;
+	};
+
+	// Returns the segment holding byte offset of the data
+	template <typename T, unsigned int S>
+	static inline unsigned int striped_segment_at(size_t offset) {
+		return offset / striped_shared<T, S>::SEGMENT_SIZE;
+	}
+
+	// Returns the segment holding addr, which lies inside the data of region
+	template <typename T, unsigned int S>
+	static inline unsigned int striped_segment(const striped_shared<T, S> *region, const void *addr) {
+		return striped_segment_at<T, S>((const char*)addr - (const char*)&region->data);
+	}
+
+	///////////////////////////////////////////////////////////////////
+	// Writers
+	/* Repairs a segment whose writer died holding its rt_wlock, which the
+	 * caller now holds (EOWNERDEAD). Segments have a single copy, so a write
+	 * that did not finish cannot be rolled back: its 2-bit is cleared and
+	 * protect->torn records the sequence the partial write is visible at. */
+	static void striped_recover_segment(struct protect *protect) {
+		protect->dead_writers++;
+		if (protect->sequence & 2) {
+			protect->torn = protect->sequence + 2;
+			add_full(&protect->sequence, (seq_t)2);
+			seq_wake(protect);
+		}
+		lock_recovered(&protect->rt_wlock);
+	}
+
+	/* Locks segments first .. last (in this order, so writers of overlapping
+	 * ranges cannot deadlock) and marks them as being written. Returns 0 or
+	 * the error of pthread_mutex_lock(), in which case nothing is locked. */
+	template <typename T, unsigned int S>
+	static inline int striped_begin_write(striped_shared<T, S> *region, unsigned int first, unsigned int last) {
+		int ret;
+
+		for (unsigned int seg = first; seg <= last; seg++) {
+			ret = pthread_mutex_lock(&region->segments[seg].rt_wlock);
+			if (ret == EOWNERDEAD) {
+				striped_recover_segment(&region->segments[seg]);
+				ret = 0;
+			}
+			if (ret) {
+				while (seg-- > first)
+					pthread_mutex_unlock(&region->segments[seg].rt_wlock);
+				return ret;
+			}
+		}
+
+		// Set 2-bit of every segment before any of them is modified, see begin_rt_write()
+		for (unsigned int seg = first; seg <= last; seg++)
+			add_relaxed(&region->segments[seg].sequence, (seq_t)2);
+		fence_release();
+
+		return 0;
+	}
+
+	// Finishes a write of segments first .. last, see end_rt_write()
+	template <typename T, unsigned int S>
+	static inline int striped_end_write(striped_shared<T, S> *region, unsigned int first, unsigned int last) {
+		int ret = 0, result;
+
+		for (unsigned int seg = first; seg <= last; seg++)
+			add_full(&region->segments[seg].sequence, (seq_t)2);
+
+		for (unsigned int seg = last + 1; seg-- > first;) {
+			struct protect *protect = &region->segments[seg];
+
+			result = pthread_mutex_unlock(&protect->rt_wlock);
+			if (result != 0)
+				ret = result;
+			seq_wake(protect);
+		}
+
+		return ret;
+	}
+
+	///////////////////////////////////////////////////////////////////
+	// Readers of a single segment
+	// Waits for writes of segment seg to finish, returns its sequence, see seq_begin()
+	template <typename T, unsigned int S>
+	static inline seq_t striped_seq_begin(const striped_shared<T, S> *region, unsigned int seg,
+					      unsigned int spin = SEQ_SPIN_DEFAULT) {
+		static const struct timespec recover_timeout = { 0, SEQ_RECOVER_MS * 1000000L };
+		const struct protect *protect = &region->segments[seg];
+		seq_t sequence = load_acquire(&protect->sequence);
+
+		while (sequence & 2) {
+			if (spin > 0) {
+				if (spin != SEQ_SPIN_FOREVER)
+					spin--;
+				cpu_relax();
+			} else if (seq_wait(protect, sequence, &recover_timeout) == -ETIMEDOUT &&
+				   load_relaxed(&protect->sequence) == sequence) {
+				// The writer may have died, see seq_try_recover()
+				struct protect *p = const_cast<struct protect*>(protect);
+
+				if (pthread_mutex_trylock(&p->rt_wlock) == EOWNERDEAD) {
+					striped_recover_segment(p);
+					pthread_mutex_unlock(&p->rt_wlock);
+				}
+			}
+			sequence = load_acquire(&protect->sequence);
+		}
+
+		return sequence;
+	}
+
+	// Returns true if segment seg was written since striped_seq_begin() returned start
+	template <typename T, unsigned int S>
+	static inline bool striped_seq_doretry(const striped_shared<T, S> *region, unsigned int seg,
+					       seq_t start) {
+		fence_acquire();
+		return load_relaxed(&region->segments[seg].sequence) != start;
+	}
+
+	///////////////////////////////////////////////////////////////////
+	// Readers of the whole region
+	// Returns the epoch of region, without waiting for writes in progress
+	template <typename T, unsigned int S>
+	static inline seq_t striped_epoch(const striped_shared<T, S> *region) {
+		seq_t epoch = 0;
+
+		for (unsigned int seg = 0; seg < S; seg++)
+			epoch += load_relaxed(&region->segments[seg].sequence);
+
+		return epoch;
+	}
+
+	/* Waits until no segment is being written and returns the epoch. The
+	 * data read afterwards is a consistent snapshot of the whole region if
+	 * striped_epoch_doretry() returns false. */
+	template <typename T, unsigned int S>
+	static inline seq_t striped_epoch_begin(const striped_shared<T, S> *region,
+						unsigned int spin = SEQ_SPIN_DEFAULT) {
+		seq_t epoch = 0;
+
+		for (unsigned int seg = 0; seg < S; seg++)
+			epoch += striped_seq_begin(region, seg, spin);
+
+		return epoch;
+	}
+
+	/* Returns true if any segment was written since striped_epoch_begin()
+	 * returned start. Every write increases a sequence, so the epoch differs
+	 * unless 2^64 sequence steps happened in between. */
+	template <typename T, unsigned int S>
+	static inline bool striped_epoch_doretry(const striped_shared<T, S> *region, seq_t start) {
+		fence_acquire();
+		return striped_epoch(region) != start;
+	}
+
+	// Prepares waiting on segment seg of region with wait_for_updates()
+	template <typename T, unsigned int S>
+	static inline void striped_update_wait_init(struct update_wait *wait, const striped_shared<T, S> *region,
+						    unsigned int seg, seq_t seq) {
+		wait->protect = &region->segments[seg];
+		wait->seq = seq;
+		wait->updated = false;
+	}
+
+	// Initialises a striped region, the data is initialised by init_data (or zeroed)
+	template <typename T, unsigned int S>
+	static int init_shared(striped_shared<T, S> *region, void (*init_data)(T *data) = NULL) {
+		int result;
+
+		memset(&region->data, 0, sizeof(T));
+		if (init_data != NULL)
+			init_data(&region->data);
+
+		init_header(&region->header, SYNC_STRIPED, 1, sizeof(T), sizeof(striped_shared<T, S>),
+			    layout_hash<T>::value);
+
+		for (unsigned int seg = 0; seg < S; seg++) {
+			result = init_protect(&region->segments[seg]);
+			if (result != 0)
+				return result;
+		}
+
+		return 0;
+	}
+
+	template <typename T, unsigned int S>
+	static inline int check_layout(const striped_shared<T, S> *region, size_t size) {
+		return check_header(&region->header, size, SYNC_STRIPED, 1, sizeof(T), sizeof(striped_shared<T, S>),
+				    layout_hash<T>::value);
+	}
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_STRIPED_H */
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_TRANSPORT_H
+#define ANDROIT_SHMEM_TRANSPORT_H
+
+#include <stddef.h>
+#include <AndroitShmem.h>
+#include <AndroitShmemApply.h>
+#include <AndroitShmemChannel.h>
+#include <AndroitShmemCombine.h>
+#include <AndroitShmemHistory.h>
+#include <AndroitShmemLeftRight.h>
+#include <AndroitShmemNBuf.h>
+#include <AndroitShmemPaged.h>
+#include <AndroitShmemStriped.h>
+#include <AndroitShmemLog.h>
+
+/* Transports hand the regions of AndroitShmemService out to clients. Every
+ * build links exactly one backend:
+ * 	- BinderTransport.cc: ServiceManager + IAndroitShmem (Android)
+ * 	- PosixTransport.cc: POSIX shm/memfd, passed over a Unix socket (Linux) */
+
+namespace androit {
+	class RegionRegistry;
+
+	// Client side of a transport
+	class Transport {
+	public:
+		virtual ~Transport() {}
+
+		/* Maps region name into the address space of the caller and returns
+		 * its base address, or NULL if the region is not available. The size
+		 * of the mapping is stored in *size. Regions are mapped only once per
+		 * process, attaching again returns the same address. */
+		virtual void *attach(const char *name, size_t *size) = 0;
+
+		// Returns the transport of this build
+		static Transport *get();
+	};
+
+	// Server side of a transport
+	class TransportServer {
+	public:
+		virtual ~TransportServer() {}
+
+		/* Starts serving the regions of registry to clients. Requests are
+		 * handled by threads of the transport, publish() returns once the
+		 * service is reachable. Returns 0 on success, -errno otherwise. */
+		virtual int publish(RegionRegistry *registry) = 0;
+
+		// Returns the transport server of this build
+		static TransportServer *get();
+	};
+
+	/* Attaches to name and returns it as Object if check (check_layout(),
+	 * check_history<T>(), ...) accepts the mapping, NULL otherwise. kind
+	 * names the object in the log. */
+	template <typename Object>
+	static inline Object *attachChecked(const char *name, const char *kind,
+					    int (*check)(const Object *object, size_t size)) {
+		size_t size = 0;
+		void *base = Transport::get()->attach(name, &size);
+		int ret;
+
+		if (base == NULL)
+			return NULL;
+
+		ret = check((const Object*)base, size);
+		if (ret != 0) {
+			LOGE("Layout of %s %s does not match this client: %d (%s)", kind, name, -ret, strerror(-ret));
+			return NULL;
+		}
+
+		return (Object*)base;
+	}
+
+	/* Returns region name as Region (shared<T>, nbuf_shared<T, N>,
+	 * striped_shared<T, S>, paged_shared<T> or lr_shared<T>), or NULL if
+	 * the region does not exist or was
+	 * set up with another layout, i.e., client and server disagree on the
+	 * region type or were built from different versions. */
+	template <typename Region>
+	static inline Region *getRegionAs(const char *name) {
+		return attachChecked<Region>(name, "region", check_layout);
+	}
+
+	// Returns region name as shared<T>, see getRegionAs()
+	template <typename T>
+	static inline shared<T> *getRegion(const char *name) {
+		return getRegionAs<shared<T> >(name);
+	}
+
+	// Returns channel name, or NULL if it does not exist or has another layout
+	static inline struct channel *getChannel(const char *name) {
+		return attachChecked<struct channel>(name, "channel", check_channel);
+	}
+
+	/* Returns history name of the versions of a shared<T>, or NULL if it
+	 * does not exist or has another layout */
+	template <typename T>
+	static inline struct history *getHistory(const char *name) {
+		return attachChecked<struct history>(name, "history", check_history<T>);
+	}
+
+	/* Returns apply queue name of a shared<T>, or NULL if it does not exist
+	 * or has another layout */
+	template <typename T>
+	static inline struct apply_queue *getApplyQueue(const char *name) {
+		return attachChecked<struct apply_queue>(name, "apply queue", check_apply_queue<T>);
+	}
+
+	/* Returns combiner name of a shared<T>, or NULL if it does not exist or
+	 * has another layout */
+	template <typename T>
+	static inline struct combiner *getCombiner(const char *name) {
+		return attachChecked<struct combiner>(name, "combiner", check_combiner<T>);
+	}
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_TRANSPORT_H */
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROIT_SHMEM_WAIT_H
+#define ANDROIT_SHMEM_WAIT_H
+
+/* Change subscription: consumers block until the sequence of a region
+ * advances instead of polling it. Waiters sleep on the sequence word and
+ * are woken by the commits of RT writers (end_rt_write()) and non-RT
+ * writers (nonrt_commit()). A waiter always returns the latest sequence,
+ * so a burst of commits during its wakeup is coalesced into one update. */
+
+#include <errno.h>
+#include <time.h>
+
+#include <AndroitShmem.h>
+#include <AndroitShmemFutex.h>
+
+namespace androit {
+	// Largest number of regions wait_for_updates() waits on (futex_waitv limit)
+	enum {
+		UPDATE_WAIT_MAX = 128
+	};
+
+	// A region wait_for_updates() waits on
+	struct update_wait {
+		const struct protect *protect;
+		seq_t seq;          // In: last sequence seen, out: current sequence
+		bool updated;       // Out: the region was updated
+	};
+
+	// Returns true if sequence denotes a finished commit after last
+	static inline bool seq_updated(seq_t sequence, seq_t last) {
+		return !(sequence & 2) && sequence != last;
+	}
+
+	// Sets deadline (CLOCK_MONOTONIC) to timeout from now
+	static inline void deadline_after(struct timespec *deadline, const struct timespec *timeout) {
+		clock_gettime(CLOCK_MONOTONIC, deadline);
+		deadline->tv_sec += timeout->tv_sec;
+		deadline->tv_nsec += timeout->tv_nsec;
+		if (deadline->tv_nsec >= 1000000000L) {
+			deadline->tv_nsec -= 1000000000L;
+			deadline->tv_sec++;
+		}
+	}
+
+	// Stores the time left until deadline in left, returns false if it has passed
+	static inline bool time_left(const struct timespec *deadline, struct timespec *left) {
+		struct timespec now;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		left->tv_sec = deadline->tv_sec - now.tv_sec;
+		left->tv_nsec = deadline->tv_nsec - now.tv_nsec;
+		if (left->tv_nsec < 0) {
+			left->tv_nsec += 1000000000L;
+			left->tv_sec--;
+		}
+
+		return left->tv_sec >= 0;
+	}
+
+	/* Blocks until the sequence of protect differs from *seq and no RT write
+	 * is in progress, at most timeout (relative, NULL for no limit). Stores
+	 * the new sequence in *seq. Returns 0 or -ETIMEDOUT. */
+	static inline int protect_wait_for_update(const struct protect *protect, seq_t *seq,
+						  const struct timespec *timeout) {
+		struct timespec deadline, left;
+		seq_t sequence;
+
+		if (timeout != NULL)
+			deadline_after(&deadline, timeout);
+
+		for (;;) {
+			sequence = load_acquire(&protect->sequence);
+			if (seq_updated(sequence, *seq)) {
+				*seq = sequence;
+				return 0;
+			}
+
+			if (timeout != NULL && !time_left(&deadline, &left))
+				return -ETIMEDOUT;
+
+			// Also sleeps through RT writes: they only wake waiters when they end
+			seq_wait(protect, sequence, timeout != NULL ? &left : NULL);
+		}
+	}
+
+	// Region is shared<T> or nbuf_shared<T, N>
+	template <typename Region>
+	static inline int wait_for_update(const Region *region, seq_t *seq,
+					  const struct timespec *timeout) {
+		return protect_wait_for_update(&region->protect, seq, timeout);
+	}
+
+	// Prepares waiting on region, seq is the last sequence the caller has seen
+	template <typename Region>
+	static inline void update_wait_init(struct update_wait *wait, const Region *region, seq_t seq) {
+		wait->protect = &region->protect;
+		wait->seq = seq;
+		wait->updated = false;
+	}
+
+	/* Blocks until at least one of the count regions of waits is updated, at
+	 * most timeout (relative, NULL for no limit). Sets updated and seq of
+	 * every updated region. Returns the number of updated regions,
+	 * -ETIMEDOUT or -EINVAL.
+	 * NOTE: Kernels before 5.16 lack futex_waitv(). There, the caller sleeps
+	 * on one region at a time for at most a millisecond, so updates of the
+	 * other regions are noticed with up to 1 ms delay. */
+	static inline int wait_for_updates(struct update_wait *waits, unsigned int count,
+					   const struct timespec *timeout) {
+		struct futex_waiter futexes[UPDATE_WAIT_MAX];
+		struct timespec deadline, left;
+		unsigned int next = 0;
+		int updated, ret;
+
+		if (count == 0 || count > UPDATE_WAIT_MAX)
+			return -EINVAL;
+
+		if (timeout != NULL)
+			deadline_after(&deadline, timeout);
+
+		for (;;) {
+			updated = 0;
+			for (unsigned int i = 0; i < count; i++) {
+				seq_t sequence = load_acquire(&waits[i].protect->sequence);
+
+				waits[i].updated = seq_updated(sequence, waits[i].seq);
+				if (waits[i].updated) {
+					waits[i].seq = sequence;
+					updated++;
+				}
+
+				futexes[i].val = (unsigned int)sequence;
+				futexes[i].uaddr = (uintptr_t)seq_futex(waits[i].protect);
+				futexes[i].reserved = 0;
+			}
+
+			if (updated > 0)
+				return updated;
+
+			if (timeout != NULL && !time_left(&deadline, &left))
+				return -ETIMEDOUT;
+
+			// Full barrier, see seq_wait()
+			for (unsigned int i = 0; i < count; i++)
+				add_full(&const_cast<struct protect*>(waits[i].protect)->waiters, 1U);
+
+			ret = futex_waitv(futexes, count, timeout != NULL ? &deadline : NULL);
+			if (ret == -ENOSYS) {
+				struct timespec slice = { 0, 1000000L };
+
+				if (timeout != NULL && (left.tv_sec == 0 && left.tv_nsec < slice.tv_nsec))
+					slice = left;
+				futex_wait(seq_futex(waits[next].protect), futexes[next].val, &slice);
+				next = (next + 1) % count;
+			}
+
+			for (unsigned int i = 0; i < count; i++)
+				add_relaxed(&const_cast<struct protect*>(waits[i].protect)->waiters, -1U);
+		}
+	}
+}; // namespace androit
+
+#endif /* ANDROIT_SHMEM_WAIT_H */
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+ *           (C) 2012 Marvin Damschen
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <jni.h>
+#include <stdint.h>
+#include <time.h>
+#include <AndroitShmemChannel.h>
+#include <AndroitShmemLog.h>
+#include <AndroitShmemTransport.h>
+
+using namespace androit;
+
+// Channels are passed to java as handles: their address in this process
+static inline struct channel *getChannelOf(jlong handle) {
+	return (struct channel*)(intptr_t)handle;
+}
+
+// Converts a timeout in milliseconds (negative: no limit) to a timespec, returns NULL for no limit
+static inline const struct timespec *toTimeout(jint timeoutMs, struct timespec *timeout) {
+	if (timeoutMs < 0)
+		return NULL;
+
+	timeout->tv_sec = timeoutMs / 1000;
+	timeout->tv_nsec = (timeoutMs % 1000) * 1000000L;
+	return timeout;
+}
+
+// Attaches to channel name, returns its handle or 0 if it is not available
+extern "C"
+jlong Java_com_androit_EventChannel_attach(JNIEnv *env, jclass clazz, jstring name) {
+	const char *chars = env->GetStringUTFChars(name, NULL);
+	struct channel *ch;
+
+	if (chars == NULL)
+		return 0;
+
+	ch = getChannel(chars);
+	if (ch == NULL)
+		LOGE("Error: Androit channel %s not available\n", chars);
+	env->ReleaseStringUTFChars(name, chars);
+
+	return (jlong)(intptr_t)ch;
+}
+
+extern "C"
+jint Java_com_androit_EventChannel_messageSize(JNIEnv *env, jclass clazz, jlong handle) {
+	return getChannelOf(handle)->msg_size;
+}
+
+extern "C"
+jlong Java_com_androit_EventChannel_dropped(JNIEnv *env, jclass clazz, jlong handle) {
+	return getChannelOf(handle)->dropped;
+}
+
+// Sends len bytes of msg, see channel_send(). Returns 0 or -errno.
+extern "C"
+jint Java_com_androit_EventChannel_send(JNIEnv *env, jclass clazz, jlong handle, jbyteArray msg,
+					jint len, jint timeoutMs) {
+	struct channel *ch = getChannelOf(handle);
+	struct timespec timeout;
+	jbyte *bytes;
+	int ret;
+
+	if (len < 0 || len > env->GetArrayLength(msg))
+		return -EINVAL;
+
+	// Not a critical section: a blocking send must not hold up the garbage collector
+	bytes = env->GetByteArrayElements(msg, NULL);
+	if (bytes == NULL)
+		return -ENOMEM;
+
+	ret = channel_send(ch, bytes, len, toTimeout(timeoutMs, &timeout));
+	env->ReleaseByteArrayElements(msg, bytes, JNI_ABORT);
+
+	return ret;
+}
+
+/* Waits at most timeoutMs (negative: no limit, 0: not at all) for messages
+ * and receives up to lens.length of them into the direct buffer buf:
+ * message i at i * messageSize(), its length in lens[i]. Returns the
+ * number of messages, 0 on timeout or -errno. */
+extern "C"
+jint Java_com_androit_EventChannel_receive(JNIEnv *env, jclass clazz, jlong handle, jobject buf,
+					   jintArray lens, jint timeoutMs) {
+	struct channel *ch = getChannelOf(handle);
+	unsigned int counts[256];
+	jint result[256];
+	struct timespec timeout;
+	unsigned int max, count;
+	void *base = env->GetDirectBufferAddress(buf);
+	jlong capacity = env->GetDirectBufferCapacity(buf);
+
+	if (base == NULL || capacity < 0)
+		return -EINVAL;
+
+	max = env->GetArrayLength(lens);
+	if (max > sizeof(counts) / sizeof(counts[0]))
+		max = sizeof(counts) / sizeof(counts[0]);
+	if ((jlong)max * ch->msg_size > capacity)
+		max = capacity / ch->msg_size;
+	if (max == 0)
+		return -EINVAL;
+
+	if (timeoutMs != 0 && channel_wait(ch, toTimeout(timeoutMs, &timeout)) != 0)
+		return 0;
+
+	count = channel_receive(ch, base, counts, max);
+	for (unsigned int i = 0; i < count; i++)
+		result[i] = counts[i];
+	env->SetIntArrayRegion(lens, 0, count, result);
+
+	return count;
+}
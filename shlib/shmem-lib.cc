@@ -16,119 +16,182 @@
  */
 
 #include <jni.h>
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
 #include <stddef.h>
+#include <pthread.h>
 #include <sys/mman.h>
-#include <android/log.h>
-#include <IAndroitShmem.h>
-#include <binder/MemoryHeapBase.h>
-#include <binder/IServiceManager.h>
+#include <unistd.h>
+#include <AndroitShmem.h>
+#include <AndroitShmemApply.h>
+#include <AndroitShmemAttach.h>
+#include <AndroitShmemBatch.h>
+#include <AndroitShmemDataAccess.h>
+#include <AndroitShmemHistory.h>
+#include <AndroitShmemLog.h>
+#include <AndroitShmemProject.h>
+#include <AndroitShmemTransport.h>
+#include <AndroitShmemWait.h>
 
-using namespace android;
 using namespace androit;
 
-// Function for client to obtain pointer to shared memory
-struct shared* getSharedData(void) {
-	static sp<IAndroitShmem> androitShmem = NULL;
-	static sp<IMemoryHeap> receiverMemBase = NULL;
+// Region and its ByteBuffer, set up once per process
+static shared<data_struct> *sharedData;
+static struct attachment sharedAttachment = { NULL, 0, -1, 0 };
+static jobject sharedBuffer;
+static pthread_mutex_t setupLock = PTHREAD_MUTEX_INITIALIZER;
+// History of the region, NULL if the server keeps none
+static struct history *sharedHistory;
+static bool historyAttached;
+// Apply queue of the region, NULL if the server keeps none
+static struct apply_queue *sharedApply;
+static bool applyAttached;
 
-	sp<IBinder> binder;
-	
-	// Acquire remote interface to AndroitShmem service from ServiceManager
-	if (androitShmem == NULL) {
-		sp<IServiceManager> sm = defaultServiceManager();
-		binder = sm->getService(String16("vendor.androit.shmem"));
+// Versions readHistory() returns per call at most
+enum {
+	HISTORY_READ_MAX = 256
+};
+
+// Function for client to obtain pointer to shared memory
+shared<data_struct> *getSharedData(void) {
+	shared<data_struct> *container = sharedData;
 
-		if (binder != 0) {
-			androitShmem = IAndroitShmem::asInterface(binder);
+	/* Attached once (directly if possible, see AndroitShmemAttach.h), the
+	 * mapping stays for the lifetime of the process: the ByteBuffer of
+	 * the Java side refers to it. */
+	if (container == NULL) {
+		pthread_mutex_lock(&setupLock);
+		container = sharedData;
+		if (container == NULL) {
+			container = attach_region<shared<data_struct> >("map", &sharedAttachment);
+			sharedData = container;
 		}
+		pthread_mutex_unlock(&setupLock);
 	}
-	
-	// Abort if AndroitShmem service is not published
-	if (androitShmem == NULL) {
-		LOGE("The AndroitShmem service is not published");
-		return NULL;
+
+	return container;
+}
+
+// Returns the history of the region, writers record into it if it exists
+static struct history *getSharedHistory(void) {
+	if (!historyAttached) {
+		pthread_mutex_lock(&setupLock);
+		if (!historyAttached) {
+			sharedHistory = getHistory<data_struct>("map.history");
+			historyAttached = true;
+		}
+		pthread_mutex_unlock(&setupLock);
 	}
-	
-	// Acquire pointer to shared MemoryHeap from AndroitShmem service if not already done
-	if (receiverMemBase == NULL) {
-		LOGD("Getting handle to shared data via binder...");
-		receiverMemBase = androitShmem->getShmem();		
+
+	return sharedHistory;
+}
+
+// Returns the apply queue of the region, starved non-RT writers delegate to it if it exists
+static struct apply_queue *getSharedApply(void) {
+	if (!applyAttached) {
+		pthread_mutex_lock(&setupLock);
+		if (!applyAttached) {
+			sharedApply = getApplyQueue<data_struct>("map.apply");
+			applyAttached = true;
+		}
+		pthread_mutex_unlock(&setupLock);
 	}
-	
-	// Return pointer to shared memory
-	return (struct shared*)receiverMemBase->getBase();
+
+	return sharedApply;
+}
+
+// Returns the spin budget for seq_begin(), negative values select the default
+static inline unsigned int spinBudget(jint spin) {
+	return spin < 0 ? (unsigned int)SEQ_SPIN_DEFAULT : (unsigned int)spin;
 }
 
 
-// Function to pass the shared memory to the java application
+/* Function to pass the shared memory to the java application. The buffer
+ * is created once and cached as a global reference, later calls return it
+ * without further work. */
 extern "C"
 jobject Java_com_androit_SharedMem_getByteBuffer(JNIEnv *env, jobject thiz) {
-	struct shared *container;
-	void *ptr;
-	jobject bb = NULL;
-	int active_data;
-	
-	container = getSharedData();
+	shared<data_struct> *container;
+	jobject bb;
 
-	if(container != NULL) {
-		// Create instantiate ByteBuffer object, encapsulating shared memory for java application
-		bb = env->NewDirectByteBuffer(container, sizeof(struct shared));
-		
-		// Determine active data copy by looking at 1-bit of sequence for debug output
-		active_data = container->protect.sequence & 1;
-		LOGD("AndroitShmem content: base=%p, active=%d, integer=%d, float=%f", 
-		     container, active_data, container->data[active_data].integer, container->data[active_data].fp);
+	if (sharedBuffer != NULL)
+		return sharedBuffer;
 
-		// Sanity check: Both addresses must be identical
-		ptr = env->GetDirectBufferAddress(bb);
-		LOGD("Mapped addresss: %p, %p", container, ptr);
+	container = getSharedData();
+	if (container == NULL) {
+		LOGE("Error: Androit shared memory not available\n");
+		return NULL;
+	}
 
-		if ((void*)container != ptr) {
-			LOGE("Internal error: container != ptr!");
+	pthread_mutex_lock(&setupLock);
+	if (sharedBuffer == NULL) {
+		// Create instantiate ByteBuffer object, encapsulating shared memory for java application
+		bb = env->NewDirectByteBuffer(container, sizeof(shared<data_struct>));
+		if (bb != NULL) {
+			sharedBuffer = env->NewGlobalRef(bb);
+			env->DeleteLocalRef(bb);
 		}
+
+		LOGD("AndroitShmem content: base=%p, integer=%d, float=%f", container,
+		     container->data[container->protect.sequence & 1].integer,
+		     container->data[container->protect.sequence & 1].fp);
 	}
-	else {
-		LOGE("Error: Androit shared memory not available\n");
-	}
+	pthread_mutex_unlock(&setupLock);
 
-	return bb;
+	return sharedBuffer;
 }
 
 // Procedure for the non-RT client to update the shared data
 extern "C"
 void Java_com_androit_SharedMem_updateByteBuffer(JNIEnv *, jobject, jfloat updateFloat, jint updateInt) {
-	struct shared *container;
-	unsigned int start_seq;
-	int update_data;
+	shared<data_struct> *container;
+	struct data_struct *update;
+	struct transaction tx;
+	struct apply_queue *queue = getSharedApply();
+	unsigned int attempts = 0;
+	int ret;
 	
 	container = getSharedData();
 	
 	if(container != NULL) {
 		begin_nonrt_write(container);
+		nonrt_start(container, &tx);
 		
-		// Determine inactive data copy to update it. It is alway outdated
-		update_data = 1 - (container->protect.sequence & 1);
-		
-		do {
-			start_seq = seq_begin(container);
+		for (;;) {
+			/* Determine inactive data copy to update it. Only blocks modified
+			 * since it was last consistent to the active copy are copied. */
+			update = nonrt_begin(container, &tx);
 			
 			// Actual update
-			container->data[update_data].fp = (float) updateFloat;
-			container->data[update_data].integer = (int) updateInt;
-			// Copy current array values to make inactive copy consistent to active copy
-			for (int i = 0; i < 1024; i++)
-				container->data[update_data].arbitrary[i] = container->data[1-update_data].arbitrary[i];
+			nonrt_mark_dirty(container, &tx, &update->integer, sizeof(update->integer) + sizeof(update->fp));
+			update->fp = (float) updateFloat;
+			update->integer = (int) updateInt;
 				
 			sleep(3); // For TESTING
 			
-			/* Compare sequence counter value before write to inactive data copy to current value.
-			 * 		- if equal: data still consistent, make inactive data copy active (invert 1-bit) and 
-			 * 			increase sequence counter (by 4, because 2-bit denotes "RT-Write in progress").
-			 * 		- if unequal: retry update 
-			 * This happens atomically (CAS, compare and swap) */
-		} while (!__sync_bool_compare_and_swap(&container->protect.sequence, start_seq, (start_seq+4)^1));
+			// Make the update visible, retry if an RT write interfered
+			if (nonrt_commit(container, &tx, getSharedHistory()))
+				break;
+
+			// Starved by RT writes: have the service apply the update, see AndroitShmemApply.h
+			if (queue != NULL && ++attempts >= APPLY_RETRIES) {
+				char buf[batch_record_size(sizeof(update->integer)) + batch_record_size(sizeof(update->fp))];
+				struct write_batch batch;
+				int integer = (int) updateInt;
+				float fp = (float) updateFloat;
+
+				batch_init(&batch, buf, sizeof(buf));
+				batch_add(&batch, offsetof(data_struct, integer), &integer, sizeof(integer));
+				batch_add(&batch, offsetof(data_struct, fp), &fp, sizeof(fp));
+				ret = nonrt_delegate(container, queue, batch.buf, batch.used);
+				if (ret == 0)
+					break;
+				// Nobody applies the queue (no drain thread): keep retrying
+				if (ret == -ETIMEDOUT)
+					queue = NULL;
+			}
+		}
 		
 		// Update finished
 		end_nonrt_write(container);
@@ -142,22 +205,199 @@ void Java_com_androit_SharedMem_updateByteBuffer(JNIEnv *, jobject, jfloat updat
 extern "C"
 jint Java_com_androit_SharedMem_getActiveDataOffset(JNIEnv *env, jobject thiz) {
 	size_t data_offset;
-	struct shared *container;
+	shared<data_struct> *container;
 	
 	container = getSharedData();
-	data_offset = offsetof(struct shared, data);
+	data_offset = offsetof(shared<data_struct>, data);
 	
-	// If second data copy is active, offset is moved there
-	return data_offset + (container->protect.sequence & 1)*sizeof(struct data_struct);
+	// If second data copy is active, offset is moved there (copies are padded, see data_copy)
+	return data_offset + (container->protect.sequence & 1)*sizeof(container->data[0]);
 }
 
 // NOTE: jlong is used on purpose here; java does not support unsigned
-// types, but since jlong is 64 bytes, the complete spectrum of unsigned int 
-// is guaranteed to fit into it.
+// types. Sequences are 64 bits wide but stay below 2^63 for centuries of
+// commits, so they are never negative as jlong.
 extern "C"
 jlong Java_com_androit_SharedMem_getSeqCount(JNIEnv *env, jobject thiz) {
-	struct shared *container = getSharedData();
+	shared<data_struct> *container = getSharedData();
+
+	return load_acquire(&container->protect.sequence);
+}
+
+/* Waits for RT writes to finish and returns the sequence value a read starts
+ * with: spins for spin iterations, then sleeps until the RT writer is done. */
+extern "C"
+jlong Java_com_androit_SharedMem_waitSeqBegin(JNIEnv *env, jobject thiz, jint spin) {
+	shared<data_struct> *container = getSharedData();
+
+	return seq_begin(container, spinBudget(spin));
+}
+
+/* Blocks until the sequence differs from lastSeq and no RT write is in
+ * progress, at most timeoutMs milliseconds (negative: no limit). Returns
+ * the new sequence, or -1 on timeout. */
+extern "C"
+jlong Java_com_androit_SharedMem_waitSeqUpdate(JNIEnv *env, jobject thiz, jlong lastSeq, jint timeoutMs) {
+	shared<data_struct> *container = getSharedData();
+	seq_t seq = (seq_t)lastSeq;
+	struct timespec timeout;
+
+	if (container == NULL)
+		return -1;
+
+	timeout.tv_sec = timeoutMs / 1000;
+	timeout.tv_nsec = (timeoutMs % 1000) * 1000000L;
+
+	if (wait_for_update(container, &seq, timeoutMs < 0 ? NULL : &timeout) != 0)
+		return -1;
+
+	return seq;
+}
+
+/* Copies len bytes at offset of the data (a data_struct) consistently into
+ * the direct buffer dst, in one JNI transition. Returns the sequence the
+ * copy is valid at, or -1 if the region or dst are not available or the
+ * range does not fit. */
+extern "C"
+jlong Java_com_androit_SharedMem_readData(JNIEnv *env, jobject thiz, jobject dst, jint offset, jint len,
+					  jint spin) {
+	shared<data_struct> *container = getSharedData();
+	void *buf = env->GetDirectBufferAddress(dst);
+
+	if (container == NULL || buf == NULL || offset < 0 || len < 0 ||
+	    (size_t)offset + len > sizeof(data_struct) || len > env->GetDirectBufferCapacity(dst))
+		return -1;
+
+	return seq_copy(container, offset, buf, len, spinBudget(spin));
+}
+
+/* Copies count elements of arbitrary[], starting at first, consistently
+ * into dst. Returns the sequence the copy is valid at, or -1. */
+extern "C"
+jlong Java_com_androit_SharedMem_readArbitrary(JNIEnv *env, jobject thiz, jlongArray dst, jint first,
+					       jint count, jint spin) {
+	shared<data_struct> *container = getSharedData();
+	int64_t copy[data_struct_layout::arbitrary_length];
+	int64_t seq;
+
+	if (container == NULL || first < 0 || count < 0 || count > env->GetArrayLength(dst))
+		return -1;
+
+	// Copy via the stack: seq_copy() may sleep, the array must not be pinned meanwhile
+	seq = data_struct_arbitrary_read(container, first, count, copy, spinBudget(spin));
+	if (seq < 0)
+		return -1;
+	env->SetLongArrayRegion(dst, 0, count, (const jlong*)copy);
+
+	return seq;
+}
+
+/* Like readArbitrary(), but into the direct buffer dst (a LongBuffer in
+ * native byte order), without a copy through the stack. */
+extern "C"
+jlong Java_com_androit_SharedMem_readArbitraryBuffer(JNIEnv *env, jobject thiz, jobject dst, jint first,
+						     jint count, jint spin) {
+	shared<data_struct> *container = getSharedData();
+	int64_t *buf = (int64_t*)env->GetDirectBufferAddress(dst);
+	int64_t seq;
+
+	// The capacity of a LongBuffer is counted in elements
+	if (container == NULL || buf == NULL || first < 0 || count < 0 || count > env->GetDirectBufferCapacity(dst))
+		return -1;
+
+	seq = data_struct_arbitrary_read(container, first, count, buf, spinBudget(spin));
+	return seq < 0 ? -1 : seq;
+}
+
+static_assert(sizeof(struct projection) == 2 * sizeof(jint), "ranges are copied into projections as they are");
+
+/* Copies the ranges given by the offset/length pairs ranges[0..2 * count)
+ * back to back into the direct buffer dst, consistently in one read.
+ * Returns the sequence the copy is valid at, or -1. */
+extern "C"
+jlong Java_com_androit_SharedMem_readProjection(JNIEnv *env, jobject thiz, jobject dst, jintArray ranges,
+						jint count, jint spin) {
+	shared<data_struct> *container = getSharedData();
+	void *buf = env->GetDirectBufferAddress(dst);
+	struct projection list[PROJECTION_MAX];
+	ssize_t size;
+
+	if (container == NULL || buf == NULL || count < 0 || count > PROJECTION_MAX ||
+	    2 * count > env->GetArrayLength(ranges))
+		return -1;
+
+	// Negative offsets and lengths turn into huge ones, projection_size() rejects them
+	env->GetIntArrayRegion(ranges, 0, 2 * count, (jint*)list);
+	size = projection_size(list, count, sizeof(data_struct));
+	if (size < 0 || size > env->GetDirectBufferCapacity(dst))
+		return -1;
+
+	return seq_project(container, list, count, buf, spinBudget(spin));
+}
+
+// Layout hash of data_struct this library was built with, checked by SharedMem against DataStruct
+extern "C"
+jint Java_com_androit_SharedMem_getLayoutHash(JNIEnv *env, jclass clazz) {
+	return layout_hash<data_struct>::value;
+}
+
+/* Applies the used bytes of write batch records in the direct buffer buf as
+ * one non-RT transaction, handed to the apply queue of the region if RT
+ * writes keep interfering. Returns 0 or -errno. */
+extern "C"
+jint Java_com_androit_WriteBatch_commit(JNIEnv *env, jclass clazz, jobject buf, jint used) {
+	shared<data_struct> *container = getSharedData();
+	void *records = env->GetDirectBufferAddress(buf);
+
+	if (container == NULL)
+		return -ENODEV;
+	if (records == NULL || used < 0 || used > env->GetDirectBufferCapacity(buf))
+		return -EINVAL;
+
+	return nonrt_write_batch(container, records, used, getSharedHistory(), getSharedApply());
+}
+
+/* Copies len bytes at offset of every version committed after sequence
+ * since (-1: of every version the history holds), oldest first,
+ * to dst + i * len, and their sequences and commit times to seqs[i] and
+ * timesNs[i]. lost[0] tells whether versions after since were overwritten.
+ * Returns the number of versions, or -1 if there is no history or the
+ * arguments do not fit. */
+extern "C"
+jint Java_com_androit_SharedMem_readHistory(JNIEnv *env, jobject thiz, jlong since, jobject dst, jint offset,
+					    jint len, jlongArray seqs, jlongArray timesNs, jbooleanArray lost) {
+	struct history *hist = getSharedHistory();
+	char *buf = (char*)env->GetDirectBufferAddress(dst);
+	struct history_stamp stamps[HISTORY_READ_MAX];
+	jlong seq[HISTORY_READ_MAX], time[HISTORY_READ_MAX];
+	unsigned int max = HISTORY_READ_MAX;
+	jboolean gap;
+	bool was_lost;
+	int count;
+
+	if (hist == NULL || buf == NULL || offset < 0 || len <= 0)
+		return -1;
+
+	if ((jlong)max * len > env->GetDirectBufferCapacity(dst))
+		max = env->GetDirectBufferCapacity(dst) / len;
+	if ((jsize)max > env->GetArrayLength(seqs))
+		max = env->GetArrayLength(seqs);
+	if ((jsize)max > env->GetArrayLength(timesNs))
+		max = env->GetArrayLength(timesNs);
+
+	count = history_read(hist, (seq_t)since, offset, len, buf, stamps, max, &was_lost);
+	if (count < 0)
+		return -1;
+
+	for (int i = 0; i < count; i++) {
+		seq[i] = stamps[i].seq;
+		time[i] = stamps[i].time_ns;
+	}
+	env->SetLongArrayRegion(seqs, 0, count, seq);
+	env->SetLongArrayRegion(timesNs, 0, count, time);
+	gap = was_lost ? JNI_TRUE : JNI_FALSE;
+	if (env->GetArrayLength(lost) > 0)
+		env->SetBooleanArrayRegion(lost, 0, 1, &gap);
 
-	// sequence only changed by __sync* built-ins, therefore no additional memory barriers needed
-	return container->protect.sequence;
+	return count;
 }
@@ -0,0 +1,365 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2012 Wolfgang Mauerer, Siemens AG
+#           (C) 2012 Marvin Damschen
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Generates the data structs of AndroitShmem regions from a schema.
+
+For every struct of the schema, emits
+  - the C++ struct, a <name>_layout struct of constexpr offsets and
+    static_asserts that the compiler agrees with them (--header),
+  - inline helpers that read fields of a region consistently and add
+    updates to write batches (--access),
+  - a java class of constant offsets and getters on a snapshot buffer
+    (--java-dir, --java-package),
+and a layout hash that regions record and clients check when attaching.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+# Schema type: (C++ type, size, java type, ByteBuffer accessor suffix)
+TYPES = {
+    "int8": ("int8_t", 1, "byte", ""),
+    "int16": ("int16_t", 2, "short", "Short"),
+    "int32": ("int32_t", 4, "int", "Int"),
+    "int64": ("int64_t", 8, "long", "Long"),
+    "float32": ("float", 4, "float", "Float"),
+    "float64": ("double", 8, "double", "Double"),
+}
+
+HEADER_NOTE = "Generated by tools/shmemgen.py from %s, do not edit."
+
+
+class Field(object):
+    def __init__(self, type_name, name, length):
+        self.type_name = type_name
+        self.name = name
+        self.length = length  # None for scalars
+        self.offset = 0
+
+    @property
+    def size(self):
+        return TYPES[self.type_name][1] * (self.length or 1)
+
+
+class Struct(object):
+    def __init__(self, name, comment):
+        self.name = name
+        self.comment = comment
+        self.fields = []
+        self.size = 0
+        self.hash = 0
+
+    def layout(self):
+        offset, align = 0, 1
+        for field in self.fields:
+            field_align = TYPES[field.type_name][1]
+            offset = (offset + field_align - 1) // field_align * field_align
+            field.offset = offset
+            offset += field.size
+            align = max(align, field_align)
+        self.size = (offset + align - 1) // align * align
+        self.hash = fnv1a(self.canonical())
+
+    def canonical(self):
+        fields = ";".join("%s %s%s@%d" % (f.type_name, f.name,
+                                          "[%d]" % f.length if f.length else "", f.offset)
+                          for f in self.fields)
+        return "%s{%s}%d" % (self.name, fields, self.size)
+
+    @property
+    def java_name(self):
+        return "".join(part.capitalize() for part in self.name.split("_"))
+
+
+def fnv1a(text):
+    value = 0x811c9dc5
+    for byte in text.encode("ascii"):
+        value = ((value ^ byte) * 0x01000193) & 0xffffffff
+    return value
+
+
+def parse(path):
+    structs, comment, current = [], [], None
+    field_re = re.compile(r"^(\w+)\s+(\w+)(?:\[(\d+)\])?\s*;$")
+
+    with open(path) as schema:
+        for number, line in enumerate(schema, 1):
+            line = line.strip()
+
+            def fail(message):
+                sys.exit("%s:%d: %s" % (path, number, message))
+
+            if not line:
+                comment = []
+            elif line.startswith("#"):
+                comment.append(line[1:].strip())
+            elif current is None:
+                match = re.match(r"^struct\s+(\w+)\s*\{$", line)
+                if not match:
+                    fail("expected 'struct <name> {'")
+                current = Struct(match.group(1), comment)
+                comment = []
+            elif line in ("};", "}"):
+                if not current.fields:
+                    fail("struct %s has no fields" % current.name)
+                current.layout()
+                structs.append(current)
+                current = None
+            else:
+                match = field_re.match(line)
+                if not match:
+                    fail("expected '<type> <name>;' or '<type> <name>[<n>];'")
+                type_name, name, length = match.groups()
+                if type_name not in TYPES:
+                    fail("unknown type %s" % type_name)
+                if length is not None and int(length) == 0:
+                    fail("array %s is empty" % name)
+                if any(f.name == name for f in current.fields):
+                    fail("duplicate field %s" % name)
+                current.fields.append(Field(type_name, name, int(length) if length else None))
+
+    if current is not None:
+        sys.exit("%s: struct %s is not closed" % (path, current.name))
+    if not structs:
+        sys.exit("%s: no structs" % path)
+
+    return structs
+
+
+def license_header(prefix=" *", start="/*", end=" */"):
+    lines = [
+        "Copyright (C) 2012 Wolfgang Mauerer, Siemens AG",
+        "          (C) 2012 Marvin Damschen",
+        "",
+        "Licensed under the Apache License, Version 2.0 (the \"License\");",
+        "you may not use this file except in compliance with the License.",
+        "You may obtain a copy of the License at",
+        "",
+        "     http://www.apache.org/licenses/LICENSE-2.0",
+        "",
+        "Unless required by applicable law or agreed to in writing, software",
+        "distributed under the License is distributed on an \"AS IS\" BASIS,",
+        "WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.",
+        "See the License for the specific language governing permissions and",
+        "limitations under the License.",
+    ]
+    return "\n".join([start] + [(prefix + " " + l).rstrip() for l in lines] + [end]) + "\n"
+
+
+def cpp_header(structs, schema):
+    out = [license_header(), "\n",
+           "#ifndef ANDROIT_SHMEM_DATA_H\n#define ANDROIT_SHMEM_DATA_H\n\n",
+           "// %s\n\n" % (HEADER_NOTE % schema),
+           "#include <stddef.h>\n#include <stdint.h>\n\n",
+           "#include <AndroitShmemSchema.h>\n\n",
+           "namespace androit {\n"]
+
+    for s in structs:
+        for line in s.comment:
+            out.append("\t// %s\n" % line if line else "\t//\n")
+        out.append("\tstruct %s {\n" % s.name)
+        for f in s.fields:
+            out.append("\t\t%s %s%s;\n" % (TYPES[f.type_name][0], f.name,
+                                          "[%d]" % f.length if f.length else ""))
+        out.append("\t};\n\n")
+
+        out.append("\t// Layout of %s as laid down in the schema\n" % s.name)
+        out.append("\tstruct %s_layout {\n" % s.name)
+        for f in s.fields:
+            out.append("\t\tstatic constexpr size_t %s = %d;\n" % (f.name, f.offset))
+            if f.length:
+                out.append("\t\tstatic constexpr size_t %s_length = %d;\n" % (f.name, f.length))
+        out.append("\t\tstatic constexpr size_t size = %d;\n" % s.size)
+        out.append("\t\tstatic constexpr uint32_t hash = 0x%08xU;\n" % s.hash)
+        out.append("\t};\n\n")
+
+        for f in s.fields:
+            out.append("\tstatic_assert(offsetof(struct %s, %s) == %s_layout::%s,\n"
+                       "\t\t      \"layout of %s differs from its schema\");\n"
+                       % (s.name, f.name, s.name, f.name, s.name))
+        out.append("\tstatic_assert(sizeof(struct %s) == %s_layout::size,\n"
+                   "\t\t      \"layout of %s differs from its schema\");\n\n" % (s.name, s.name, s.name))
+
+        out.append("\ttemplate <>\n\tstruct layout_hash<%s> {\n" % s.name)
+        out.append("\t\tstatic const uint32_t value = %s_layout::hash;\n\t};\n\n" % s.name)
+
+    out[-1] = out[-1].rstrip("\n") + "\n"
+    out.append("}; // namespace androit\n\n#endif /* ANDROIT_SHMEM_DATA_H */\n")
+    return "".join(out)
+
+
+def continuation(line):
+    """Returns the indentation aligning a continuation with the parenthesis of line"""
+    column = 0
+    for char in line[:line.index("(") + 1]:
+        column = (column // 8 + 1) * 8 if char == "\t" else column + 1
+    return "\t" * (column // 8) + " " * (column % 8)
+
+
+def signature(head, first, rest):
+    """Function head(first, rest) with rest on a continuation line"""
+    line = "\t%s(%s," % (head, first)
+    return "%s\n%s%s) {\n" % (line, continuation(line), rest)
+
+
+def cpp_access(structs, schema):
+    out = [license_header(), "\n",
+           "#ifndef ANDROIT_SHMEM_DATA_ACCESS_H\n#define ANDROIT_SHMEM_DATA_ACCESS_H\n\n",
+           "// %s\n\n" % (HEADER_NOTE % schema),
+           "/* Accessors of the fields of regions holding the data structs of the\n"
+           " * schema: reads are consistent (see seq_copy()), writes are added to a\n"
+           " * write batch (see AndroitShmemBatch.h). */\n\n",
+           "#include <errno.h>\n\n",
+           "#include <AndroitShmem.h>\n#include <AndroitShmemBatch.h>\n\n",
+           "namespace androit {\n"]
+
+    for s in structs:
+        for f in s.fields:
+            ctype = TYPES[f.type_name][0]
+            prefix = "%s_%s" % (s.name, f.name)
+            offset = "%s_layout::%s" % (s.name, f.name)
+            if f.length is None:
+                out.append(signature("static inline %s %s_read" % (ctype, prefix),
+                                     "const shared<%s> *region" % s.name,
+                                     "unsigned int spin = SEQ_SPIN_DEFAULT"))
+                out.append(
+                    "\t\t%(t)s value;\n\n"
+                    "\t\tseq_copy(region, %(o)s, &value, sizeof(value), spin);\n"
+                    "\t\treturn value;\n\t}\n\n"
+                    "\tstatic inline int %(p)s_write(struct write_batch *batch, %(t)s value) {\n"
+                    "\t\treturn batch_add(batch, %(o)s, &value, sizeof(value));\n\t}\n\n"
+                    % {"t": ctype, "p": prefix, "s": s.name, "o": offset})
+            else:
+                out.append(
+                    "\t/* Copies count elements from first on to dst, returns the sequence\n"
+                    "\t * the copy is valid at or -EINVAL. */\n")
+                out.append(signature("static inline int64_t %s_read" % prefix,
+                                     "const shared<%s> *region, size_t first, size_t count" % s.name,
+                                     "%s *dst, unsigned int spin = SEQ_SPIN_DEFAULT" % ctype))
+                out.append(
+                    "\t\tif (first > %(o)s_length || count > %(o)s_length - first)\n"
+                    "\t\t\treturn -EINVAL;\n\n"
+                    "\t\treturn seq_copy(region, %(o)s + first * sizeof(%(t)s), dst,\n"
+                    "\t\t\t\tcount * sizeof(%(t)s), spin);\n"
+                    "\t}\n\n"
+                    % {"t": ctype, "p": prefix, "s": s.name, "o": offset})
+                out.append(signature("static inline int %s_write" % prefix,
+                                     "struct write_batch *batch, size_t first",
+                                     "const %s *src, size_t count" % ctype))
+                out.append(
+                    "\t\tif (first > %(o)s_length || count > %(o)s_length - first)\n"
+                    "\t\t\treturn -EINVAL;\n\n"
+                    "\t\treturn batch_add(batch, %(o)s + first * sizeof(%(t)s), src,\n"
+                    "\t\t\t\t count * sizeof(%(t)s));\n"
+                    "\t}\n\n"
+                    % {"t": ctype, "p": prefix, "s": s.name, "o": offset})
+
+    out[-1] = out[-1].rstrip("\n") + "\n"
+    out.append("}; // namespace androit\n\n#endif /* ANDROIT_SHMEM_DATA_ACCESS_H */\n")
+    return "".join(out)
+
+
+def java_class(s, package, schema):
+    name = s.java_name
+    out = [license_header(" *"), "\n", "package %s;\n\n" % package,
+           "import java.nio.ByteBuffer;\nimport java.nio.ByteOrder;\n\n",
+           "// %s\n\n" % (HEADER_NOTE % schema),
+           "/* Layout of %s. Getters read a snapshot of the data (see\n"
+           " * SharedMem.readSnapshot()), setters add updates to a WriteBatch. */\n" % s.name,
+           "public final class %s {\n" % name]
+
+    for f in s.fields:
+        out.append("\tpublic static final int OFFSET_%s = %d;\n" % (f.name.upper(), f.offset))
+        if f.length:
+            out.append("\tpublic static final int LENGTH_%s = %d;\n" % (f.name.upper(), f.length))
+    out.append("\tpublic static final int SIZE = %d;\n" % s.size)
+    out.append("\tpublic static final int LAYOUT_HASH = 0x%08x;\n\n" % s.hash)
+    out.append("\tprivate final ByteBuffer buf;\n\t\n")
+    out.append("\t// Wraps a snapshot of at least SIZE bytes\n")
+    out.append("\tpublic %s(ByteBuffer snapshot) {\n" % name)
+    out.append("\t\tbuf = snapshot.duplicate().order(ByteOrder.nativeOrder());\n\t}\n")
+
+    for f in s.fields:
+        jtype, suffix = TYPES[f.type_name][2], TYPES[f.type_name][3]
+        size = TYPES[f.type_name][1]
+        camel = "".join(p[:1].upper() + p[1:] for p in f.name.split("_"))
+        const = "OFFSET_%s" % f.name.upper()
+        if f.length is None:
+            out.append("\t\n\tpublic %s get%s() {\n\t\treturn buf.get%s(%s);\n\t}\n"
+                       % (jtype, camel, suffix, const))
+            out.append("\t\n\tpublic static void set%s(WriteBatch batch, %s value) {\n"
+                       "\t\tbatch.put%s(%s, value);\n\t}\n"
+                       % (camel, jtype, suffix or "Byte", const))
+        else:
+            out.append("\t\n\tpublic %s get%s(int index) {\n\t\treturn buf.get%s(%s + index * %d);\n\t}\n"
+                       % (jtype, camel, suffix, const, size))
+            out.append("\t\n\t// Copies count elements from first on to dst[0 .. count)\n"
+                       "\tpublic void get%s(%s[] dst, int first, int count) {\n"
+                       "\t\tfor (int i = 0; i < count; i++)\n"
+                       "\t\t\tdst[i] = buf.get%s(%s + (first + i) * %d);\n\t}\n"
+                       % (camel, jtype, suffix, const, size))
+            out.append("\t\n\t// Stores src[srcFirst .. srcFirst + count) in elements first .. first + count\n"
+                       "\tpublic static void set%s(WriteBatch batch, int first, %s[] src, int srcFirst, int count) {\n"
+                       "\t\tbatch.put%ss(%s + first * %d, src, srcFirst, count);\n\t}\n"
+                       % (camel, jtype, suffix or "Byte", const, size))
+
+    out.append("}\n")
+    return "".join(out)
+
+
+def write(path, text):
+    # Keep the timestamp of unchanged files, builds do not redo their work
+    if os.path.exists(path):
+        with open(path) as old:
+            if old.read() == text:
+                return
+    with open(path, "w") as new:
+        new.write(text)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("schema")
+    parser.add_argument("--header", help="C++ header of the structs")
+    parser.add_argument("--access", help="C++ header of the accessors")
+    parser.add_argument("--java-dir", help="root of the java sources")
+    parser.add_argument("--java-package", default="com.androit")
+    parser.add_argument("--print-layout", action="store_true", help="print offsets and hashes")
+    args = parser.parse_args()
+
+    structs = parse(args.schema)
+    schema = os.path.relpath(args.schema).replace(os.sep, "/")
+
+    if args.header:
+        write(args.header, cpp_header(structs, schema))
+    if args.access:
+        write(args.access, cpp_access(structs, schema))
+    if args.java_dir:
+        directory = os.path.join(args.java_dir, *args.java_package.split("."))
+        for s in structs:
+            write(os.path.join(directory, s.java_name + ".java"), java_class(s, args.java_package, schema))
+    if args.print_layout:
+        for s in structs:
+            print("%s: %d bytes, hash 0x%08x" % (s.name, s.size, s.hash))
+            for f in s.fields:
+                print("  %-20s %6d %6d" % (f.name, f.offset, f.size))
+
+
+if __name__ == "__main__":
+    main()